@@ -1,7 +1,10 @@
 #include "Directive.hpp"
 
 #include "clang/AST/Comment.h"
+#include "clang/AST/CommentCommandTraits.h"
 #include "clang/AST/CommentVisitor.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
 
 /*
  * supported commands:
@@ -11,6 +14,11 @@
  * \omitBase <a list of base class names till next command>, don't generate code
  * for the specified bases
  *
+ * \trackDirty also generate <Record>Tracked, the record with a dirty bit per
+ * member and a setter per member that sets it, writeDelta(), which writes the
+ * dirty members only, and parsePatch(), which applies such a partial document
+ * to an existing object
+ *
  * FieldDirective:
  * \required this is a required field, if it is not present, bool valid()
  * returns false
@@ -49,13 +57,142 @@
  * \usrArry expresssion-statement, like \usrArray
  *
  * \array var, like \string
+ *
+ * \shortArray zero|reject, for a fixed-size array member: whether a json array
+ * with fewer elements zero-fills the rest, or fails the parse(the default).
+ * More elements always fail the parse.
+ *
+ * \intern [table], store the string in an InternTable, table or the global
+ * one, and the id, the const char * or a string view of it in the member
+ *
+ * \inlineString [reject|truncate|spill], copy the string into the member, a
+ * char[N] or a jsongen::InlineString<N>, instead of pointing to it. A longer
+ * string fails the parse(the default), is cut at a character boundary, or,
+ * for an InlineString only, is pointed to like a \cstring.
  */
 
-RecordDirective::RecordDirective(const clang::comments::FullComment*) {
-  is_empty = true;
+namespace {
+// a command and the text following it till the next command
+struct Command {
+  llvm::StringRef name;
+  std::string param;
+};
+
+void collectCommands(const clang::comments::Comment *c,
+                     const clang::comments::CommandTraits &traits,
+                     std::vector<Command> &out) {
+  using namespace clang::comments;
+  auto append = [&](llvm::StringRef text) {
+    if (!out.empty()) {
+      out.back().param += text;
+      out.back().param += ' ';
+    }
+  };
+  if (const auto *ic = llvm::dyn_cast<InlineCommandComment>(c)) {
+    // unknown commands are parsed as inline commands
+    out.push_back({ic->getCommandName(traits), std::string()});
+    for (unsigned i = 0, e = ic->getNumArgs(); i != e; ++i) {
+      append(ic->getArgText(i));
+    }
+    return;
+  }
+  if (const auto *bc = llvm::dyn_cast<BlockCommandComment>(c)) {
+    // commands registered with -fcomment-block-commands=
+    out.push_back({bc->getCommandName(traits), std::string()});
+    for (unsigned i = 0, e = bc->getNumArgs(); i != e; ++i) {
+      append(bc->getArgText(i));
+    }
+  } else if (const auto *tc = llvm::dyn_cast<TextComment>(c)) {
+    append(tc->getText());
+    return;
+  }
+  for (auto it = c->child_begin(), e = c->child_end(); it != e; ++it) {
+    collectCommands(*it, traits, out);
+  }
+}
+
+std::vector<Command>
+collectCommands(const clang::comments::FullComment *fc,
+                const clang::comments::CommandTraits *traits) {
+  std::vector<Command> commands;
+  if (fc && traits) {
+    collectCommands(fc, *traits, commands);
+  }
+  for (Command &c : commands) {
+    c.param = llvm::StringRef(c.param).trim().str();
+  }
+  return commands;
 }
+} // namespace
 
-FieldDirective::FieldDirective(const clang::comments::FullComment*) {
+RecordDirective::RecordDirective(const clang::comments::FullComment *fc,
+                                 const clang::comments::CommandTraits *traits) {
   is_empty = true;
+  is_check_specified = false;
+  is_track_dirty = false;
+  for (const Command &c : collectCommands(fc, traits)) {
+    if (c.name == "jsongen") {
+      is_empty = false;
+    } else if (c.name == "trackDirty") {
+      is_track_dirty = true;
+    } else if (c.name == "omitBase") {
+      llvm::SmallVector<llvm::StringRef, 4> names;
+      llvm::StringRef(c.param).split(names, ' ', -1, false);
+      for (llvm::StringRef name : names) {
+        omit_base.push_back(name.trim(",").str());
+      }
+    }
+  }
 }
 
+FieldDirective::FieldDirective(const clang::comments::FullComment *fc,
+                               const clang::comments::CommandTraits *traits) {
+  is_empty = true;
+  is_required = false;
+  is_omit = false;
+  is_c_string = false;
+  is_string_pointer = false;
+  is_string_length = false;
+  is_user_defined_string = false;
+  is_null_terminated_array = false;
+  is_array_pointer = false;
+  is_array_length = false;
+  is_user_defined_array = false;
+  is_zero_fill_array = false;
+  is_interned = false;
+  is_inline_string = false;
+  for (const Command &c : collectCommands(fc, traits)) {
+    if (c.name == "required") {
+      is_required = true;
+    } else if (c.name == "omit") {
+      is_omit = true;
+    } else if (c.name == "cstring") {
+      is_c_string = true;
+    } else if (c.name == "string") {
+      is_string_pointer = true;
+      param = c.param;
+    } else if (c.name == "usrString") {
+      is_user_defined_string = true;
+      param = c.param;
+    } else if (c.name == "nullArray") {
+      is_null_terminated_array = true;
+    } else if (c.name == "array") {
+      is_array_pointer = true;
+      param = c.param;
+    } else if (c.name == "usrArray") {
+      is_user_defined_array = true;
+      param = c.param;
+    } else if (c.name == "intern") {
+      is_interned = true;
+      param = c.param;
+    } else if (c.name == "inlineString") {
+      is_inline_string = true;
+      param = c.param;
+    } else if (c.name == "shortArray") {
+      is_zero_fill_array = c.param == "zero";
+    } else {
+      continue;
+    }
+    is_empty = false;
+  }
+}
@@ -10,15 +10,21 @@
 namespace clang {
 namespace comments {
 class FullComment;
+class CommandTraits;
 }
 } // namespace clang
 
 struct RecordDirective {
   bool is_empty : 1;
   bool is_check_specified : 1;
+  // generate <Record>Tracked, writeDelta() and parsePatch()
+  bool is_track_dirty : 1;
   std::vector<std::string> omit_base;
   std::vector<std::pair<std::string, std::string>> named_base;
-  RecordDirective(const clang::comments::FullComment *);
+  // traits is needed to know the command names, nullptr gives an empty
+  // directive
+  RecordDirective(const clang::comments::FullComment *,
+                  const clang::comments::CommandTraits *traits = nullptr);
   void Dump(llvm::raw_ostream & os) {
     if (is_empty) {
       os << "empty";
@@ -27,6 +33,9 @@ struct RecordDirective {
     if (is_check_specified) {
       os << "check_specified ";
     }
+    if (is_track_dirty) {
+      os << "track_dirty ";
+    }
     os << "omit_base: ";
     for (const auto & b : omit_base) {
       os << b << ' ';
@@ -53,10 +62,31 @@ struct FieldDirective {
   bool is_array_length : 1;
   bool is_user_defined_array : 1;
 
+  // a fixed-size array member may have fewer elements in json, the rest are
+  // zero-filled instead of failing the parse
+  bool is_zero_fill_array : 1;
+
+  // string values are looked up in an InternTable, param names it, the
+  // global one if empty; the member holds the id, the stable const char *
+  // or a string view of the interned copy, depending on its type
+  bool is_interned : 1;
+
+  // string values are copied into the member, a char[N] or a
+  // jsongen::InlineString<N>; param is what is done with longer ones:
+  // reject (the default), truncate or spill
+  bool is_inline_string : 1;
+
   // the meaning of this string depends on the previous bitfields
   std::string param;
 
-  FieldDirective(const clang::comments::FullComment *);
+  FieldDirective(const clang::comments::FullComment *,
+                 const clang::comments::CommandTraits *traits = nullptr);
+  // the directive, not the type of the member, decides how it is parsed
+  bool hasLayout() const {
+    return is_c_string || is_string_pointer || is_user_defined_string ||
+           is_null_terminated_array || is_array_pointer ||
+           is_user_defined_array || is_interned || is_inline_string;
+  }
   void Dump(llvm::raw_ostream & os) {
     if (is_empty) {
       os << "empty";
@@ -68,6 +98,9 @@ struct FieldDirective {
     if (is_omit) {
       os << "omit ";
     }
+    if (is_zero_fill_array) {
+      os << "zero-filled short array ";
+    }
     if (is_c_string) {
       os << "c-style string";
       return;
@@ -98,6 +131,16 @@ struct FieldDirective {
     }
     if (is_user_defined_array) {
       os << "user defined array with " << param;
+      return;
+    }
+    if (is_interned) {
+      os << "interned string in " << (param.empty() ? "global" : param);
+      return;
+    }
+    if (is_inline_string) {
+      os << "inline string, " << (param.empty() ? "reject" : param)
+         << " if longer";
+      return;
     }
     os << "wrong field directive: not empty but no content";
   }
@@ -0,0 +1,83 @@
+#pragma once
+
+// Files parsed in place: the generated parse_file() and parse_ndjson_file()
+// map the input instead of reading it into a heap buffer. Generated headers
+// include this file with the files plugin option only, it needs POSIX.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+
+namespace jsongen {
+
+// A private, writable mapping of a file, followed by at least one '\0' as
+// the in-situ parser expects. Writes by the parser stay in this process. The
+// \string and \cstring members of what is parsed from it point into the
+// mapping, keep the MappedFile as long as they are used.
+class MappedFile {
+  char *base = nullptr;
+  size_t mapped = 0;
+  size_t length = 0;
+
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() { close(); }
+
+  bool open(const char *path) {
+    close();
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      ::close(fd);
+      return false;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    // reserve one byte more than the file, rounded to pages: the file is
+    // mapped over the start, the tail of its last page and the page after it
+    // read as zeros
+    size_t total = (size + 1 + page - 1) / page * page;
+    void *p = mmap(nullptr, total, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      ::close(fd);
+      return false;
+    }
+    if (size &&
+        mmap(p, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd,
+             0) == MAP_FAILED) {
+      munmap(p, total);
+      ::close(fd);
+      return false;
+    }
+    ::close(fd);
+    if (size) {
+      madvise(p, size, MADV_SEQUENTIAL);
+    }
+    base = static_cast<char *>(p);
+    mapped = total;
+    length = size;
+    return true;
+  }
+  void close() {
+    if (base) {
+      munmap(base, mapped);
+    }
+    base = nullptr;
+    mapped = length = 0;
+  }
+
+  // null-terminated
+  char *data() const { return base; }
+  size_t size() const { return length; }
+};
+
+} // namespace jsongen
@@ -0,0 +1,147 @@
+#pragma once
+
+// A rapidjson Writer whose output is a list of iovecs, ready for writev() or
+// sendmsg(): long strings that need no escaping are referenced where they are
+// instead of being copied, only the rest of the text goes to a scratch buffer.
+// Every generated write() takes it as its Writer:
+//
+//   jsongen::GatherWriter writer;
+//   write(record, writer);
+//   const std::vector<iovec> &iov = writer.finish();
+//   writev(fd, iov.data(), iov.size());
+//
+// Not included by the generated headers, it needs POSIX.
+
+#include "JsonGenSimd.hpp"
+
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+namespace jsongen {
+
+namespace detail {
+// the scratch buffer has to be constructed before the Writer that uses it
+struct GatherScratch {
+  rapidjson::StringBuffer scratch;
+};
+} // namespace detail
+
+class GatherWriter : private detail::GatherScratch,
+                     public rapidjson::Writer<rapidjson::StringBuffer> {
+  using Base = rapidjson::Writer<rapidjson::StringBuffer>;
+  // a range of the scratch buffer if data is nullptr, a string in place
+  // otherwise; scratch may move until finish(), so it is kept as an offset
+  struct Piece {
+    const char *data;
+    size_t offset;
+    size_t length;
+  };
+  std::vector<Piece> pieces;
+  std::vector<iovec> iov;
+  // the scratch bytes already in pieces
+  size_t cut = 0;
+  size_t min_length;
+
+  void cutScratch() {
+    size_t size = scratch.GetSize();
+    if (size != cut) {
+      pieces.push_back({nullptr, cut, size - cut});
+      cut = size;
+    }
+  }
+  // escapes what rapidjson's Writer escapes, the runs in between are found
+  // 16 or 32 bytes at a time and copied whole; clean is the length of the
+  // first run
+  bool writeCopy(const char *str, size_t length, size_t clean) {
+    static const char hex[] = "0123456789ABCDEF";
+    Prefix(rapidjson::kStringType);
+    scratch.Put('"');
+    for (;;) {
+      std::memcpy(scratch.Push(clean), str, clean);
+      if (clean == length) {
+        break;
+      }
+      unsigned char c = static_cast<unsigned char>(str[clean]);
+      char escape = c == '"' ? '"'
+                  : c == '\\' ? '\\'
+                  : c == '\b' ? 'b'
+                  : c == '\f' ? 'f'
+                  : c == '\n' ? 'n'
+                  : c == '\r' ? 'r'
+                  : c == '\t' ? 't'
+                  : 'u';
+      scratch.Put('\\');
+      scratch.Put(escape);
+      if (escape == 'u') {
+        char *p = scratch.Push(4);
+        p[0] = '0';
+        p[1] = '0';
+        p[2] = hex[c >> 4];
+        p[3] = hex[c & 0xF];
+      }
+      str += clean + 1;
+      length -= clean + 1;
+      clean = findEscape(str, length);
+    }
+    scratch.Put('"');
+    return EndValue(true);
+  }
+
+public:
+  // strings shorter than min_length are copied, an iovec costs more than
+  // copying them
+  explicit GatherWriter(size_t min_length = 256)
+      : Base(scratch), min_length(min_length) {}
+
+  bool String(const char *str, rapidjson::SizeType length, bool = false) {
+    size_t clean = findEscape(str, length);
+    if (length < min_length || clean != length) {
+      return writeCopy(str, length, clean);
+    }
+    Prefix(rapidjson::kStringType);
+    scratch.Put('"');
+    cutScratch();
+    pieces.push_back({str, 0, length});
+    scratch.Put('"');
+    return EndValue(true);
+  }
+  bool String(const char *str) {
+    return String(str, static_cast<rapidjson::SizeType>(std::strlen(str)));
+  }
+
+  // the output so far; it refers to the strings written, which have to
+  // outlive it, and is valid until the next write or Reset()
+  const std::vector<iovec> &finish() {
+    cutScratch();
+    iov.clear();
+    const char *base = scratch.GetString();
+    for (const Piece &p : pieces) {
+      const char *data = p.data ? p.data : base + p.offset;
+      iov.push_back({const_cast<char *>(data), p.length});
+    }
+    return iov;
+  }
+  // the number of bytes finish() refers to
+  size_t size() const {
+    size_t total = scratch.GetSize() - cut;
+    for (const Piece &p : pieces) {
+      total += p.length;
+    }
+    return total;
+  }
+  // start a new document
+  void Reset() {
+    scratch.Clear();
+    pieces.clear();
+    cut = 0;
+    Base::Reset(scratch);
+  }
+};
+
+} // namespace jsongen
@@ -0,0 +1,159 @@
+#pragma once
+
+// The storage of \inlineString members: short strings copied into the object
+// itself, instead of a pointer to a string on the heap or in the input. The
+// records that declare jsongen::InlineString members include this file, it
+// depends on the standard library only; generated headers with
+// \inlineString members include it too.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace jsongen {
+
+// what an \inlineString member does with a string longer than it holds
+enum class InlineOverflow : unsigned char {
+  // fail the parse with ParseError::StringTooLong
+  Reject,
+  // keep what fits, cut before the UTF-8 character that doesn't
+  Truncate,
+  // point to the string where the parse left it, as a \cstring member does;
+  // jsongen::InlineString members only
+  Spill,
+};
+
+namespace detail {
+// the length of the longest prefix of s[0, length) that has at most n bytes
+// and doesn't end inside a UTF-8 character
+inline size_t truncateUtf8(const char *s, size_t length, size_t n) {
+  if (length <= n) {
+    return length;
+  }
+  // s[n] is the first byte cut, the character it belongs to goes too
+  while (n && (static_cast<unsigned char>(s[n]) & 0xc0) == 0x80) {
+    --n;
+  }
+  return n;
+}
+} // namespace detail
+
+// A string of up to N bytes, null-terminated, in the object, and its length
+// in one byte; aligned to 1, so that InlineString<N - 2> packs into N bytes.
+// With InlineOverflow::Spill, a longer one is referenced where it is instead:
+// data() then points out of the object, to a string that lives as long as the
+// input of the parse.
+template <size_t N> class InlineString {
+  static_assert(N > 0 && N < 255, "an InlineString holds 1 to 254 bytes");
+  static constexpr unsigned char kSpilled = 255;
+  // a spilled string is its pointer and its 32-bit size, unaligned
+  static constexpr size_t kSpillBytes = sizeof(const char *) + 4;
+
+  char chars[N + 1 < kSpillBytes ? kSpillBytes : N + 1];
+  // kSpilled if chars holds a spilled string
+  unsigned char length;
+
+  const char *spilledData() const {
+    const char *data;
+    std::memcpy(&data, chars, sizeof(data));
+    return data;
+  }
+  size_t spilledSize() const {
+    uint32_t size;
+    std::memcpy(&size, chars + sizeof(const char *), 4);
+    return size;
+  }
+
+public:
+  InlineString() : length(0) { chars[0] = '\0'; }
+  InlineString(const char *s, size_t n) : InlineString() {
+    assign(s, n, InlineOverflow::Truncate);
+  }
+
+  static constexpr size_t capacity() { return N; }
+  const char *data() const {
+    return length == kSpilled ? spilledData() : chars;
+  }
+  const char *c_str() const { return data(); }
+  size_t size() const { return length == kSpilled ? spilledSize() : length; }
+  bool empty() const { return size() == 0; }
+  bool isSpilled() const { return length == kSpilled; }
+
+  void clear() {
+    length = 0;
+    chars[0] = '\0';
+  }
+  // false, and *this unchanged, if s[0, n) doesn't fit and overflow is
+  // Reject, or a spill of 4 GiB or more
+  bool assign(const char *s, size_t n, InlineOverflow overflow) {
+    if (n > N) {
+      if (overflow == InlineOverflow::Reject) {
+        return false;
+      }
+      if (overflow == InlineOverflow::Spill && n <= UINT32_MAX) {
+        uint32_t size = static_cast<uint32_t>(n);
+        std::memcpy(chars, &s, sizeof(s));
+        std::memcpy(chars + sizeof(s), &size, 4);
+        length = kSpilled;
+        return true;
+      }
+      if (overflow != InlineOverflow::Truncate) {
+        return false;
+      }
+      n = detail::truncateUtf8(s, n, N);
+    }
+    std::memcpy(chars, s, n);
+    chars[n] = '\0';
+    length = static_cast<unsigned char>(n);
+    return true;
+  }
+
+  friend bool operator==(const InlineString &a, const InlineString &b) {
+    return a.size() == b.size() &&
+           std::memcmp(a.data(), b.data(), a.size()) == 0;
+  }
+  friend bool operator!=(const InlineString &a, const InlineString &b) {
+    return !(a == b);
+  }
+};
+
+// the generated code of an \inlineString member, the same for both types it
+// may have; a char[N] holds N - 1 bytes and a terminating null
+template <size_t N>
+bool assignInline(InlineString<N> &member, const char *s, size_t n,
+                  InlineOverflow overflow) {
+  return member.assign(s, n, overflow);
+}
+template <size_t N>
+bool assignInline(char (&member)[N], const char *s, size_t n,
+                  InlineOverflow overflow) {
+  if (n >= N) {
+    if (overflow != InlineOverflow::Truncate) {
+      return false;
+    }
+    n = detail::truncateUtf8(s, n, N - 1);
+  }
+  std::memcpy(member, s, n);
+  member[n] = '\0';
+  return true;
+}
+
+template <size_t N> void clearInline(InlineString<N> &member) {
+  member.clear();
+}
+template <size_t N> void clearInline(char (&member)[N]) { member[0] = '\0'; }
+
+template <typename Writer, size_t N>
+bool writeInline(Writer &writer, const InlineString<N> &member) {
+  return writer.String(member.data(), static_cast<unsigned>(member.size()));
+}
+// the array may have been filled by other code than the parse, it is read up
+// to its first null or its end
+template <typename Writer, size_t N>
+bool writeInline(Writer &writer, const char (&member)[N]) {
+  const void *end = std::memchr(member, '\0', N);
+  size_t size = end ? static_cast<const char *>(end) - member : N;
+  return writer.String(member, static_cast<unsigned>(size));
+}
+
+} // namespace jsongen
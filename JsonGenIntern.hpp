@@ -0,0 +1,148 @@
+#pragma once
+
+// The tables behind \intern members: each distinct string is stored once,
+// numbered, and kept until its table is destroyed, global() lives as long as
+// the program. Any number of threads may intern into the same table, the
+// strings are spread over shards that are locked separately. Generated
+// headers with \intern members include this file.
+
+#include "JsonGenRuntime.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace jsongen {
+
+// a string of an InternTable; data is null-terminated and stays where it is,
+// id is never 0, which stands for no string
+struct InternedString {
+  const char *data;
+  uint32_t size;
+  uint32_t id;
+};
+
+class InternTable {
+  static constexpr unsigned kShards = 64;
+  static constexpr unsigned kChunkBits = 12;
+  static constexpr size_t kMaxChunks = 4096;
+
+  struct Key {
+    const char *data;
+    size_t size;
+  };
+  // FNV-1a, also picks the shard
+  static uint64_t hash(const char *s, size_t n) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i != n; ++i) {
+      h = (h ^ static_cast<unsigned char>(s[i])) * 1099511628211ull;
+    }
+    return h;
+  }
+  struct KeyHash {
+    size_t operator()(const Key &k) const {
+      return static_cast<size_t>(hash(k.data, k.size));
+    }
+  };
+  struct KeyEqual {
+    bool operator()(const Key &a, const Key &b) const {
+      return a.size == b.size && std::memcmp(a.data, b.data, a.size) == 0;
+    }
+  };
+  struct alignas(64) Shard {
+    std::mutex mutex;
+    std::unordered_map<Key, InternedString, KeyHash, KeyEqual> strings;
+    NodePool pool;
+  };
+  Shard shards[kShards];
+  // the strings by id, in chunks that never move, so that get() takes no
+  // lock
+  std::atomic<InternedString *> chunks[kMaxChunks];
+  std::mutex chunk_mutex;
+  std::atomic<uint32_t> next_id{1};
+
+  InternedString &slot(uint32_t id) {
+    std::atomic<InternedString *> &chunk = chunks[id >> kChunkBits];
+    InternedString *c = chunk.load(std::memory_order_acquire);
+    if (!c) {
+      std::lock_guard<std::mutex> lock(chunk_mutex);
+      c = chunk.load(std::memory_order_relaxed);
+      if (!c) {
+        c = new InternedString[size_t(1) << kChunkBits]();
+        chunk.store(c, std::memory_order_release);
+      }
+    }
+    return c[id & ((1u << kChunkBits) - 1)];
+  }
+
+public:
+  InternTable() {
+    for (std::atomic<InternedString *> &chunk : chunks) {
+      chunk.store(nullptr, std::memory_order_relaxed);
+    }
+  }
+  InternTable(const InternTable &) = delete;
+  InternTable &operator=(const InternTable &) = delete;
+  ~InternTable() {
+    for (std::atomic<InternedString *> &chunk : chunks) {
+      delete[] chunk.load(std::memory_order_relaxed);
+    }
+  }
+
+  // the table of the \intern members that don't name one
+  static InternTable &global() {
+    static InternTable table;
+    return table;
+  }
+
+  // the copy of s in the table, made on the first call for its content
+  InternedString intern(const char *s, size_t n) {
+    Shard &shard = shards[hash(s, n) % kShards];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.strings.find(Key{s, n});
+    if (it != shard.strings.end()) {
+      return it->second;
+    }
+    // a full table takes no id, size() stays the number of strings stored
+    uint32_t id = next_id.load(std::memory_order_relaxed);
+    do {
+      if (id >> kChunkBits >= kMaxChunks) {
+        throw std::length_error("jsongen::InternTable is full");
+      }
+    } while (!next_id.compare_exchange_weak(id, id + 1,
+                                            std::memory_order_relaxed));
+    char *data = static_cast<char *>(shard.pool.allocate(n + 1, 1));
+    std::memcpy(data, s, n);
+    data[n] = '\0';
+    InternedString interned = {data, static_cast<uint32_t>(n), id};
+    slot(id) = interned;
+    shard.strings.emplace(Key{data, n}, interned);
+    return interned;
+  }
+
+  // the string of an id intern() returned, {nullptr, 0, 0} for 0; the id
+  // has to have reached the caller through intern() or some other
+  // synchronization
+  InternedString get(uint32_t id) const {
+    if (!id) {
+      return {nullptr, 0, 0};
+    }
+    return chunks[id >> kChunkBits].load(std::memory_order_acquire)
+        [id & ((1u << kChunkBits) - 1)];
+  }
+  // the number of distinct strings
+  size_t size() const { return next_id.load(std::memory_order_relaxed) - 1; }
+};
+
+// write() of an \intern member holding an id
+template <typename Writer>
+bool writeInterned(Writer &writer, const InternTable &table, uint64_t id) {
+  InternedString s = table.get(static_cast<uint32_t>(id));
+  return s.data ? writer.String(s.data, s.size) : writer.Null();
+}
+
+} // namespace jsongen
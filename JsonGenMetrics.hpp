@@ -0,0 +1,253 @@
+#pragma once
+
+// The metrics of the generated parsers. Compiled with -DJSONGEN_METRICS,
+// parse(), parsePatch(), parse_file(), parse_ndjson_file() and
+// parseColumns() count, for each record type, the documents they parse, the
+// bytes they read, the failures by ParseError and by the state of the
+// handler that failed, and the deepest nesting seen. Without it none of this
+// is compiled in. Generated headers include this file only then.
+//
+// Each thread counts into blocks of its own, one per record type, aligned to
+// cache lines and written without atomic read-modify-writes; snapshot()
+// adds them up when asked. Rates, e.g. documents/s, are for the scraper to
+// compute from two snapshots.
+
+#include "JsonGenRuntime.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace jsongen {
+
+// one counter per ParseError
+constexpr size_t kParseErrorKinds =
+    static_cast<size_t>(ParseError::StringTooLong) + 1;
+
+// the counters of one record type, over all threads
+struct MetricsSnapshot {
+  const char *record;
+  uint64_t documents = 0;
+  uint64_t failures = 0;
+  uint64_t bytes = 0;
+  uint64_t max_depth = 0;
+  // the failures by ParseError
+  uint64_t errors[kParseErrorKinds] = {};
+  // the failures by the state of the handler of this record that reported
+  // them, e.g. "S_Mx" for a bad value of x; the states that had any only
+  std::vector<std::pair<const char *, uint64_t>> state_errors;
+
+  uint64_t unknownKeys() const {
+    return errors[static_cast<size_t>(ParseError::UnknownKey)];
+  }
+};
+
+// The counters of one record type, a function-local static of its handler.
+class RecordMetrics {
+  enum : size_t { kDocuments, kFailures, kBytes, kMaxDepth, kErrors };
+  // a cache line of counters; a block is the counters of one thread
+  struct alignas(64) Line {
+    std::atomic<uint64_t> counters[8];
+  };
+  struct Block {
+    RecordMetrics *owner;
+    std::unique_ptr<Line[]> lines;
+  };
+  // the blocks of one thread, by record id; they are folded into retired
+  // when it exits
+  struct ThreadBlocks {
+    std::vector<Block *> blocks;
+    ~ThreadBlocks() {
+      std::lock_guard<std::mutex> guard(registryLock());
+      for (Block *b : blocks) {
+        if (b) {
+          b->owner->retire(b);
+        }
+      }
+    }
+  };
+
+  const char *record;
+  const char *const *states;
+  size_t state_count;
+  size_t id;
+  // the blocks of the live threads, and the sum of the others; guarded by
+  // registryLock()
+  std::vector<Block *> live;
+  std::vector<uint64_t> retired;
+
+  static std::mutex &registryLock() {
+    static std::mutex lock;
+    return lock;
+  }
+  static std::vector<RecordMetrics *> &registry() {
+    static std::vector<RecordMetrics *> all;
+    return all;
+  }
+  size_t counterCount() const {
+    return kErrors + kParseErrorKinds + state_count;
+  }
+  static std::atomic<uint64_t> &counter(Block *b, size_t i) {
+    return b->lines[i / 8].counters[i % 8];
+  }
+  // only the thread of the block writes to it
+  static void add(Block *b, size_t i, uint64_t n) {
+    std::atomic<uint64_t> &c = counter(b, i);
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  Block *local() {
+    thread_local ThreadBlocks blocks;
+    if (id < blocks.blocks.size() && blocks.blocks[id]) {
+      return blocks.blocks[id];
+    }
+    return attach(blocks);
+  }
+  JSONGEN_COLD Block *attach(ThreadBlocks &blocks) {
+    Block *b = new Block{this, std::unique_ptr<Line[]>(
+                                   new Line[(counterCount() + 7) / 8]())};
+    std::lock_guard<std::mutex> guard(registryLock());
+    if (blocks.blocks.size() <= id) {
+      blocks.blocks.resize(id + 1);
+    }
+    blocks.blocks[id] = b;
+    live.push_back(b);
+    return b;
+  }
+  void retire(Block *b) {
+    fold(b, retired);
+    for (size_t i = 0; i != live.size(); ++i) {
+      if (live[i] == b) {
+        live[i] = live.back();
+        live.pop_back();
+        break;
+      }
+    }
+    delete b;
+  }
+  void fold(Block *b, std::vector<uint64_t> &sums) const {
+    for (size_t i = 0; i != counterCount(); ++i) {
+      uint64_t v = counter(b, i).load(std::memory_order_relaxed);
+      sums[i] = i == kMaxDepth ? (v > sums[i] ? v : sums[i]) : sums[i] + v;
+    }
+  }
+  // snapshot() with registryLock() held
+  MetricsSnapshot snapshotLocked() {
+    std::vector<uint64_t> sums = retired;
+    for (Block *b : live) {
+      fold(b, sums);
+    }
+    MetricsSnapshot s;
+    s.record = record;
+    s.documents = sums[kDocuments];
+    s.failures = sums[kFailures];
+    s.bytes = sums[kBytes];
+    s.max_depth = sums[kMaxDepth];
+    for (size_t k = 0; k != kParseErrorKinds; ++k) {
+      s.errors[k] = sums[kErrors + k];
+    }
+    for (size_t at = 0; at != state_count; ++at) {
+      if (uint64_t n = sums[kErrors + kParseErrorKinds + at]) {
+        s.state_errors.emplace_back(states[at], n);
+      }
+    }
+    return s;
+  }
+
+public:
+  // states[at] names the state at of the handler, see error()
+  RecordMetrics(const char *record, const char *const *states,
+                size_t state_count)
+      : record(record), states(states), state_count(state_count) {
+    std::lock_guard<std::mutex> guard(registryLock());
+    retired.assign(counterCount(), 0);
+    id = registry().size();
+    registry().push_back(this);
+  }
+  RecordMetrics(const RecordMetrics &) = delete;
+  RecordMetrics &operator=(const RecordMetrics &) = delete;
+
+  // A parse of a document of this record ended after bytes, with depth
+  // handlers open at most. code is why it failed, None for a syntax error
+  // the handlers didn't record.
+  void document(bool ok, size_t bytes, size_t depth, ParseError code) {
+    Block *b = local();
+    add(b, kDocuments, 1);
+    add(b, kBytes, bytes);
+    std::atomic<uint64_t> &max_depth = counter(b, kMaxDepth);
+    if (depth > max_depth.load(std::memory_order_relaxed)) {
+      max_depth.store(depth, std::memory_order_relaxed);
+    }
+    if (!ok) {
+      add(b, kFailures, 1);
+      add(b, kErrors + static_cast<size_t>(code == ParseError::None
+                                               ? ParseError::Syntax
+                                               : code),
+          1);
+    }
+  }
+  // the handler of this record failed at state at
+  JSONGEN_COLD void error(size_t at) {
+    if (at < state_count) {
+      add(local(), kErrors + kParseErrorKinds + at, 1);
+    }
+  }
+
+  MetricsSnapshot snapshot() {
+    std::lock_guard<std::mutex> guard(registryLock());
+    return snapshotLocked();
+  }
+  // the records parsed so far, in the order they were first parsed
+  static std::vector<MetricsSnapshot> snapshotAll() {
+    std::lock_guard<std::mutex> guard(registryLock());
+    std::vector<MetricsSnapshot> all;
+    for (RecordMetrics *m : registry()) {
+      all.push_back(m->snapshotLocked());
+    }
+    return all;
+  }
+
+  // snapshotAll() in the Prometheus text format, one sample per line
+  static std::string format() {
+    std::string out;
+    auto sample = [&](const char *name, const char *record, const char *label,
+                      const char *value, uint64_t n) {
+      out += "jsongen_";
+      out += name;
+      out += "{record=\"";
+      out += record;
+      if (label) {
+        out += "\",";
+        out += label;
+        out += "=\"";
+        out += value;
+      }
+      out += "\"} ";
+      out += std::to_string(n);
+      out += '\n';
+    };
+    for (const MetricsSnapshot &s : snapshotAll()) {
+      sample("documents_total", s.record, nullptr, nullptr, s.documents);
+      sample("failures_total", s.record, nullptr, nullptr, s.failures);
+      sample("bytes_total", s.record, nullptr, nullptr, s.bytes);
+      sample("max_depth", s.record, nullptr, nullptr, s.max_depth);
+      for (size_t k = 1; k != kParseErrorKinds; ++k) {
+        if (s.errors[k]) {
+          sample("errors_total", s.record, "error",
+                 describe(static_cast<ParseError>(k)), s.errors[k]);
+        }
+      }
+      for (const auto &e : s.state_errors) {
+        sample("state_errors_total", s.record, "state", e.first, e.second);
+      }
+    }
+    return out;
+  }
+};
+
+} // namespace jsongen
@@ -0,0 +1,82 @@
+#pragma once
+
+// The instrumented build of the generated handlers. Compiled with
+// -DJSONGEN_PROFILE, every handler counts the keys it sees and which key
+// follows which; KeyCounters::dump() writes the counts in the format the
+// plugin reads back with profile=. Generated headers include this file only
+// then.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace jsongen {
+
+// The counters of one record, a function-local static of its handler.
+class KeyCounters {
+  const char *record;
+  const char *const *keys;
+  size_t size;
+  std::unique_ptr<std::atomic<uint64_t>[]> hits;
+  // next[from * size + key], from is size at the start of an object
+  std::unique_ptr<std::atomic<uint64_t>[]> next;
+
+  static std::mutex &registryLock() {
+    static std::mutex lock;
+    return lock;
+  }
+  static std::vector<KeyCounters *> &registry() {
+    static std::vector<KeyCounters *> all;
+    return all;
+  }
+
+public:
+  KeyCounters(const char *record, const char *const *keys, size_t size)
+      : record(record), keys(keys), size(size),
+        hits(new std::atomic<uint64_t>[size]()),
+        next(new std::atomic<uint64_t>[(size + 1) * size]()) {
+    std::lock_guard<std::mutex> guard(registryLock());
+    registry().push_back(this);
+  }
+  KeyCounters(const KeyCounters &) = delete;
+  KeyCounters &operator=(const KeyCounters &) = delete;
+
+  // key was seen after from, the key before it in the same object
+  void hit(size_t from, size_t key) {
+    hits[key].fetch_add(1, std::memory_order_relaxed);
+    next[from * size + key].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // write the counters of every record seen so far to path
+  static bool dump(const char *path) {
+    std::FILE *f = std::fopen(path, "w");
+    if (!f) {
+      return false;
+    }
+    std::fputs("# clang-json-gen key profile\n", f);
+    std::lock_guard<std::mutex> guard(registryLock());
+    for (const KeyCounters *c : registry()) {
+      for (size_t k = 0; k != c->size; ++k) {
+        std::fprintf(f, "key %s %s %llu\n", c->record, c->keys[k],
+                     static_cast<unsigned long long>(c->hits[k].load()));
+      }
+      for (size_t from = 0; from <= c->size; ++from) {
+        for (size_t k = 0; k != c->size; ++k) {
+          uint64_t n = c->next[from * c->size + k].load();
+          if (n) {
+            std::fprintf(f, "next %s %s %s %llu\n", c->record,
+                         from == c->size ? "^" : c->keys[from], c->keys[k],
+                         static_cast<unsigned long long>(n));
+          }
+        }
+      }
+    }
+    return std::fclose(f) == 0;
+  }
+};
+
+} // namespace jsongen
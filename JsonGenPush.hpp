@@ -0,0 +1,241 @@
+#pragma once
+
+// Documents parsed from chunks of input as they arrive, e.g. from a socket,
+// without buffering the whole document first: the generated FooPushParser
+// feeds them to a PushParser, which runs rapidjson's iterative parser one
+// token at a time. Generated headers include this file with the push plugin
+// option.
+
+#include "JsonGenRuntime.hpp"
+
+#include "rapidjson/reader.h"
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+namespace jsongen {
+
+namespace detail {
+// The length of what one IterativeParseNext() reads at p: whitespace, a ','
+// or ':', whitespace and one token. 0 if that may go on past end, the token
+// is then read once the next chunk completes it. A token that isn't json is
+// left for the reader to report.
+inline size_t pushUnit(const char *p, const char *end) {
+  const char *q = p;
+  auto skip = [&] {
+    while (q != end &&
+           (*q == ' ' || *q == '\n' || *q == '\r' || *q == '\t')) {
+      ++q;
+    }
+  };
+  skip();
+  if (q != end && (*q == ',' || *q == ':')) {
+    ++q;
+    skip();
+  }
+  if (q == end) {
+    return 0;
+  }
+  switch (*q) {
+  case '"':
+    for (const char *s = q + 1;;) {
+      const char *quote =
+          static_cast<const char *>(std::memchr(s, '"', end - s));
+      if (!quote) {
+        return 0;
+      }
+      // escaped if preceded by an odd number of backslashes
+      const char *b = quote;
+      while (b != q + 1 && b[-1] == '\\') {
+        --b;
+      }
+      if ((quote - b) % 2 == 0) {
+        return quote + 1 - p;
+      }
+      s = quote + 1;
+    }
+  case 't':
+  case 'n':
+    return end - q >= 4 ? q + 4 - p : 0;
+  case 'f':
+    return end - q >= 5 ? q + 5 - p : 0;
+  default:
+    if (*q != '-' && !isDigit(*q)) {
+      return q + 1 - p;
+    }
+    // a number ends at the first byte that can't be part of it
+    while (q != end && (isDigit(*q) || *q == '-' || *q == '+' || *q == '.' ||
+                        *q == 'e' || *q == 'E')) {
+      ++q;
+    }
+    return q != end ? q - p : 0;
+  }
+}
+
+// Forwards the events of the reader to target. The reader only lends its
+// strings for the time of the call, the values are copied to strings for
+// the handlers to keep; keys are only compared.
+template <typename Target> struct RetainStrings {
+  Target &target;
+  NodePool &strings;
+
+  bool Null() { return target.Null(); }
+  bool Bool(bool b) { return target.Bool(b); }
+  bool Int(int i) { return target.Int(i); }
+  bool Uint(unsigned u) { return target.Uint(u); }
+  bool Int64(int64_t i) { return target.Int64(i); }
+  bool Uint64(uint64_t u) { return target.Uint64(u); }
+  bool Double(double d) { return target.Double(d); }
+  bool RawNumber(const char *str, rapidjson::SizeType length, bool copy) {
+    return target.RawNumber(str, length, copy);
+  }
+  bool String(const char *str, rapidjson::SizeType length, bool) {
+    char *kept = static_cast<char *>(strings.allocate(length + 1, 1));
+    std::memcpy(kept, str, length);
+    kept[length] = '\0';
+    return target.String(kept, length, false);
+  }
+  bool StartObject() { return target.StartObject(); }
+  bool Key(const char *str, rapidjson::SizeType length, bool copy) {
+    return target.Key(str, length, copy);
+  }
+  bool EndObject(rapidjson::SizeType members) {
+    return target.EndObject(members);
+  }
+  bool StartArray() { return target.StartArray(); }
+  bool EndArray(rapidjson::SizeType elements) {
+    return target.EndArray(elements);
+  }
+};
+} // namespace detail
+
+// The parse of one document into target, a generated handler or a
+// ParseContext, fed in chunks of any size. Tokens are parsed straight from
+// the chunk; only a token cut by the end of a chunk is copied, with as much
+// of the next chunk as completes it, to a carry buffer. The handlers don't
+// read numeric arrays from the input themselves here, see scanNumbers(). The
+// \string and \cstring members parsed point into the parser, keep it as long
+// as they are used.
+template <typename Target> class PushParser {
+  static constexpr unsigned kFlags = rapidjson::kParseStopWhenDoneFlag;
+
+  rapidjson::Reader reader;
+  NodePool strings;
+  detail::RetainStrings<Target> handler;
+  ErrorInfo *error;
+  std::vector<char> carry;
+  // the offset in the document of the chunk or carry parsed from
+  size_t offset = 0;
+  size_t rest = 0;
+  bool failed = false;
+
+  // parse the unit at is, known to be complete
+  bool next(rapidjson::StringStream &is) {
+    if (reader.template IterativeParseNext<kFlags>(is, handler) &&
+        !reader.HasParseError()) {
+      return true;
+    }
+    fail(is);
+    return false;
+  }
+  JSONGEN_COLD void fail(const rapidjson::StringStream &is) {
+    failed = true;
+    if (!error) {
+      return;
+    }
+    // the handlers have no stream to tell their offset from
+    if (error->code == ParseError::None) {
+      error->code = ParseError::Syntax;
+      error->offset = offset + reader.GetErrorOffset();
+    } else {
+      error->offset = offset + is.Tell();
+    }
+  }
+
+public:
+  explicit PushParser(Target &target, ErrorInfo *error = nullptr)
+      : handler{target, strings}, error(error) {
+    reader.IterativeParseInit();
+  }
+  PushParser(const PushParser &) = delete;
+  PushParser &operator=(const PushParser &) = delete;
+
+  // Parse what data completes of the document; false if it is known to be
+  // invalid. Once the document is complete, the rest of data is left, see
+  // tail(), and later chunks are ignored.
+  bool feed(const char *data, size_t size) {
+    if (failed) {
+      return false;
+    }
+    const char *p = data;
+    const char *end = data + size;
+    if (!done() && !carry.empty()) {
+      // copy from data what completes the cut unit, in growing steps, as
+      // the unit is scanned from its start each time
+      size_t old = carry.size();
+      size_t taken = 0;
+      size_t unit = 0;
+      while (!unit) {
+        if (taken == size) {
+          return true;
+        }
+        size_t step = taken < 32 ? 64 : taken * 2;
+        size_t take = size - taken < step ? size - taken : step;
+        carry.insert(carry.end(), data + taken, data + taken + take);
+        taken += take;
+        unit = detail::pushUnit(carry.data(), carry.data() + carry.size());
+      }
+      carry.push_back('\0');
+      rapidjson::StringStream is(carry.data());
+      if (!next(is)) {
+        return false;
+      }
+      p += is.Tell() - old;
+      offset += is.Tell();
+      carry.clear();
+    }
+    while (!done()) {
+      if (!detail::pushUnit(p, end)) {
+        carry.assign(p, end);
+        return true;
+      }
+      rapidjson::StringStream is(p);
+      if (!next(is)) {
+        return false;
+      }
+      p += is.Tell();
+      offset += is.Tell();
+    }
+    rest = end - p;
+    return true;
+  }
+
+  // The end of the input: parse what is left of the document, false if it
+  // is incomplete or invalid.
+  bool finish() {
+    if (failed) {
+      return false;
+    }
+    // the carry is all that is left, whitespace, a cut token or a number
+    // that the end of the input ends
+    carry.push_back('\0');
+    rapidjson::StringStream is(carry.data());
+    while (!done()) {
+      if (!next(is)) {
+        return false;
+      }
+    }
+    carry.clear();
+    return true;
+  }
+
+  // the whole document has been parsed
+  bool done() const {
+    return reader.IterativeParseComplete() && !reader.HasParseError();
+  }
+  // the bytes of the last chunk fed after the end of the document
+  size_t tail() const { return rest; }
+};
+
+} // namespace jsongen
@@ -0,0 +1,747 @@
+#pragma once
+
+// The runtime support shared by all generated code. Generated headers include
+// this file, the plugin itself doesn't.
+
+#include "JsonGenSimd.hpp"
+
+#include "rapidjson/reader.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace jsongen {
+
+// nesting deeper than this is rejected by parse(), whose handlers are on
+// the heap, see ParseContext
+constexpr size_t kMaxDepth = 1 << 16;
+// and by write(), which recurses once per level: a frame per nested record
+// has to fit into the smallest usual thread stacks
+constexpr unsigned kMaxWriteDepth = 512;
+
+// the failure paths of the generated handlers are kept out of line, so that
+// the success path stays compact
+#if defined(__GNUC__)
+#define JSONGEN_COLD __attribute__((cold, noinline))
+#elif defined(_MSC_VER)
+#define JSONGEN_COLD __declspec(noinline)
+#else
+#define JSONGEN_COLD
+#endif
+
+// why a parse failed
+enum class ParseError : unsigned char {
+  None,
+  // the input isn't json, or ends early
+  Syntax,
+  // a value, key or end of object where the handler expects none
+  UnexpectedToken,
+  // a member whose type doesn't accept this kind of value
+  TypeMismatch,
+  // an integer that doesn't fit into the member
+  OutOfRange,
+  UnknownKey,
+  // a \required member given twice
+  DuplicateMember,
+  // a \required member is missing
+  MissingMember,
+  // more or, without \shortArray zero, fewer elements than the array holds
+  ArrayLength,
+  // a nested record parsed without a ParseContext
+  NoContext,
+  // nesting deeper than the ParseContext allows
+  TooDeep,
+  // parse_file() couldn't map the file
+  Io,
+  // a string value that isn't UTF-8, with the validate_utf8 plugin option
+  InvalidUtf8,
+  // a string longer than its \inlineString member holds
+  StringTooLong,
+};
+
+inline const char *describe(ParseError code) {
+  switch (code) {
+  case ParseError::None:
+    return "no error";
+  case ParseError::Syntax:
+    return "invalid json";
+  case ParseError::UnexpectedToken:
+    return "unexpected token";
+  case ParseError::TypeMismatch:
+    return "value of the wrong type";
+  case ParseError::OutOfRange:
+    return "number out of range";
+  case ParseError::UnknownKey:
+    return "unknown key";
+  case ParseError::DuplicateMember:
+    return "required member given twice";
+  case ParseError::MissingMember:
+    return "required member missing";
+  case ParseError::ArrayLength:
+    return "wrong number of array elements";
+  case ParseError::NoContext:
+    return "nested record without a ParseContext";
+  case ParseError::TooDeep:
+    return "nesting too deep";
+  case ParseError::Io:
+    return "cannot read file";
+  case ParseError::InvalidUtf8:
+    return "invalid UTF-8";
+  case ParseError::StringTooLong:
+    return "string too long for its member";
+  }
+  return "unknown error";
+}
+
+// The first error of a parse, filled when the caller of parse() passes one.
+struct ErrorInfo {
+  ParseError code = ParseError::None;
+  // the state of the failing handler, e.g. "S_Mx" while the value of x is
+  // expected; nullptr if the error isn't a handler's
+  const char *state = nullptr;
+  // in the input, just past the token the error was found at
+  size_t offset = 0;
+};
+
+// record an error into error, if any, and return false
+JSONGEN_COLD inline bool
+recordError(ErrorInfo *error, ParseError code, const char *state,
+            rapidjson::InsituStringStream *stream) {
+  if (error) {
+    error->code = code;
+    error->state = state;
+    error->offset = stream ? stream->Tell() : 0;
+  }
+  return false;
+}
+
+// the outcome of a generated parse(); a reader error the handlers didn't
+// record themselves is a syntax error. done has to be computed after the
+// parse, not in the same call: the order arguments are evaluated in is
+// unspecified, and gcc evaluates them right to left.
+inline bool checkParse(rapidjson::ParseResult result, bool done,
+                       ErrorInfo *error) {
+  if (!result.IsError() && done) {
+    return true;
+  }
+  if (error && error->code == ParseError::None) {
+    error->code = ParseError::Syntax;
+    error->offset = result.Offset();
+  }
+  return false;
+}
+
+// The rows of a generated parseColumns(): the elements of a top-level array,
+// or the documents of ndjson. The rows themselves are parsed by the handler,
+// next() only reads the whitespace and separators around them.
+class RowStream {
+  rapidjson::InsituStringStream &is;
+  enum { Start, Array, Ndjson, End, Failed } state = Start;
+
+  void skip() {
+    while (is.Peek() == ' ' || is.Peek() == '\n' || is.Peek() == '\r' ||
+           is.Peek() == '\t') {
+      is.Take();
+    }
+  }
+  // after the ']', only whitespace may follow
+  bool end() {
+    skip();
+    state = is.Peek() == '\0' ? End : Failed;
+    return false;
+  }
+
+public:
+  explicit RowStream(rapidjson::InsituStringStream &is) : is(is) {}
+
+  // whether another row starts at the stream; false at the end and at a
+  // separator that isn't json, see failed()
+  bool next() {
+    skip();
+    switch (state) {
+    case Start:
+      if (is.Peek() != '[') {
+        state = Ndjson;
+        return is.Peek() != '\0';
+      }
+      is.Take();
+      skip();
+      if (is.Peek() == ']') {
+        is.Take();
+        return end();
+      }
+      state = Array;
+      return true;
+    case Array:
+      if (is.Peek() == ',') {
+        is.Take();
+        return true;
+      }
+      if (is.Peek() == ']') {
+        is.Take();
+        return end();
+      }
+      state = Failed;
+      return false;
+    case Ndjson:
+      return is.Peek() != '\0';
+    default:
+      return false;
+    }
+  }
+  bool failed() const { return state == Failed; }
+};
+
+// whether the integer v is in the range of the integer type T; the generated
+// handlers check the values that may not fit before narrowing them
+template <typename T, typename V> constexpr bool fits(V v) {
+  using TL = std::numeric_limits<T>;
+  using UV = typename std::make_unsigned<V>::type;
+  using UT = typename std::make_unsigned<T>::type;
+  return std::is_signed<V>::value == std::is_signed<T>::value
+             ? v >= TL::min() && v <= TL::max()
+         : std::is_signed<V>::value
+             ? v >= 0 && static_cast<UV>(v) <= static_cast<UT>(TL::max())
+             : v <= static_cast<UT>(TL::max());
+}
+
+namespace detail {
+inline bool isDigit(char c) { return static_cast<unsigned char>(c - '0') < 10; }
+
+inline char *skipWhitespace(char *p) {
+  while (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t') {
+    ++p;
+  }
+  return p;
+}
+
+// The number at p, if it is an integer that fits into T, and the end of it;
+// nullptr otherwise.
+template <typename T>
+char *scanNumber(char *p, T &out, std::false_type /* floating */) {
+  bool negative = *p == '-';
+  p += negative;
+  if (!isDigit(*p) || (*p == '0' && isDigit(p[1]))) {
+    return nullptr;
+  }
+  uint64_t m = 0;
+  for (int digits = 0; isDigit(*p); ++digits, ++p) {
+    if (digits == 19) {
+      return nullptr;
+    }
+    m = m * 10 + static_cast<unsigned>(*p - '0');
+  }
+  if (*p == '.' || *p == 'e' || *p == 'E') {
+    return nullptr;
+  }
+  if (!negative) {
+    if (!fits<T>(m)) {
+      return nullptr;
+    }
+    out = static_cast<T>(m);
+    return p;
+  }
+  if (m > uint64_t(1) << 63) {
+    return nullptr;
+  }
+  int64_t v = m == uint64_t(1) << 63 ? std::numeric_limits<int64_t>::min()
+                                     : -static_cast<int64_t>(m);
+  if (!fits<T>(v)) {
+    return nullptr;
+  }
+  out = static_cast<T>(v);
+  return p;
+}
+
+// The number at p, if it converts to double exactly with one multiplication
+// or division (at most 2^53 and 10^±22), and the end of it; nullptr
+// otherwise.
+template <typename T>
+char *scanNumber(char *p, T &out, std::true_type /* floating */) {
+  static const double pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                 1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                 1e18, 1e19, 1e20, 1e21, 1e22};
+  bool negative = *p == '-';
+  p += negative;
+  if (!isDigit(*p) || (*p == '0' && isDigit(p[1]))) {
+    return nullptr;
+  }
+  uint64_t m = 0;
+  int digits = 0;
+  int exponent = 0;
+  for (; isDigit(*p); ++digits, ++p) {
+    if (digits == 19) {
+      return nullptr;
+    }
+    m = m * 10 + static_cast<unsigned>(*p - '0');
+  }
+  if (*p == '.') {
+    if (!isDigit(*++p)) {
+      return nullptr;
+    }
+    for (; isDigit(*p); ++digits, ++p, --exponent) {
+      if (digits == 19) {
+        return nullptr;
+      }
+      m = m * 10 + static_cast<unsigned>(*p - '0');
+    }
+  }
+  if (*p == 'e' || *p == 'E') {
+    ++p;
+    bool negative_exponent = *p == '-';
+    if (*p == '-' || *p == '+') {
+      ++p;
+    }
+    if (!isDigit(*p)) {
+      return nullptr;
+    }
+    int e = 0;
+    for (; isDigit(*p); ++p) {
+      if (e > 1000) {
+        return nullptr;
+      }
+      e = e * 10 + (*p - '0');
+    }
+    exponent += negative_exponent ? -e : e;
+  }
+  if (m > uint64_t(1) << 53 || exponent < -22 || exponent > 22) {
+    return nullptr;
+  }
+  double d = static_cast<double>(m);
+  d = exponent < 0 ? d / pow10[-exponent] : d * pow10[exponent];
+  out = static_cast<T>(negative ? -d : d);
+  return p;
+}
+
+// scanNumbers() with what is done with each element left to store, which
+// returns false if there is no room for it
+template <typename T, typename Store>
+bool scanNumbers(char *&src, Store &&store) {
+  auto resume = [&src](char *at) {
+    src = at - 1;
+    return true;
+  };
+  char *p = skipWhitespace(src + 1);
+  if (*p == ']') {
+    return resume(p);
+  }
+  for (;;) {
+    T value;
+    char *end = scanNumber(p, value, std::is_floating_point<T>());
+    if (end) {
+      end = skipWhitespace(end);
+    }
+    if (!end || (*end != ',' && *end != ']')) {
+      return resume(p);
+    }
+    if (!store(value)) {
+      return false;
+    }
+    if (*end == ']') {
+      return resume(end);
+    }
+    p = skipWhitespace(end + 1);
+    if (*p == ']') {
+      return resume(end);
+    }
+  }
+}
+} // namespace detail
+
+// The bulk path of numeric array members, called by StartArray(). The
+// iterative reader calls StartArray() before it takes the '[', so src points
+// at it, and the reader takes one byte once StartArray() returns. Reads
+// elements straight from the input into out[index, size), without a SAX
+// callback per element, and leaves src one byte before where the reader
+// resumes: the ']', or an element it can't convert exactly (null, a big
+// exponent, a value that doesn't fit...), which the reader parses and hands
+// to the handler as usual, or a trailing comma, for the reader to report.
+// Fails on more than size elements only.
+template <typename T>
+bool scanNumbers(char *&src, T *out, rapidjson::SizeType &index,
+                 rapidjson::SizeType size) {
+  return detail::scanNumbers<T>(src, [&](T value) {
+    if (index == size) {
+      return false;
+    }
+    out[index++] = value;
+    return true;
+  });
+}
+
+// the same for a std::vector member, the elements are appended to out
+template <typename T, typename Allocator>
+bool scanNumbers(char *&src, std::vector<T, Allocator> &out) {
+  return detail::scanNumbers<T>(src, [&](T value) {
+    out.push_back(value);
+    return true;
+  });
+}
+
+class ParseContext;
+
+// The SAX interface of every generated handler. Generated handlers are final,
+// so calling them through their own type is not a virtual call; the virtual
+// calls only happen through ParseContext, for nested records.
+class HandlerBase {
+public:
+  virtual bool Null() = 0;
+  virtual bool Bool(bool b) = 0;
+  virtual bool Int(int i) = 0;
+  virtual bool Uint(unsigned u) = 0;
+  virtual bool Int64(int64_t i) = 0;
+  virtual bool Uint64(uint64_t u) = 0;
+  virtual bool Double(double d) = 0;
+  virtual bool RawNumber(const char *str, rapidjson::SizeType length,
+                         bool copy) = 0;
+  virtual bool String(const char *str, rapidjson::SizeType length,
+                      bool copy) = 0;
+  virtual bool StartObject() = 0;
+  virtual bool Key(const char *str, rapidjson::SizeType length, bool copy) = 0;
+  virtual bool EndObject(rapidjson::SizeType members) = 0;
+  virtual bool StartArray() = 0;
+  virtual bool EndArray(rapidjson::SizeType elements) = 0;
+  // the object this handler fills is complete
+  virtual bool done() const = 0;
+
+  // set when the handler is a frame of a ParseContext, nested records can
+  // only be parsed then
+  ParseContext *ctx = nullptr;
+  // the input being parsed, if the handler may read numeric arrays from it
+  // directly, see scanNumbers()
+  rapidjson::InsituStringStream *stream = nullptr;
+  // where the handler records why it failed, if anywhere
+  ErrorInfo *error = nullptr;
+
+protected:
+  // handlers live in ParseContext's frames and are never deleted through
+  // this class
+  ~HandlerBase() = default;
+};
+
+// A bump allocator for the nodes of recursive records: a tree of a million
+// nodes is a handful of mallocs, and is freed in one shot by clear() or the
+// destructor.
+class NodePool {
+  struct Chunk {
+    Chunk *next;
+  };
+  struct Destructor {
+    void (*destroy)(void *);
+    void *object;
+    Destructor *next;
+  };
+  Chunk *chunks = nullptr;
+  char *cur = nullptr;
+  char *end = nullptr;
+  size_t next_chunk_size;
+  Destructor *destructors = nullptr;
+
+  void grow(size_t size, size_t align) {
+    size_t need = sizeof(Chunk) + size + align;
+    size_t chunk_size = next_chunk_size < need ? need : next_chunk_size;
+    if (next_chunk_size < (1 << 20)) {
+      next_chunk_size *= 2;
+    }
+    Chunk *chunk = static_cast<Chunk *>(std::malloc(chunk_size));
+    if (!chunk) {
+      throw std::bad_alloc();
+    }
+    chunk->next = chunks;
+    chunks = chunk;
+    cur = reinterpret_cast<char *>(chunk + 1);
+    end = reinterpret_cast<char *>(chunk) + chunk_size;
+  }
+
+public:
+  explicit NodePool(size_t first_chunk_size = 4096)
+      : next_chunk_size(first_chunk_size) {}
+  NodePool(const NodePool &) = delete;
+  NodePool &operator=(const NodePool &) = delete;
+  ~NodePool() { clear(); }
+
+  void *allocate(size_t size, size_t align) {
+    uintptr_t p = (reinterpret_cast<uintptr_t>(cur) + align - 1) & ~(align - 1);
+    if (!cur || p + size > reinterpret_cast<uintptr_t>(end)) {
+      grow(size, align);
+      p = (reinterpret_cast<uintptr_t>(cur) + align - 1) & ~(align - 1);
+    }
+    cur = reinterpret_cast<char *>(p + size);
+    return reinterpret_cast<void *>(p);
+  }
+
+  template <typename T> T *create() {
+    T *t = new (allocate(sizeof(T), alignof(T))) T();
+    if (!std::is_trivially_destructible<T>::value) {
+      Destructor *d = static_cast<Destructor *>(
+          allocate(sizeof(Destructor), alignof(Destructor)));
+      d->destroy = [](void *p) { static_cast<T *>(p)->~T(); };
+      d->object = t;
+      d->next = destructors;
+      destructors = d;
+    }
+    return t;
+  }
+
+  // destroy every node and release the memory
+  void clear() {
+    for (Destructor *d = destructors; d; d = d->next) {
+      d->destroy(d->object);
+    }
+    destructors = nullptr;
+    while (chunks) {
+      Chunk *next = chunks->next;
+      std::free(chunks);
+      chunks = next;
+    }
+    cur = end = nullptr;
+  }
+};
+
+// The state of one parse of nested records: an explicit stack of handlers,
+// one per open object, instead of recursion, and the pool the nested nodes
+// come from. It is itself the rapidjson handler, and forwards every event to
+// the innermost handler. The frames are reused from one parse to the next.
+class ParseContext {
+  struct Frame {
+    HandlerBase *handler;
+    size_t chunk;
+    size_t offset;
+  };
+  static constexpr size_t kChunkSize = 64 * 1024;
+  std::vector<std::unique_ptr<char[]>> chunks;
+  std::vector<size_t> chunk_sizes;
+  size_t chunk = 0;
+  size_t offset = 0;
+  std::vector<Frame> stack;
+  size_t max_depth;
+#ifdef JSONGEN_METRICS
+  // the most frames open at once since reset()
+  size_t high_water = 0;
+#endif
+
+  void *allocateFrame(size_t size, size_t align) {
+    for (;;) {
+      if (chunk == chunks.size()) {
+        size_t chunk_size = size + align > kChunkSize ? size + align
+                                                      : kChunkSize;
+        chunks.emplace_back(new char[chunk_size]);
+        chunk_sizes.push_back(chunk_size);
+      }
+      uintptr_t base = reinterpret_cast<uintptr_t>(chunks[chunk].get());
+      uintptr_t p = (base + offset + align - 1) & ~(align - 1);
+      if (p + size <= base + chunk_sizes[chunk]) {
+        offset = p + size - base;
+        return reinterpret_cast<void *>(p);
+      }
+      ++chunk;
+      offset = 0;
+    }
+  }
+
+public:
+  NodePool pool;
+  // given to every handler pushed
+  rapidjson::InsituStringStream *stream = nullptr;
+  ErrorInfo *error = nullptr;
+
+  explicit ParseContext(size_t max_depth = kMaxDepth) : max_depth(max_depth) {}
+  ParseContext(const ParseContext &) = delete;
+  ParseContext &operator=(const ParseContext &) = delete;
+
+  // open a nested object, filled by a new Handler
+  template <typename Handler, typename Record> bool push(Record &record) {
+    static_assert(std::is_trivially_destructible<Handler>::value,
+                  "frames are popped without running destructors");
+    if (stack.size() == max_depth) {
+      return recordError(error, ParseError::TooDeep, nullptr, stream);
+    }
+    Frame frame = {nullptr, chunk, offset};
+    Handler *h =
+        new (allocateFrame(sizeof(Handler), alignof(Handler))) Handler(record);
+    h->ctx = this;
+    h->stream = stream;
+    h->error = error;
+    frame.handler = h;
+    stack.push_back(frame);
+#ifdef JSONGEN_METRICS
+    if (stack.size() > high_water) {
+      high_water = stack.size();
+    }
+#endif
+    return true;
+  }
+  void pop() {
+    assert(!stack.empty());
+    chunk = stack.back().chunk;
+    offset = stack.back().offset;
+    stack.pop_back();
+  }
+  HandlerBase *top() const { return stack.back().handler; }
+  size_t depth() const { return stack.size(); }
+#ifdef JSONGEN_METRICS
+  size_t highWater() const { return high_water; }
+#endif
+  // forget the frames, but neither the memory of the frames nor the nodes
+  void reset() {
+    stack.clear();
+    chunk = 0;
+    offset = 0;
+#ifdef JSONGEN_METRICS
+    high_water = 0;
+#endif
+  }
+
+  bool Null() { return top()->Null(); }
+  bool Bool(bool b) { return top()->Bool(b); }
+  bool Int(int i) { return top()->Int(i); }
+  bool Uint(unsigned u) { return top()->Uint(u); }
+  bool Int64(int64_t i) { return top()->Int64(i); }
+  bool Uint64(uint64_t u) { return top()->Uint64(u); }
+  bool Double(double d) { return top()->Double(d); }
+  bool RawNumber(const char *str, rapidjson::SizeType length, bool copy) {
+    return top()->RawNumber(str, length, copy);
+  }
+  bool String(const char *str, rapidjson::SizeType length, bool copy) {
+    return top()->String(str, length, copy);
+  }
+  bool StartObject() { return top()->StartObject(); }
+  bool Key(const char *str, rapidjson::SizeType length, bool copy) {
+    return top()->Key(str, length, copy);
+  }
+  bool EndObject(rapidjson::SizeType members) {
+    if (!top()->EndObject(members)) {
+      return false;
+    }
+    // a nested object is complete, give control back to its parent; the
+    // outermost handler stays for the caller to check
+    if (stack.size() > 1 && top()->done()) {
+      pop();
+    }
+    return true;
+  }
+  bool StartArray() { return top()->StartArray(); }
+  bool EndArray(rapidjson::SizeType elements) {
+    return top()->EndArray(elements);
+  }
+};
+
+// The members of a json object, found by a structural scan only: where each
+// key and each value is, nothing is converted or unescaped. Keys are compared
+// as they are in the input, so a key written with escapes matches nothing.
+// The generated views decode a value from here when it is first asked for.
+class ObjectIndex {
+  struct Member {
+    const char *key;
+    size_t key_length;
+    char *value;
+  };
+  std::vector<Member> members;
+
+  // past the closing quote of the string at p, nullptr if it is unterminated
+  static char *skipString(char *p) {
+    for (++p; *p != '"'; ++p) {
+      if (!*p || (*p == '\\' && !*++p)) {
+        return nullptr;
+      }
+    }
+    return p + 1;
+  }
+  // past the value at p; nested brackets are only counted, the reader checks
+  // them when the value is decoded
+  static char *skipValue(char *p) {
+    if (*p == '"') {
+      return skipString(p);
+    }
+    if (*p != '{' && *p != '[') {
+      char *begin = p;
+      while (*p && *p != ',' && *p != '}' && *p != ']' && *p != ' ' &&
+             *p != '\n' && *p != '\r' && *p != '\t') {
+        ++p;
+      }
+      return p == begin ? nullptr : p;
+    }
+    size_t depth = 0;
+    do {
+      if (*p == '"') {
+        if (!(p = skipString(p))) {
+          return nullptr;
+        }
+        continue;
+      }
+      if (*p == '{' || *p == '[') {
+        ++depth;
+      } else if (*p == '}' || *p == ']') {
+        --depth;
+      } else if (!*p) {
+        return nullptr;
+      }
+      ++p;
+    } while (depth);
+    return p;
+  }
+
+public:
+  // index the object in the null-terminated buffer, false if it isn't one
+  bool build(char *buffer) {
+    members.clear();
+    char *p = detail::skipWhitespace(buffer);
+    if (*p != '{') {
+      return false;
+    }
+    p = detail::skipWhitespace(p + 1);
+    if (*p == '}') {
+      return true;
+    }
+    for (;;) {
+      if (*p != '"') {
+        return false;
+      }
+      const char *key = p + 1;
+      if (!(p = skipString(p))) {
+        return false;
+      }
+      size_t key_length = static_cast<size_t>(p - 1 - key);
+      p = detail::skipWhitespace(p);
+      if (*p != ':') {
+        return false;
+      }
+      char *value = detail::skipWhitespace(p + 1);
+      if (!(p = skipValue(value))) {
+        return false;
+      }
+      members.push_back({key, key_length, value});
+      p = detail::skipWhitespace(p);
+      if (*p == '}') {
+        return true;
+      }
+      if (*p != ',') {
+        return false;
+      }
+      p = detail::skipWhitespace(p + 1);
+    }
+  }
+  // the value of the last member named key, nullptr if there is none
+  char *find(const char *key, size_t length) const {
+    for (size_t i = members.size(); i != 0; --i) {
+      const Member &m = members[i - 1];
+      if (m.key_length == length && std::memcmp(m.key, key, length) == 0) {
+        return m.value;
+      }
+    }
+    return nullptr;
+  }
+  size_t size() const { return members.size(); }
+};
+
+} // namespace jsongen
@@ -0,0 +1,372 @@
+#pragma once
+
+// Vectorized scans of strings: where the first character json has to escape
+// is, and whether a string is valid UTF-8. On x86-64 the SSE2 versions are
+// the baseline and the SSSE3 and AVX2 ones are chosen at run time, other
+// targets get portable versions.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define JSONGEN_X86_SIMD 1
+#include <immintrin.h>
+#define JSONGEN_SSSE3 __attribute__((target("ssse3")))
+#define JSONGEN_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace jsongen {
+namespace detail {
+
+inline bool isEscaped(unsigned char c) {
+  return c < 0x20 || c == '"' || c == '\\';
+}
+
+inline size_t findEscapeScalar(const char *s, size_t i, size_t n) {
+  while (i != n && !isEscaped(static_cast<unsigned char>(s[i]))) {
+    ++i;
+  }
+  return i;
+}
+
+// the length of the well-formed UTF-8 sequence at s[i], 0 if there is none
+// (RFC 3629: no overlong forms, no surrogates, nothing above U+10FFFF)
+inline size_t utf8Sequence(const unsigned char *s, size_t i, size_t n) {
+  unsigned char c = s[i];
+  if (c < 0x80) {
+    return 1;
+  }
+  size_t length;
+  unsigned char lo = 0x80;
+  unsigned char hi = 0xBF;
+  if (c < 0xC2) {
+    return 0;
+  } else if (c < 0xE0) {
+    length = 2;
+  } else if (c < 0xF0) {
+    length = 3;
+    lo = c == 0xE0 ? 0xA0 : 0x80;
+    hi = c == 0xED ? 0x9F : 0xBF;
+  } else if (c < 0xF5) {
+    length = 4;
+    lo = c == 0xF0 ? 0x90 : 0x80;
+    hi = c == 0xF4 ? 0x8F : 0xBF;
+  } else {
+    return 0;
+  }
+  if (n - i < length || s[i + 1] < lo || s[i + 1] > hi) {
+    return 0;
+  }
+  for (size_t k = 2; k < length; ++k) {
+    if ((s[i + k] & 0xC0) != 0x80) {
+      return 0;
+    }
+  }
+  return length;
+}
+
+// ASCII runs a word at a time, the rest a sequence at a time
+inline bool validUtf8Portable(const char *s, size_t n) {
+  const unsigned char *u = reinterpret_cast<const unsigned char *>(s);
+  size_t i = 0;
+  while (i < n) {
+    uint64_t word;
+    if (n - i >= 8 &&
+        (std::memcpy(&word, u + i, 8), !(word & 0x8080808080808080ull))) {
+      i += 8;
+      continue;
+    }
+    size_t length = utf8Sequence(u, i, n);
+    if (!length) {
+      return false;
+    }
+    i += length;
+  }
+  return true;
+}
+
+#ifdef JSONGEN_X86_SIMD
+inline size_t findEscapeSse2(const char *s, size_t n) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1F);
+  size_t i = 0;
+  for (; n - i >= 16; i += 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, backslash)),
+        _mm_cmpeq_epi8(_mm_min_epu8(x, control), x));
+    if (int mask = _mm_movemask_epi8(m)) {
+      return i + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+  }
+  return findEscapeScalar(s, i, n);
+}
+
+JSONGEN_AVX2 inline size_t findEscapeAvx2(const char *s, size_t n) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i control = _mm256_set1_epi8(0x1F);
+  size_t i = 0;
+  for (; n - i >= 32; i += 32) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+    __m256i m = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(x, quote),
+                        _mm256_cmpeq_epi8(x, backslash)),
+        _mm256_cmpeq_epi8(_mm256_min_epu8(x, control), x));
+    if (int mask = _mm256_movemask_epi8(m)) {
+      return i + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+  }
+  return i + findEscapeSse2(s + i, n - i);
+}
+
+// SSE2 has no byte shuffle to classify multi-byte sequences with, only the
+// ASCII runs are skipped 16 bytes at a time; the CPUs without SSSE3 only
+inline bool validUtf8Sse2(const char *s, size_t n) {
+  const unsigned char *u = reinterpret_cast<const unsigned char *>(s);
+  size_t i = 0;
+  while (i < n) {
+    if (n - i >= 16 && !_mm_movemask_epi8(_mm_loadu_si128(
+                           reinterpret_cast<const __m128i *>(s + i)))) {
+      i += 16;
+      continue;
+    }
+    size_t length = utf8Sequence(u, i, n);
+    if (!length) {
+      return false;
+    }
+    i += length;
+  }
+  return true;
+}
+
+// The lookup algorithm of Keiser and Lemire, "Validating UTF-8 In Less Than
+// One Instruction Per Byte": every error is recognized from the high nibble
+// of the previous byte, its low nibble and the high nibble of the current
+// byte, with three table lookups, plus the continuation bytes the lead bytes
+// two and three bytes back require. The SSSE3 and the AVX2 versions differ
+// in the width of the blocks only.
+struct Utf8StateSsse3 {
+  __m128i error;
+  __m128i prev_input;
+  __m128i prev_incomplete;
+};
+
+struct Utf8State {
+  __m256i error;
+  __m256i prev_input;
+  __m256i prev_incomplete;
+};
+
+// the three tables, indexed by a nibble
+struct Utf8Tables {
+  __m128i byte_1_high;
+  __m128i byte_1_low;
+  __m128i byte_2_high;
+};
+
+inline Utf8Tables utf8Tables() {
+  const char too_short = 1 << 0;  // lead byte or ASCII, then a lead byte or ASCII
+  const char too_long = 1 << 1;   // ASCII, then a continuation
+  const char overlong_3 = 1 << 2; // 11100000 100_____
+  const char too_large = 1 << 3;  // above U+10FFFF
+  const char surrogate = 1 << 4;  // 11101101 101_____
+  const char overlong_2 = 1 << 5; // 1100000_ 10______
+  const char too_large_1000 = 1 << 6;
+  const char overlong_4 = 1 << 6; // 11110000 1000____
+  const char two_conts = static_cast<char>(1 << 7); // 10______ 10______
+  const char carry = too_short | too_long | two_conts;
+  const char large = carry | too_large | too_large_1000;
+  const char cont_1000 = too_long | overlong_2 | two_conts | overlong_3 |
+                         too_large_1000 | overlong_4;
+  const char cont_1001 =
+      too_long | overlong_2 | two_conts | overlong_3 | too_large;
+  const char cont_101 =
+      too_long | overlong_2 | two_conts | surrogate | too_large;
+  return {
+      _mm_setr_epi8(too_long, too_long, too_long, too_long, too_long,
+                    too_long, too_long, too_long, two_conts, two_conts,
+                    two_conts, two_conts, too_short | overlong_2, too_short,
+                    too_short | overlong_3 | surrogate,
+                    too_short | too_large | too_large_1000 | overlong_4),
+      _mm_setr_epi8(carry | overlong_3 | overlong_2 | overlong_4,
+                    carry | overlong_2, carry, carry, carry | too_large,
+                    large, large, large, large, large, large, large, large,
+                    large | surrogate, large, large),
+      _mm_setr_epi8(too_short, too_short, too_short, too_short, too_short,
+                    too_short, too_short, too_short, cont_1000, cont_1001,
+                    cont_101, cont_101, too_short, too_short, too_short,
+                    too_short)};
+}
+
+template <int N> JSONGEN_SSSE3 inline __m128i utf8Prev(__m128i input,
+                                                       __m128i prev_input) {
+  return _mm_alignr_epi8(input, prev_input, 16 - N);
+}
+
+JSONGEN_SSSE3 inline __m128i utf8HighNibbles(__m128i x) {
+  return _mm_and_si128(_mm_srli_epi16(x, 4), _mm_set1_epi8(0x0F));
+}
+
+JSONGEN_SSSE3 inline __m128i utf8Errors(__m128i input, __m128i prev_input) {
+  const Utf8Tables tables = utf8Tables();
+  __m128i prev1 = utf8Prev<1>(input, prev_input);
+  __m128i special = _mm_and_si128(
+      _mm_and_si128(
+          _mm_shuffle_epi8(tables.byte_1_high, utf8HighNibbles(prev1)),
+          _mm_shuffle_epi8(tables.byte_1_low,
+                           _mm_and_si128(prev1, _mm_set1_epi8(0x0F)))),
+      _mm_shuffle_epi8(tables.byte_2_high, utf8HighNibbles(input)));
+  // the third and fourth bytes of 3 and 4 byte sequences must be
+  // continuations, which is the only case two_conts isn't an error
+  __m128i is_third = _mm_subs_epu8(utf8Prev<2>(input, prev_input),
+                                   _mm_set1_epi8(char(0xE0 - 0x80)));
+  __m128i is_fourth = _mm_subs_epu8(utf8Prev<3>(input, prev_input),
+                                    _mm_set1_epi8(char(0xF0 - 0x80)));
+  __m128i must_continue =
+      _mm_and_si128(_mm_or_si128(is_third, is_fourth),
+                    _mm_set1_epi8(static_cast<char>(0x80)));
+  return _mm_xor_si128(must_continue, special);
+}
+
+JSONGEN_SSSE3 inline void utf8Step(Utf8StateSsse3 &state,
+                                   __m128i input) {
+  if (!_mm_movemask_epi8(input)) {
+    // a sequence cut at the end of the previous block
+    state.error = _mm_or_si128(state.error, state.prev_incomplete);
+  } else {
+    state.error =
+        _mm_or_si128(state.error, utf8Errors(input, state.prev_input));
+    // the last three bytes start a sequence longer than what is left
+    const __m128i max = _mm_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1),
+        static_cast<char>(0xC0 - 1));
+    state.prev_incomplete = _mm_subs_epu8(input, max);
+  }
+  state.prev_input = input;
+}
+
+JSONGEN_SSSE3 inline bool validUtf8Ssse3(const char *s, size_t n) {
+  Utf8StateSsse3 state = {_mm_setzero_si128(), _mm_setzero_si128(),
+                              _mm_setzero_si128()};
+  size_t i = 0;
+  for (; n - i >= 16; i += 16) {
+    utf8Step(state,
+             _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i)));
+  }
+  if (i != n) {
+    // padded with ASCII, which also ends a sequence cut by the end
+    alignas(16) char tail[16] = {};
+    std::memcpy(tail, s + i, n - i);
+    utf8Step(state, _mm_load_si128(reinterpret_cast<const __m128i *>(tail)));
+  }
+  __m128i error = _mm_or_si128(state.error, state.prev_incomplete);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) ==
+         0xFFFF;
+}
+
+template <int N> JSONGEN_AVX2 inline __m256i utf8Prev(__m256i input,
+                                                      __m256i prev_input) {
+  return _mm256_alignr_epi8(
+      input, _mm256_permute2x128_si256(prev_input, input, 0x21), 16 - N);
+}
+
+JSONGEN_AVX2 inline __m256i utf8HighNibbles(__m256i x) {
+  return _mm256_and_si256(_mm256_srli_epi16(x, 4), _mm256_set1_epi8(0x0F));
+}
+
+JSONGEN_AVX2 inline __m256i utf8Errors(__m256i input, __m256i prev_input) {
+  const Utf8Tables tables = utf8Tables();
+  const __m256i byte_1_high = _mm256_broadcastsi128_si256(tables.byte_1_high);
+  const __m256i byte_1_low = _mm256_broadcastsi128_si256(tables.byte_1_low);
+  const __m256i byte_2_high = _mm256_broadcastsi128_si256(tables.byte_2_high);
+  __m256i prev1 = utf8Prev<1>(input, prev_input);
+  __m256i special = _mm256_and_si256(
+      _mm256_and_si256(
+          _mm256_shuffle_epi8(byte_1_high, utf8HighNibbles(prev1)),
+          _mm256_shuffle_epi8(byte_1_low,
+                              _mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)))),
+      _mm256_shuffle_epi8(byte_2_high, utf8HighNibbles(input)));
+  __m256i is_third = _mm256_subs_epu8(utf8Prev<2>(input, prev_input),
+                                      _mm256_set1_epi8(char(0xE0 - 0x80)));
+  __m256i is_fourth = _mm256_subs_epu8(utf8Prev<3>(input, prev_input),
+                                       _mm256_set1_epi8(char(0xF0 - 0x80)));
+  __m256i must_continue =
+      _mm256_and_si256(_mm256_or_si256(is_third, is_fourth),
+                       _mm256_set1_epi8(static_cast<char>(0x80)));
+  return _mm256_xor_si256(must_continue, special);
+}
+
+JSONGEN_AVX2 inline void utf8Step(Utf8State &state, __m256i input) {
+  if (!_mm256_movemask_epi8(input)) {
+    state.error = _mm256_or_si256(state.error, state.prev_incomplete);
+  } else {
+    state.error = _mm256_or_si256(state.error,
+                                  utf8Errors(input, state.prev_input));
+    const __m256i max = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1),
+        static_cast<char>(0xC0 - 1));
+    state.prev_incomplete = _mm256_subs_epu8(input, max);
+  }
+  state.prev_input = input;
+}
+
+JSONGEN_AVX2 inline bool validUtf8Avx2(const char *s, size_t n) {
+  Utf8State state = {_mm256_setzero_si256(), _mm256_setzero_si256(),
+                              _mm256_setzero_si256()};
+  size_t i = 0;
+  for (; n - i >= 32; i += 32) {
+    utf8Step(state, _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i *>(s + i)));
+  }
+  if (i != n) {
+    alignas(32) char tail[32] = {};
+    std::memcpy(tail, s + i, n - i);
+    utf8Step(state, _mm256_load_si256(reinterpret_cast<const __m256i *>(tail)));
+  }
+  __m256i error = _mm256_or_si256(state.error, state.prev_incomplete);
+  return _mm256_testz_si256(error, error);
+}
+
+inline bool hasAvx2() {
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+}
+
+inline bool hasSsse3() {
+  static const bool ssse3 = __builtin_cpu_supports("ssse3");
+  return ssse3;
+}
+#endif
+
+} // namespace detail
+
+// the index of the first character of s that json escapes, n if none
+inline size_t findEscape(const char *s, size_t n) {
+#ifdef JSONGEN_X86_SIMD
+  return detail::hasAvx2() ? detail::findEscapeAvx2(s, n)
+                           : detail::findEscapeSse2(s, n);
+#else
+  return detail::findEscapeScalar(s, 0, n);
+#endif
+}
+
+// whether s is well-formed UTF-8
+inline bool validUtf8(const char *s, size_t n) {
+#ifdef JSONGEN_X86_SIMD
+  if (detail::hasAvx2()) {
+    return detail::validUtf8Avx2(s, n);
+  }
+  return detail::hasSsse3() ? detail::validUtf8Ssse3(s, n)
+                            : detail::validUtf8Sse2(s, n);
+#else
+  return detail::validUtf8Portable(s, n);
+#endif
+}
+
+} // namespace jsongen
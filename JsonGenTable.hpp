@@ -0,0 +1,336 @@
+#pragma once
+
+// The table-driven mode of the generated code, enabled by the tables plugin
+// option: a record is described by a constexpr table of its members, and
+// parsed and written by the shared TableHandler and writeTable() below
+// instead of a switch per callback. Generated headers include this file in
+// that mode only.
+
+#include "JsonGenRuntime.hpp"
+#ifdef JSONGEN_METRICS
+#include "JsonGenMetrics.hpp"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace jsongen {
+
+// how a member is stored; the width and signedness of an integer member also
+// decide which values have to be range checked
+enum class FieldKind : unsigned char {
+  Bool,
+  Int8,
+  Int16,
+  Int32,
+  Int64,
+  Uint8,
+  Uint16,
+  Uint32,
+  Uint64,
+  Float,
+  Double,
+  // a \cstring member, pointing into the input
+  CString,
+};
+
+struct FieldInfo {
+  const char *key;
+  uint32_t key_length;
+  uint32_t offset;
+  FieldKind kind;
+  bool required;
+};
+
+struct RecordTable {
+  const FieldInfo *fields;
+  uint32_t size;
+  // bit n is set if fields[n] is \required, at most 64 members
+  uint64_t required;
+  // the validate_utf8 plugin option
+  bool validate_utf8;
+};
+
+namespace detail {
+template <typename T> T load(const char *p) {
+  T v;
+  std::memcpy(&v, p, sizeof(T));
+  return v;
+}
+template <typename T> void store(char *p, T v) { std::memcpy(p, &v, sizeof(T)); }
+
+inline size_t sizeOf(FieldKind kind) {
+  switch (kind) {
+  case FieldKind::Bool:
+    return sizeof(bool);
+  case FieldKind::Int8:
+  case FieldKind::Uint8:
+    return 1;
+  case FieldKind::Int16:
+  case FieldKind::Uint16:
+    return 2;
+  case FieldKind::Int32:
+  case FieldKind::Uint32:
+    return 4;
+  case FieldKind::Int64:
+  case FieldKind::Uint64:
+    return 8;
+  case FieldKind::Float:
+    return sizeof(float);
+  case FieldKind::Double:
+    return sizeof(double);
+  case FieldKind::CString:
+    return sizeof(const char *);
+  }
+  return 0;
+}
+} // namespace detail
+
+// The handler of every table-driven record. It accepts what the generated
+// switch handlers accept, and reports the same errors; the state recorded
+// with an error is the key of the member being parsed.
+class TableHandler : public HandlerBase {
+  const RecordTable &table;
+  char *self;
+  const FieldInfo *field = nullptr;
+  uint64_t seen = 0;
+
+  JSONGEN_COLD bool fail(ParseError code) const {
+    static const char *const names[] = {"S_start", "S_expect_key", "S_end"};
+#ifdef JSONGEN_METRICS
+    if (metrics) {
+      metrics->error(state == S_value ? S_value + (field - table.fields)
+                                      : state);
+    }
+#endif
+    return recordError(error, code,
+                       state == S_value ? field->key : names[state], stream);
+  }
+  JSONGEN_COLD bool failMissing(const FieldInfo &missing) const {
+#ifdef JSONGEN_METRICS
+    if (metrics) {
+      metrics->error(S_value + (&missing - table.fields));
+    }
+#endif
+    return recordError(error, ParseError::MissingMember, missing.key, stream);
+  }
+  // the member has its value, only \required members are checked for
+  // duplicates
+  bool valueEnd() {
+    if (field->required) {
+      uint64_t bit = uint64_t(1) << (field - table.fields);
+      if (seen & bit) {
+        return fail(ParseError::DuplicateMember);
+      }
+      seen |= bit;
+    }
+    state = S_expect_key;
+    return true;
+  }
+  template <typename T, typename V> bool storeInteger(char *p, V v) {
+    if (!fits<T>(v)) {
+      return fail(ParseError::OutOfRange);
+    }
+    detail::store(p, static_cast<T>(v));
+    return valueEnd();
+  }
+  template <typename V> bool integer(V v) {
+    if (state != S_value) {
+      return fail(ParseError::UnexpectedToken);
+    }
+    char *p = self + field->offset;
+    switch (field->kind) {
+    case FieldKind::Int8:
+      return storeInteger<int8_t>(p, v);
+    case FieldKind::Int16:
+      return storeInteger<int16_t>(p, v);
+    case FieldKind::Int32:
+      return storeInteger<int32_t>(p, v);
+    case FieldKind::Int64:
+      return storeInteger<int64_t>(p, v);
+    case FieldKind::Uint8:
+      return storeInteger<uint8_t>(p, v);
+    case FieldKind::Uint16:
+      return storeInteger<uint16_t>(p, v);
+    case FieldKind::Uint32:
+      return storeInteger<uint32_t>(p, v);
+    case FieldKind::Uint64:
+      return storeInteger<uint64_t>(p, v);
+    case FieldKind::Float:
+      detail::store(p, static_cast<float>(v));
+      return valueEnd();
+    case FieldKind::Double:
+      detail::store(p, static_cast<double>(v));
+      return valueEnd();
+    default:
+      return fail(ParseError::TypeMismatch);
+    }
+  }
+
+public:
+  enum State : unsigned char { S_start, S_expect_key, S_end, S_value };
+  State state = S_start;
+  // set by parsePatch(), the \required members may be missing
+  bool patch = false;
+#ifdef JSONGEN_METRICS
+  // the states of its errors are S_start, S_expect_key, S_end and the
+  // members, in the order of the table
+  RecordMetrics *metrics = nullptr;
+#endif
+
+  TableHandler(const RecordTable &table, void *self)
+      : table(table), self(static_cast<char *>(self)) {}
+
+  bool done() const override { return state == S_end; }
+  bool Null() override {
+    if (state != S_value) {
+      return fail(ParseError::UnexpectedToken);
+    }
+    std::memset(self + field->offset, 0, detail::sizeOf(field->kind));
+    return valueEnd();
+  }
+  bool Bool(bool b) override {
+    if (state != S_value) {
+      return fail(ParseError::UnexpectedToken);
+    }
+    if (field->kind != FieldKind::Bool) {
+      return fail(ParseError::TypeMismatch);
+    }
+    detail::store(self + field->offset, b);
+    return valueEnd();
+  }
+  bool Int(int i) override { return integer(i); }
+  bool Uint(unsigned u) override { return integer(u); }
+  bool Int64(int64_t i) override { return integer(i); }
+  bool Uint64(uint64_t u) override { return integer(u); }
+  bool Double(double d) override {
+    if (state != S_value) {
+      return fail(ParseError::UnexpectedToken);
+    }
+    if (field->kind == FieldKind::Double) {
+      detail::store(self + field->offset, d);
+    } else if (field->kind == FieldKind::Float) {
+      detail::store(self + field->offset, static_cast<float>(d));
+    } else {
+      return fail(ParseError::TypeMismatch);
+    }
+    return valueEnd();
+  }
+  bool RawNumber(const char *, rapidjson::SizeType, bool) override {
+    return fail(ParseError::UnexpectedToken);
+  }
+  bool String(const char *str, rapidjson::SizeType length, bool) override {
+    if (state != S_value) {
+      return fail(ParseError::UnexpectedToken);
+    }
+    if (field->kind != FieldKind::CString) {
+      return fail(ParseError::TypeMismatch);
+    }
+    if (table.validate_utf8 && !validUtf8(str, length)) {
+      return fail(ParseError::InvalidUtf8);
+    }
+    detail::store(self + field->offset, str);
+    return valueEnd();
+  }
+  bool StartObject() override {
+    if (state != S_start) {
+      return fail(ParseError::UnexpectedToken);
+    }
+    state = S_expect_key;
+    return true;
+  }
+  bool Key(const char *str, rapidjson::SizeType length, bool) override {
+    if (state != S_expect_key) {
+      return fail(ParseError::UnexpectedToken);
+    }
+    for (const FieldInfo *f = table.fields, *end = f + table.size; f != end;
+         ++f) {
+      if (f->key_length == length && std::memcmp(f->key, str, length) == 0) {
+        field = f;
+        state = S_value;
+        return true;
+      }
+    }
+    return fail(ParseError::UnknownKey);
+  }
+  bool EndObject(rapidjson::SizeType) override {
+    if (state != S_expect_key) {
+      return fail(ParseError::UnexpectedToken);
+    }
+    state = S_end;
+    uint64_t missing = table.required & ~seen;
+    if (!patch && missing) {
+      const FieldInfo *f = table.fields;
+      while (!(missing & 1)) {
+        missing >>= 1;
+        ++f;
+      }
+      return failMissing(*f);
+    }
+    return true;
+  }
+  bool StartArray() override { return fail(ParseError::UnexpectedToken); }
+  bool EndArray(rapidjson::SizeType) override {
+    return fail(ParseError::UnexpectedToken);
+  }
+};
+
+// write() of every table-driven record
+template <typename Writer>
+bool writeTable(const RecordTable &table, const void *self, Writer &writer) {
+  const char *base = static_cast<const char *>(self);
+  writer.StartObject();
+  for (const FieldInfo *f = table.fields, *end = f + table.size; f != end;
+       ++f) {
+    writer.Key(f->key, f->key_length);
+    const char *p = base + f->offset;
+    bool ok = false;
+    switch (f->kind) {
+    case FieldKind::Bool:
+      ok = writer.Bool(detail::load<bool>(p));
+      break;
+    case FieldKind::Int8:
+      ok = writer.Int(detail::load<int8_t>(p));
+      break;
+    case FieldKind::Int16:
+      ok = writer.Int(detail::load<int16_t>(p));
+      break;
+    case FieldKind::Int32:
+      ok = writer.Int(detail::load<int32_t>(p));
+      break;
+    case FieldKind::Int64:
+      ok = writer.Int64(detail::load<int64_t>(p));
+      break;
+    case FieldKind::Uint8:
+      ok = writer.Uint(detail::load<uint8_t>(p));
+      break;
+    case FieldKind::Uint16:
+      ok = writer.Uint(detail::load<uint16_t>(p));
+      break;
+    case FieldKind::Uint32:
+      ok = writer.Uint(detail::load<uint32_t>(p));
+      break;
+    case FieldKind::Uint64:
+      ok = writer.Uint64(detail::load<uint64_t>(p));
+      break;
+    case FieldKind::Float:
+      ok = writer.Double(detail::load<float>(p));
+      break;
+    case FieldKind::Double:
+      ok = writer.Double(detail::load<double>(p));
+      break;
+    case FieldKind::CString: {
+      const char *s = detail::load<const char *>(p);
+      ok = s ? writer.String(s) : writer.Null();
+      break;
+    }
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  return writer.EndObject();
+}
+
+} // namespace jsongen
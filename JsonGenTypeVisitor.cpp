@@ -1,96 +1,378 @@
 #include "JsonGenTypeVisitor.hpp"
 
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/CommentCommandTraits.h"
 #include "clang/Basic/Diagnostic.h"
+#include "llvm/Support/SaveAndRestore.h"
 
-RecordDirective::RecordDirective(const clang::comments::FullComment* fc) {
-}
-
-FiedlDirective::FiedlDirective(const clang::comments::FullComment* fc) {
-}
+#include <algorithm>
+#include <vector>
 
-JsonGenTypeVisitor::JsonGenTypeVisitor(std::ostream& os, clang::ASTContext *ast_context)
-    : os(os), ast_context(ast_context), diags(ast_context->getDiagnostics()) {
-  diag_error_complex = diags->getCustomDiagID(clang::DiagnosticEngine::Error,
+JsonGenTypeVisitor::JsonGenTypeVisitor(clang::ASTContext *ast_context)
+    : ast_context(ast_context), diags(&ast_context->getDiagnostics()) {
+  diag_error_complex = diags->getCustomDiagID(clang::DiagnosticsEngine::Error,
                                               "no support for complex type");
   diag_error_block_pointer = diags->getCustomDiagID(
-      clang::DiagnosticEngine::Error, "no support for block pointer");
+      clang::DiagnosticsEngine::Error, "no support for block pointer");
   diag_error_incomplete_array = diags->getCustomDiagID(
-      clang::DiagnosticEngine::Error, "no support for incomplete array");
+      clang::DiagnosticsEngine::Error, "no support for incomplete array");
   diag_error_vla = diags->getCustomDiagID(
-      clang::DiagnosticEngine::Error, "no support for variable length array");
-  diag_error_template = diags->getCustomDiagID(clang::DiagnosticEngine::Error,
+      clang::DiagnosticsEngine::Error, "no support for variable length array");
+  diag_error_template = diags->getCustomDiagID(clang::DiagnosticsEngine::Error,
                                                "no support for template");
   diag_error_simd = diags->getCustomDiagID(
-      clang::DiagnosticEngine::Error, "no support for gnu vector extension");
+      clang::DiagnosticsEngine::Error, "no support for gnu vector extension");
   diag_error_attributed_type = diags->getCustomDiagID(
-      clang::DiagnosticEngine::Error, "no support for attributed type");
+      clang::DiagnosticsEngine::Error, "no support for attributed type");
   diag_error_injected_class_name = diags->getCustomDiagID(
-      clang::DiagnosticEngine::Error, "can not have injected class name");
-  diag_error_objc = diags->getCustomDiagID(clang::DiagnosticEngine::Error,
+      clang::DiagnosticsEngine::Error, "can not have injected class name");
+  diag_error_objc = diags->getCustomDiagID(clang::DiagnosticsEngine::Error,
                                            "no support for objc type");
-  diag_error_pipe = diags->getCustomDiagID(clang::DiagnosticEngine::Error,
+  diag_error_pipe = diags->getCustomDiagID(clang::DiagnosticsEngine::Error,
                                            "no support for OpenCL Pipe");
-  diag_error_atomic = diags->getCustomDiagID(clang::DiagnosticEngine::Error,
+  diag_error_atomic = diags->getCustomDiagID(clang::DiagnosticsEngine::Error,
                                              "no support for atomic type");
+  diag_error_child_not_jsongen = diags->getCustomDiagID(
+      clang::DiagnosticsEngine::Error,
+      "nested record without \\jsongen");
+  diag_error_nested_array = diags->getCustomDiagID(
+      clang::DiagnosticsEngine::Error,
+      "no support for multi-dimensional arrays: the elements of an array "
+      "member must be scalars, records or pointers to records");
+  diag_error_intern_type = diags->getCustomDiagID(
+      clang::DiagnosticsEngine::Error,
+      "\\intern member must be an integer id, a const char * or a string "
+      "view");
+  diag_error_inline_string_type = diags->getCustomDiagID(
+      clang::DiagnosticsEngine::Error,
+      "\\inlineString member must be a char array or a "
+      "jsongen::InlineString");
+  diag_error_inline_string_overflow = diags->getCustomDiagID(
+      clang::DiagnosticsEngine::Error,
+      "\\inlineString takes reject, truncate or spill, and spill only for a "
+      "jsongen::InlineString");
+  diag_error_required_not_written = diags->getCustomDiagID(
+      clang::DiagnosticsEngine::Error,
+      "write() can not write this \\required member back, parse() would "
+      "reject what it writes");
+  diag_error_vector_element = diags->getCustomDiagID(
+      clang::DiagnosticsEngine::Error,
+      "std::vector member must hold \\jsongen records or scalars");
+  diag_error_smart_pointer = diags->getCustomDiagID(
+      clang::DiagnosticsEngine::Error,
+      "no support for smart pointers, nested records are plain pointers "
+      "allocated from the jsongen::ParseContext pool, or std::vector "
+      "elements");
   diag_warning_pointer_as_integer = diags->getCustomDiagID(
-      clang::DiagnosticEngine::Warning, "treating pointer as integer");
+      clang::DiagnosticsEngine::Warning, "treating pointer as integer");
   diag_warning_function_proto_as_integer = diags->getCustomDiagID(
-      clang::DiagnosticEngine::Warning, "treating function proto as integer");
+      clang::DiagnosticsEngine::Warning, "treating function proto as integer");
   diag_warning_function_no_proto_as_integer =
-      diags->getCustomDiagID(clang::DiagnosticEngine::Warning,
+      diags->getCustomDiagID(clang::DiagnosticsEngine::Warning,
                              "treating FunctionNoProtoType as integer");
   diag_warning_paren_as_integer = diags->getCustomDiagID(
-      clang::DiagnosticEngine::Warning, "treating ParenType as integer");
+      clang::DiagnosticsEngine::Warning, "treating ParenType as integer");
   diag_warning_enum_as_int64_t = diags->getCustomDiagID(
-      clang::DiagnosticEngine::Warning, "treating enum as int64_t");
+      clang::DiagnosticsEngine::Warning, "treating enum as its underlying integer type");
+  diag_warning_not_written = diags->getCustomDiagID(
+      clang::DiagnosticsEngine::Warning,
+      "write() can not write this member back, it is left out");
 }
 
-bool JsonGenTypeVisitor::generateCode(clang::CXXRecordDecl * reco,
-                            const clang::comments::FullComment * fc) {
-  if (RecordInfo * ri = record_infos[reco]) {
-    return generateCode_impl(ri);
+const TypeClass *JsonGenTypeVisitor::classify(clang::QualType qt) {
+  clang::QualType canon = qt.getCanonicalType().getUnqualifiedType();
+  auto it = type_classes.find(canon);
+  if (it != type_classes.end()) {
+    const TypeClass *tc = it->second;
+    // the nested record still has to be checked for the record being visited
+    if (tc && tc->getNestedRecord()) {
+      pending_records.push_back(tc->getNestedRecord());
+    }
+    if (tc) {
+      fallbacks |= tc->fallbacks;
+    }
+    return tc;
+  }
+  // the fallbacks of this type, an array gets those of its element too
+  unsigned outer = fallbacks;
+  fallbacks = TypeClass::FB_None;
+  bool ok = Visit(qt.getTypePtr());
+  unsigned own = fallbacks;
+  fallbacks |= outer;
+  if (!ok) {
+    type_classes[canon] = nullptr;
+    return nullptr;
   }
-  visited_records.clear();
-  visited_records.insert(reco);
-  Visit(decl->getTypeForDecl());
-  return generateCode_impl(record_infos[reco]);
+  // the sugar of qt may have been classified while walking it
+  it = type_classes.find(canon);
+  if (it != type_classes.end()) {
+    return it->second;
+  }
+  TypeClass *tc = new (type_class_allocator.Allocate())
+      TypeClass(makeTypeClass(canon));
+  tc->fallbacks = own;
+  type_classes[canon] = tc;
+  return tc;
 }
 
-bool JsonGenTypeVisitor::VisitRecordType(const clang::RecordType * reco_) {
-  const clang::CXXRecordDecl* reco = static_cast<const clang::CXXRecordDecl*>(reco_);
-  if (!reco) {
-    return false;
+// the kinds of integer SAX callbacks whose values don't always fit into an
+// integer of the given width and signedness
+static unsigned getNarrowingKinds(unsigned bits, bool is_signed) {
+  struct {
+    TypeClass::ValueKind kind;
+    unsigned bits;
+    bool is_signed;
+  } callbacks[] = {{TypeClass::VK_Int, 32, true},
+                   {TypeClass::VK_Uint, 32, false},
+                   {TypeClass::VK_Int64, 64, true},
+                   {TypeClass::VK_Uint64, 64, false}};
+  unsigned kinds = TypeClass::VK_None;
+  for (const auto &cb : callbacks) {
+    bool fits = cb.is_signed == is_signed ? cb.bits <= bits
+                                          : !cb.is_signed && cb.bits < bits;
+    if (!fits) {
+      kinds |= cb.kind;
+    }
   }
-  if (record_infos[reco]) {
+  return kinds;
+}
+
+TypeClass JsonGenTypeVisitor::makeTypeClass(clang::QualType canon) {
+  const clang::PrintingPolicy &policy = ast_context->getPrintingPolicy();
+  const unsigned integers = TypeClass::VK_Int | TypeClass::VK_Uint |
+                            TypeClass::VK_Int64 | TypeClass::VK_Uint64;
+  TypeClass tc;
+  tc.spelling = canon.getAsString(policy);
+  const clang::Type *t = canon.getTypePtr();
+  if (t->isBooleanType()) {
+    tc.shape = TypeClass::Scalar;
+    tc.value_kinds = TypeClass::VK_Null | TypeClass::VK_Bool;
+    tc.write_kind = TypeClass::VK_Bool;
+    tc.table_kind = "Bool";
+  } else if (t->isEnumeralType() || t->isIntegerType()) {
+    // enums are range checked against, and written as, their underlying type
+    clang::QualType integer = canon;
+    if (const clang::EnumType *et = t->getAs<clang::EnumType>()) {
+      integer = et->getDecl()->getIntegerType().getCanonicalType();
+    }
+    unsigned bits = ast_context->getTypeSize(integer);
+    bool is_signed = integer->isSignedIntegerType();
+    tc.shape = TypeClass::Scalar;
+    tc.value_kinds = TypeClass::VK_Null | integers;
+    tc.narrowing_kinds = getNarrowingKinds(bits, is_signed);
+    tc.range_type = integer.getAsString(policy);
+    tc.bulk_numeric = !t->isEnumeralType();
+    if (is_signed) {
+      tc.write_kind = bits <= 32 ? TypeClass::VK_Int : TypeClass::VK_Int64;
+    } else {
+      tc.write_kind = bits <= 32 ? TypeClass::VK_Uint : TypeClass::VK_Uint64;
+    }
+    static const char *const table_kinds[2][4] = {
+        {"Uint8", "Uint16", "Uint32", "Uint64"},
+        {"Int8", "Int16", "Int32", "Int64"}};
+    for (unsigned i = 0; i != 4; ++i) {
+      if (bits == 8u << i) {
+        tc.table_kind = table_kinds[is_signed][i];
+      }
+    }
+  } else if (t->isRealFloatingType()) {
+    // integral json numbers are fine for floating fields, without checks
+    tc.shape = TypeClass::Scalar;
+    tc.value_kinds = TypeClass::VK_Null | TypeClass::VK_Double | integers;
+    tc.write_kind = TypeClass::VK_Double;
+    tc.bulk_numeric = true;
+    if (t->isSpecificBuiltinType(clang::BuiltinType::Float)) {
+      tc.table_kind = "Float";
+    } else if (t->isSpecificBuiltinType(clang::BuiltinType::Double)) {
+      tc.table_kind = "Double";
+    }
+  } else if (t->isPointerType()) {
+    tc.shape = TypeClass::Pointer;
+    tc.record = t->getPointeeCXXRecordDecl();
+    if (tc.record) {
+      tc.record = tc.record->getDefinition();
+      tc.value_kinds = TypeClass::VK_Null | TypeClass::VK_Object;
+      tc.write_kind = TypeClass::VK_Object;
+    }
+  } else if (isStdTemplate(t->getAsCXXRecordDecl(), "vector")) {
+    // the element may be the record being visited, it is not classified
+    // through Visit(), which has checked it is a record or a scalar
+    const auto *spec =
+        llvm::cast<clang::ClassTemplateSpecializationDecl>(
+            t->getAsCXXRecordDecl());
+    clang::QualType element =
+        spec->getTemplateArgs()[0].getAsType().getCanonicalType();
+    tc.shape = TypeClass::Vector;
+    tc.element = new (type_class_allocator.Allocate())
+        TypeClass(makeTypeClass(element));
+    tc.value_kinds = TypeClass::VK_Array;
+    tc.write_kind = TypeClass::VK_Array;
+  } else if (t->isRecordType()) {
+    tc.shape = TypeClass::Record;
+    tc.record = t->getAsCXXRecordDecl();
+    if (tc.record) {
+      tc.record = tc.record->getDefinition();
+    }
+    tc.value_kinds = TypeClass::VK_Object;
+    tc.write_kind = TypeClass::VK_Object;
+  } else if (const clang::ConstantArrayType *carr =
+                 ast_context->getAsConstantArrayType(canon)) {
+    tc.shape = TypeClass::ConstantArray;
+    tc.element = classify(carr->getElementType());
+    tc.array_size = carr->getSize().getZExtValue();
+    tc.value_kinds = TypeClass::VK_Array;
+    tc.write_kind = TypeClass::VK_Array;
+  }
+  return tc;
+}
+
+bool JsonGenTypeVisitor::VisitRecordType(const clang::RecordType * t) {
+  SPDLOG_ENTER();
+  const clang::CXXRecordDecl *reco =
+      llvm::dyn_cast<clang::CXXRecordDecl>(t->getDecl());
+  // a std::vector of records is filled by the handlers of the element, which
+  // may be the record being visited, so only remember it here; a std::vector
+  // of scalars grows by one per value
+  if (isStdTemplate(reco, "vector")) {
+    const auto *spec = llvm::cast<clang::ClassTemplateSpecializationDecl>(reco);
+    clang::QualType element_type = spec->getTemplateArgs()[0].getAsType();
+    const clang::CXXRecordDecl *element = element_type->getAsCXXRecordDecl();
+    if (element &&
+        !llvm::isa<clang::ClassTemplateSpecializationDecl>(element)) {
+      pending_records.push_back(element);
+      return true;
+    }
+    const TypeClass *tc = element ? nullptr : classify(element_type);
+    if (!tc || tc->shape != TypeClass::Scalar) {
+      diags->Report(field_loc, diag_error_vector_element);
+      return false;
+    }
     return true;
   }
-  if (visited_records[reco]) {
+  if (!reco || !reco->hasDefinition()) {
     return false;
   }
-  RecordInfo * ri = new RecordInfo;
+  reco = reco->getDefinition();
+  if (record_infos.count(reco)) {
+    return true;
+  }
+  llvm::SaveAndRestore<clang::SourceLocation> saved_loc(field_loc);
+  const clang::comments::CommandTraits *traits =
+      &ast_context->getCommentCommandTraits();
+  RecordDirective rd(ast_context->getCommentForDecl(reco, nullptr), traits);
+  RecordInfo * ri = createRecordInfo(reco);
+  ri->setDirective(rd);
+  for (const clang::CXXBaseSpecifier & bs : reco->bases()) {
+    if (!Visit(bs.getType())) {
+      return false;
+    }
+    const clang::CXXRecordDecl *base =
+        bs.getType()->getAsCXXRecordDecl()->getDefinition();
+    SubClass sc(&bs, record_infos.lookup(base));
+    sc.omit = std::find(rd.omit_base.begin(), rd.omit_base.end(),
+                        base->getName()) != rd.omit_base.end();
+    if (bs.isVirtual()) {
+      ri->addVBase(sc);
+    } else {
+      ri->addBase(sc);
+    }
+  }
+  std::vector<Field> fields;
   for (const clang::FieldDecl* fd : reco->fields()) {
-    const clang::Type * type = fd->getType().getTypePtr();
-    if (!Visit(type)) {
+    FieldDirective directive(ast_context->getCommentForDecl(fd, nullptr),
+                             traits);
+    // the directive tells how to treat strings and arrays, don't look into
+    // their types
+    const TypeClass *tc = nullptr;
+    field_loc = fd->getLocation();
+    if (!directive.is_omit && !directive.hasLayout() &&
+        !(tc = classify(fd->getType()))) {
       return false;
     }
-    ri->addMember(fd->getName().str(), type);
+    if (directive.is_interned) {
+      clang::QualType qt = fd->getType().getCanonicalType();
+      bool id = qt->isIntegerType() && !qt->isBooleanType() &&
+                !qt->isEnumeralType();
+      bool chars = qt->isPointerType() &&
+                   qt->getPointeeType()->isCharType() &&
+                   qt->getPointeeType().isConstQualified();
+      if (!id && !chars && !qt->isRecordType()) {
+        diags->Report(fd->getLocation(), diag_error_intern_type);
+        return false;
+      }
+    }
+    if (directive.is_inline_string) {
+      clang::QualType qt = fd->getType().getCanonicalType();
+      const clang::ConstantArrayType *chars =
+          ast_context->getAsConstantArrayType(qt);
+      bool array = chars &&
+                   (chars->getElementType()->isSpecificBuiltinType(
+                        clang::BuiltinType::Char_S) ||
+                    chars->getElementType()->isSpecificBuiltinType(
+                        clang::BuiltinType::Char_U));
+      const clang::CXXRecordDecl *record = qt->getAsCXXRecordDecl();
+      bool inline_string =
+          record &&
+          record->getQualifiedNameAsString() == "jsongen::InlineString";
+      if (!array && !inline_string) {
+        diags->Report(fd->getLocation(), diag_error_inline_string_type);
+        return false;
+      }
+      const std::string &overflow = directive.param;
+      if (!(overflow.empty() || overflow == "reject" ||
+            overflow == "truncate" || (overflow == "spill" && !array))) {
+        diags->Report(fd->getLocation(), diag_error_inline_string_overflow);
+        return false;
+      }
+    }
+    fields.emplace_back(fd, directive, tc);
   }
-  if (reco->beses_begin() == reco->bases_end()) {
-    record_infos[reco] = ri;
-    return true;
+  // \string var and \array var make var the length of another member
+  for (const Field &f : fields) {
+    if (!f.directive.is_string_pointer && !f.directive.is_array_pointer) {
+      continue;
+    }
+    for (Field &length : fields) {
+      if (length.field->getName() == f.directive.param) {
+        length.directive.is_omit = true;
+        length.directive.is_empty = false;
+        if (f.directive.is_string_pointer) {
+          length.directive.is_string_length = true;
+        } else {
+          length.directive.is_array_length = true;
+        }
+      }
+    }
+  }
+  for (Field &f : fields) {
+    if (!f.directive.is_omit && !RecordInfo::isWritten(f)) {
+      if (f.directive.is_required) {
+        diags->Report(f.field->getLocation(), diag_error_required_not_written);
+        return false;
+      }
+      diags->Report(f.field->getLocation(), diag_warning_not_written);
+    }
+    ri->addMember(std::move(f));
   }
-  visited_records.insert(reco);
-  for (const CXXBaseSpecifier * bs : reco->bases()) {
-    const clang::RecordType * type = staitc_cast<const clang::RecordType*>(bs->getType().getTypePtr());
-    if (!Visit(type)) {
+  record_infos[reco] = ri;
+  return true;
+}
+
+// nested records must be \jsongen records themselves, so that their handlers
+// are generated too
+bool JsonGenTypeVisitor::visitPendingRecords() {
+  while (!pending_records.empty()) {
+    const clang::CXXRecordDecl *reco = pending_records.back();
+    pending_records.pop_back();
+    if (!reco->hasDefinition() ||
+        !Visit(ast_context->getRecordType(reco->getDefinition()))) {
       return false;
     }
-    if (bs->isVirtual()) {
-      ri->addVirtualBase(type);
-    } else {
-      ri->addBase(type);
+    RecordInfo *ri = record_infos.lookup(reco->getDefinition());
+    if (ri->getDirective().is_empty) {
+      diags->Report(reco->getLocation(), diag_error_child_not_jsongen);
+      return false;
     }
   }
-  record_infos[reco] = ri;
   return true;
 }
@@ -1,45 +1,80 @@
 #pragma once
 
 #include "JsonGen.hpp"
+#include "RecordInfo.hpp"
+#include "TypeClass.hpp"
 
 #include "clang/AST/Comment.h"
 #include "clang/AST/DeclCXX.h"
+#include "clang/AST/DeclTemplate.h"
 #include "clang/AST/Expr.h"
 #include "clang/AST/Type.h"
 #include "clang/Basic/Diagnostic.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/Allocator.h"
 
 #include <memory>
-#include <ostream>
 
 namespace clang {
 class ASTContext;
 }
 
-class RecordInfo;
-
 /* The class we generate code for must satisfy the following conditions:
  * 1 each direct base is not also inherited as a indirect base(otherwise we
  * won't be able to convert the class to it's direct base to access the direct
  * base 2 only generate code for members that is accessible to this class
  */
 class JsonGenTypeVisitor {
-  std::ostream &os;
   clang::ASTContext *ast_context;
-  clang::DiagnosticEngine *diag;
+  clang::DiagnosticsEngine *diags;
   unsigned diag_error_complex, diag_error_block_pointer,
       diag_error_incomplete_array, diag_error_vla, diag_error_template,
       diag_error_simd, diag_error_attributed_type,
       diag_error_injected_class_name, diag_error_objc, diag_error_pipe,
-      diag_error_atomic;
+      diag_error_atomic, diag_error_child_not_jsongen,
+      diag_error_nested_array, diag_error_intern_type,
+      diag_error_inline_string_type, diag_error_inline_string_overflow,
+      diag_error_required_not_written, diag_error_vector_element,
+      diag_error_smart_pointer;
   unsigned diag_warning_pointer_as_integer,
       diag_warning_function_proto_as_integer,
       diag_warning_function_no_proto_as_integer, diag_warning_paren_as_integer,
-      diag_warning_enum_as_int64_t;
+      diag_warning_enum_as_int64_t, diag_warning_not_written;
   llvm::DenseMap<const clang::CXXRecordDecl *, RecordInfo *> record_infos;
+  // RecordInfos and the names computed from them live as long as the visitor
+  llvm::SpecificBumpPtrAllocator<RecordInfo> record_allocator;
+  llvm::BumpPtrAllocator name_allocator;
+  // the member whose type is being classified, the diagnostics that are
+  // about it go there
+  clang::SourceLocation field_loc;
+  // records reached through pointers, visited once the current record is done
+  std::vector<const clang::CXXRecordDecl *> pending_records;
+  bool visitPendingRecords();
+  RecordInfo *createRecordInfo(const clang::CXXRecordDecl *decl) {
+    return new (record_allocator.Allocate()) RecordInfo(decl, name_allocator);
+  }
+  // the classification of every canonical type seen so far, nullptr for the
+  // types we can't generate code for
+  llvm::DenseMap<clang::QualType, const TypeClass *> type_classes;
+  llvm::SpecificBumpPtrAllocator<TypeClass> type_class_allocator;
+  TypeClass makeTypeClass(clang::QualType canon);
+  // the fallbacks taken by the type classify() is walking
+  unsigned fallbacks = TypeClass::FB_None;
+  void warn(unsigned diag, TypeClass::Fallback fallback) {
+    diags->Report(diag);
+    fallbacks |= fallback;
+  }
 
   // QualType is not part of the clang Type system, but we provide it here as a
   // convenient helper
-  bool Visit(clang::QualType qt) { return Visit(qt.getTypePtr()); }
+  bool Visit(clang::QualType qt) { return classify(qt) != nullptr; }
+  // a specialization of std::<name>, whatever inline namespace the standard
+  // library puts it in
+  static bool isStdTemplate(const clang::CXXRecordDecl *reco,
+                            llvm::StringRef name) {
+    return reco && llvm::isa<clang::ClassTemplateSpecializationDecl>(reco) &&
+           reco->isInStdNamespace() && reco->getName() == name;
+  }
   bool Visit(const clang::Type *T) {
     // Top switch stmt: dispatch to VisitFooType for each FooType.
 #define DISPATCH(CLASS)                                                        \
@@ -67,9 +102,15 @@ class JsonGenTypeVisitor {
     diags->Report(diag_error_complex);
     return false;
   }
-  bool VisitPointerType(const clang::PointerType *) {
+  bool VisitPointerType(const clang::PointerType *t) {
     SPDLOG_ENTER();
-    diags->Report(diag_warning_pointer_as_integer);
+    // a pointer to a record is a nested object, the record may be the one
+    // being visited (recursive records), so only remember it here
+    if (const clang::CXXRecordDecl *reco = t->getPointeeCXXRecordDecl()) {
+      pending_records.push_back(reco);
+      return true;
+    }
+    warn(diag_warning_pointer_as_integer, TypeClass::FB_PointerAsInteger);
     // treate pointer as uint_t
     return false;
   }
@@ -88,14 +129,27 @@ class JsonGenTypeVisitor {
     SPDLOG_ENTER();
     return Visit(rref->getPointeeType());
   }
-  bool VisitMemberPointerType(const clang::MemberPointerType) {
+  bool VisitMemberPointerType(const clang::MemberPointerType *) {
     SPDLOG_ENTER();
     // treate member pointer as integer
     return true;
   }
   bool VisitConstantArrayType(const clang::ConstantArrayType *carr) {
     SPDLOG_ENTER();
-    return Visit(carr->getElementType());
+    const TypeClass *element = classify(carr->getElementType());
+    if (!element) {
+      return false;
+    }
+    if (element->shape == TypeClass::ConstantArray ||
+        element->shape == TypeClass::Vector) {
+      diags->Report(field_loc, diag_error_nested_array);
+      return false;
+    }
+    // records stored in the array are filled by their own handlers
+    if (element->shape == TypeClass::Record) {
+      pending_records.push_back(element->record);
+    }
+    return true;
   }
   bool VisitIncompleteArrayType(const clang::IncompleteArrayType *iarr) {
     SPDLOG_ENTER();
@@ -151,13 +205,15 @@ class JsonGenTypeVisitor {
   bool VisitFunctionProtoType(const clang::FunctionProtoType *) {
     SPDLOG_ENTER();
     // treate as integer
-    diags->Report(diag_warning_function_proto_as_integer);
+    warn(diag_warning_function_proto_as_integer,
+         TypeClass::FB_FunctionProtoAsInteger);
     return true;
   }
   bool VisitFunctionNoProtoType(const clang::FunctionNoProtoType *) {
     SPDLOG_ENTER();
     // treate as integer
-    diags->Report(diag_warning_function_no_proto_as_integer);
+    warn(diag_warning_function_no_proto_as_integer,
+         TypeClass::FB_FunctionNoProtoAsInteger);
     return true;
   }
   bool VisitUnresolvedUsingType(const clang::UnresolvedUsingType *) {
@@ -169,10 +225,10 @@ class JsonGenTypeVisitor {
   bool VisitParenType(const clang::ParenType *) {
     SPDLOG_ENTER();
     // treate as integer
-    diags->Report(diag_warning_paren_as_integer);
+    warn(diag_warning_paren_as_integer, TypeClass::FB_ParenAsInteger);
     return true;
   }
-  bool VisitTypedefType(const clang::TypedefType *t, ) {
+  bool VisitTypedefType(const clang::TypedefType *t) {
     SPDLOG_ENTER();
     // desugar() and pray for it to be correct
     return Visit(t->desugar());
@@ -210,21 +266,20 @@ class JsonGenTypeVisitor {
   bool VisitRecordType(const clang::RecordType *t);
   bool VisitEnumType(const clang::EnumType *t) {
     SPDLOG_ENTER();
-    // treate enum as int64_t, and pray for it not to blow up
-    diags->Report(diag_warning_enum_as_int64_t);
+    // treate enum as its underlying type, see makeTypeClass()
+    warn(diag_warning_enum_as_int64_t, TypeClass::FB_EnumAsInteger);
     return true;
   }
   bool VisitElaboratedType(const clang::ElaboratedType *t) {
     SPDLOG_ENTER();
-    // elaborated type specifier can only appear in templates
-    SPDLOG_ERROR(console_logger, "no support for template related type");
-    diags->Report(diag_error_template);
-    return false;
+    // ns::Enum, struct Foo, std::uint32_t: the qualified name of another
+    // type
+    return Visit(t->desugar());
   }
   bool VisitAttributedType(const clang::AttributedType *t) {
     SPDLOG_ENTER();
     // return false because we don't understand all the attributes
-    diags->Repoer(diag_error_attributed_type);
+    diags->Report(diag_error_attributed_type);
     return false;
   }
   bool VisitTemplateTypeParmType(const clang::TemplateTypeParmType *) {
@@ -245,8 +300,18 @@ class JsonGenTypeVisitor {
     return false;
   }
   bool
-  VisitTemplateSpecializationType(const clang::TemplateSpecializationType *) {
+  VisitTemplateSpecializationType(const clang::TemplateSpecializationType *t) {
     SPDLOG_ENTER();
+    const clang::CXXRecordDecl *reco = t->getAsCXXRecordDecl();
+    // a std::vector of records is an array member, see VisitRecordType()
+    if (isStdTemplate(reco, "vector")) {
+      return Visit(t->desugar());
+    }
+    if (isStdTemplate(reco, "unique_ptr") ||
+        isStdTemplate(reco, "shared_ptr")) {
+      diags->Report(field_loc, diag_error_smart_pointer);
+      return false;
+    }
     diags->Report(diag_error_template);
     return false;
   }
@@ -261,8 +326,8 @@ class JsonGenTypeVisitor {
   }
   bool VisitInjectedClassNameType(const clang::InjectedClassNameType *) {
     SPDLOG_ENTER();
-    // return false because you can not create recursive object in json
-    // unless you use features like option, but we don't support that yet
+    // only appears inside class templates, recursive records are reached
+    // through VisitPointerType
     diags->Report(diag_error_template);
     return false;
   }
@@ -315,27 +380,25 @@ class JsonGenTypeVisitor {
   }
 
 public:
-  JsonGenTypeVisitor(std::ostream &, clang::ASTContext *);
-  ~JsonGenTypeVisitor() {
-    for (auto &kv : record_infos) {
-      delete kv.second;
+  explicit JsonGenTypeVisitor(clang::ASTContext *);
+  // walk the type once per canonical type, and return what it is, or nullptr
+  // if it is not supported; the diagnostics are reported the first time only
+  const TypeClass *classify(clang::QualType qt);
+  // collect the RecordInfo of a \jsongen CXXRecordDecl, and of everything it
+  // depends on
+  RecordInfo *addRecord(const clang::CXXRecordDecl *decl,
+                        const RecordDirective &rd) {
+    if (RecordInfo *ri = record_infos.lookup(decl)) {
+      return ri;
     }
-  }
-  // generate code for a CXXRecordDecl
-  const RecordInfo* addRecord(clang::CXXRecordDecl *decl,
-                 const clang::comments::FullComment *fc) {
-    RecordDirective rd(fc);
-    if (rd.empty()) {
+    if (!Visit(decl->getTypeForDecl()) || !visitPendingRecords()) {
       return nullptr;
     }
-    if (const auto * ri = record_infos[decl]) {
-      return ri;
-    }
-    Visit(decl->getTypeForDecl());
-    auto & ri = record_infos[decl];
-    ri.setDirective(rd);
+    RecordInfo *ri = record_infos.lookup(decl);
+    ri->setDirective(rd);
     return ri;
   }
-  const RecordInfo *getInfo(clang::CXXRecordDecl *decl) {
+  RecordInfo *getInfo(const clang::CXXRecordDecl *decl) {
+    return record_infos.lookup(decl);
   }
 };
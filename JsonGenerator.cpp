@@ -1,5 +1,8 @@
 #include "JsonGen.hpp"
 #include "JsonGenTypeVisitor.hpp"
+#include "Manifest.hpp"
+#include "Profile.hpp"
+#include "RecordInfo.hpp"
 
 #include "clang/AST/AST.h"
 #include "clang/AST/ASTConsumer.h"
@@ -9,12 +12,23 @@
 #include "clang/AST/DeclCXX.h"
 #include "clang/AST/Type.h"
 #include "clang/AST/TypeVisitor.h"
+#include "clang/Basic/Diagnostic.h"
 #include "clang/Basic/SourceManager.h"
 #include "clang/Frontend/FrontendAction.h"
 #include "clang/Frontend/FrontendPluginRegistry.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ADT/iterator_range.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
 
 #include <algorithm>
 #include <cctype>
@@ -25,6 +39,7 @@
 #include <list>
 #include <memory>
 #include <optional>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -53,6 +68,25 @@ const char *startWith(const char *str, const char *substr) {
 struct Config {
   std::string output_file_name;
   std::string log_file_name;
+  // records already generated by other translation units, empty means
+  // don't deduplicate
+  std::string manifest_file_name;
+  // machine readable timing of each phase, empty means don't record
+  std::string stats_file_name;
+  // the definitions go here instead of inline in the output header
+  std::string source_file_name;
+  // the key statistics of an instrumented build, empty means declaration
+  // order
+  std::string profile_file_name;
+  // a make rule listing the headers the output depends on, empty means
+  // don't write it
+  std::string depfile_name;
+  // the states, bases and code size of each record, empty means don't
+  // write it
+  std::string report_file_name;
+  // threads emitting records, 0 means one per hardware thread
+  unsigned jobs;
+  EmitOptions emit_options;
 };
 
 #pragma GCC diagnostic push
@@ -62,7 +96,15 @@ struct Config {
 #pragma GCC diagnostic ignored "-Wc99-extensions"
 #endif
 const Config default_config = {.output_file_name = JSONGEN_str + ".hpp",
-                               .log_file_name = "/tmp/" + JSONGEN_str + ".log"};
+                               .log_file_name = "/tmp/" + JSONGEN_str + ".log",
+                               .manifest_file_name = "",
+                               .stats_file_name = "",
+                               .source_file_name = "",
+                               .profile_file_name = "",
+                               .depfile_name = "",
+                               .report_file_name = "",
+                               .jobs = 0,
+                               .emit_options = EmitOptions()};
 #pragma GCC diagnostic pop
 
 
@@ -70,6 +112,8 @@ class JsonGeneratorAction : public clang::PluginASTAction {
   Config config = default_config;
 
 public:
+  const Config &getConfig() const { return config; }
+
   std::unique_ptr<clang::ASTConsumer>
   CreateASTConsumer(clang::CompilerInstance &CI, llvm::StringRef) override;
 
@@ -103,7 +147,143 @@ public:
         return false;
       }
     };
-    std::pair<const char *, hdl_func> arg_handlers[] = {{log_str, log_hdl}};
+    const char *output_str = "output=";
+    bool output_specified = false;
+    auto output_hdl = [&](const char *pos) -> bool {
+      if (!output_specified) {
+        config.output_file_name = pos;
+        output_specified = true;
+        return true;
+      } else {
+        SPDLOG_ERROR(console_logger, "error: multiple output file specified");
+        return false;
+      }
+    };
+    const char *manifest_str = "manifest=";
+    auto manifest_hdl = [&](const char *pos) -> bool {
+      if (!config.manifest_file_name.size()) {
+        config.manifest_file_name = pos;
+        return true;
+      } else {
+        SPDLOG_ERROR(console_logger, "error: multiple manifest file specified");
+        return false;
+      }
+    };
+    const char *stats_str = "stats=";
+    auto stats_hdl = [&](const char *pos) -> bool {
+      if (!config.stats_file_name.size()) {
+        config.stats_file_name = pos;
+        return true;
+      } else {
+        SPDLOG_ERROR(console_logger, "error: multiple stats file specified");
+        return false;
+      }
+    };
+    const char *source_str = "source=";
+    auto source_hdl = [&](const char *pos) -> bool {
+      if (!config.source_file_name.size()) {
+        config.source_file_name = pos;
+        config.emit_options.inline_definitions = false;
+        return true;
+      } else {
+        SPDLOG_ERROR(console_logger, "error: multiple source file specified");
+        return false;
+      }
+    };
+    const char *profile_str = "profile=";
+    auto profile_hdl = [&](const char *pos) -> bool {
+      if (!config.profile_file_name.size()) {
+        config.profile_file_name = pos;
+        return true;
+      } else {
+        SPDLOG_ERROR(console_logger, "error: multiple profile file specified");
+        return false;
+      }
+    };
+    const char *depfile_str = "depfile=";
+    auto depfile_hdl = [&](const char *pos) -> bool {
+      if (!config.depfile_name.size()) {
+        config.depfile_name = pos;
+        return true;
+      } else {
+        SPDLOG_ERROR(console_logger, "error: multiple depfile specified");
+        return false;
+      }
+    };
+    const char *report_str = "report=";
+    auto report_hdl = [&](const char *pos) -> bool {
+      if (!config.report_file_name.size()) {
+        config.report_file_name = pos;
+        config.emit_options.report = true;
+        return true;
+      } else {
+        SPDLOG_ERROR(console_logger, "error: multiple report file specified");
+        return false;
+      }
+    };
+    const char *tables_str = "tables";
+    auto tables_hdl = [&](const char *pos) -> bool {
+      config.emit_options.table_driven = true;
+      return !*pos;
+    };
+    const char *validate_utf8_str = "validate_utf8";
+    auto validate_utf8_hdl = [&](const char *pos) -> bool {
+      config.emit_options.validate_utf8 = true;
+      return !*pos;
+    };
+    // the optional parts of the generated code, see EmitOptions
+    const char *files_str = "files";
+    auto files_hdl = [&](const char *pos) -> bool {
+      config.emit_options.files = true;
+      return !*pos;
+    };
+    const char *push_str = "push";
+    auto push_hdl = [&](const char *pos) -> bool {
+      config.emit_options.push = true;
+      return !*pos;
+    };
+    const char *views_str = "views";
+    auto views_hdl = [&](const char *pos) -> bool {
+      config.emit_options.views = true;
+      return !*pos;
+    };
+    const char *columns_str = "columns";
+    auto columns_hdl = [&](const char *pos) -> bool {
+      config.emit_options.columns = true;
+      return !*pos;
+    };
+    const char *jobs_str = "jobs=";
+    auto jobs_hdl = [&](const char *pos) -> bool {
+      return !llvm::StringRef(pos).getAsInteger(10, config.jobs);
+    };
+    // extern_templates or extern_templates=<writer type>
+    const char *extern_templates_str = "extern_templates";
+    auto extern_templates_hdl = [&](const char *pos) -> bool {
+      config.emit_options.extern_templates = true;
+      if (*pos == '=') {
+        config.emit_options.extern_writer = pos + 1;
+      } else if (*pos) {
+        return false;
+      }
+      return true;
+    };
+    std::pair<const char *, hdl_func> arg_handlers[] = {
+        {log_str, log_hdl},
+        {output_str, output_hdl},
+        {manifest_str, manifest_hdl},
+        {stats_str, stats_hdl},
+        {source_str, source_hdl},
+        {profile_str, profile_hdl},
+        {depfile_str, depfile_hdl},
+        {report_str, report_hdl},
+        {jobs_str, jobs_hdl},
+        {tables_str, tables_hdl},
+        {validate_utf8_str, validate_utf8_hdl},
+        {files_str, files_hdl},
+        {push_str, push_hdl},
+        {views_str, views_hdl},
+        {columns_str, columns_hdl},
+        {extern_templates_str, extern_templates_hdl}};
     for (int i = 0; i < n; ++i) {
       bool handled = false;
       bool has_error = false;
@@ -126,6 +306,11 @@ public:
         break;
       };
     }
+    if (config.emit_options.extern_templates &&
+        config.emit_options.inline_definitions) {
+      SPDLOG_ERROR(console_logger, "error: extern_templates needs source=");
+      ret = false;
+    }
     if (!ret) {
       SPDLOG_INFO(console_logger, "return error");
       return ret;
@@ -191,20 +376,485 @@ class JsonGeneratorConsumer : public clang::ASTConsumer {
   // map a decl to corresponding item in decls_to_emit
   llvm::DenseMap<clang::Type *, TypeWithDirective *> visited_decl;
 
-  JsonGenTypeVisitor visitor;
-  bool addType(const clang::Type *type) { return visitor.Visit(type); }
+  std::unique_ptr<JsonGenTypeVisitor> visitor;
+  RecordManifest manifest;
+  KeyProfile key_profile;
+  unsigned diag_error_odr_mismatch, diag_error_odr_conflict,
+      diag_error_split_conflict;
+  // the records that survived deduplication, in the order we met them
+  std::vector<RecordInfo *> records_to_emit;
+  unsigned records_skipped = 0;
+
+  // accumulate the time spent in each phase for stats=
+  llvm::TimeRecord collect_time;
+  llvm::TimeRecord emit_time;
+  class PhaseTimer {
+    llvm::TimeRecord &total;
+    llvm::TimeRecord start;
+
+  public:
+    PhaseTimer(llvm::TimeRecord &total)
+        : total(total), start(llvm::TimeRecord::getCurrentTime(true)) {}
+    ~PhaseTimer() {
+      total += llvm::TimeRecord::getCurrentTime(false);
+      total -= start;
+    }
+  };
+
+  // a record is identified by its ODR hash, plus its comments and the ones
+  // of its members and bases, because the directives change the generated
+  // code without changing the definition
+  llvm::hash_code hashComment(llvm::hash_code hash, const clang::Decl *decl) {
+    if (const clang::RawComment *rc =
+            ast_context->getRawCommentForAnyRedecl(decl)) {
+      hash = llvm::hash_combine(
+          hash, rc->getRawText(ast_context->getSourceManager()));
+    }
+    return hash;
+  }
+  llvm::hash_code hashComments(llvm::hash_code hash,
+                               const clang::CXXRecordDecl *decl) {
+    hash = hashComment(hash, decl);
+    for (const clang::FieldDecl *fd : decl->fields()) {
+      hash = hashComment(hash, fd);
+    }
+    for (const clang::CXXBaseSpecifier &base : decl->bases()) {
+      if (const clang::CXXRecordDecl *bd =
+              base.getType()->getAsCXXRecordDecl()) {
+        hash = hashComments(hash, bd);
+      }
+    }
+    return hash;
+  }
+  uint64_t getFingerprint(const clang::CXXRecordDecl *decl) {
+    return hashComments(llvm::hash_value(decl->getODRHash()), decl);
+  }
+
+  // the include guard of the code of a record, when several outputs may
+  // emit it: the owner, and the outputs whose records nest it
+  static std::string getRecordGuard(const clang::CXXRecordDecl *decl) {
+    // FNV-1a, stable from one run to the next
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : decl->getQualifiedNameAsString()) {
+      hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    std::string guard;
+    llvm::raw_string_ostream(guard)
+        << "JSONGEN_RECORD_" << llvm::format_hex_no_prefix(hash, 16, true);
+    return guard;
+  }
+  // text between #ifndef <guard><suffix> and #endif, as is if guard is empty
+  static void writeGuarded(llvm::raw_ostream &os, llvm::StringRef guard,
+                           llvm::StringRef suffix, llvm::StringRef text) {
+    if (guard.empty() || text.empty()) {
+      os << text;
+      return;
+    }
+    os << "#ifndef " << guard << suffix << "\n";
+    os << "#define " << guard << suffix << "\n";
+    os << text;
+    os << "#endif // " << guard << suffix << "\n";
+  }
+
+  bool addType(const clang::Type *type) { return visitor->Visit(type); }
 
   bool addDecl(clang::CXXRecordDecl *decl,
                    const clang::comments::FullComment * fc) {
-    return visitor.addDecl(decl, fc);
+    RecordDirective rd(fc, &ast_context->getCommentCommandTraits());
+    if (rd.is_empty) {
+      return true;
+    }
+    bool skip = false;
+    if (manifest.enabled()) {
+      std::string name = decl->getQualifiedNameAsString();
+      switch (manifest.check(name, getFingerprint(decl))) {
+      case RecordManifest::Status::New:
+      case RecordManifest::Status::Owned:
+        break;
+      case RecordManifest::Status::Generated:
+        SPDLOG_INFO(debug_logger, "{} already generated, skip", name);
+        skip = true;
+        break;
+      case RecordManifest::Status::Stale:
+        SPDLOG_INFO(debug_logger, "{} changed, left to {}", name,
+                    manifest.getOwner(name).str());
+        skip = true;
+        break;
+      case RecordManifest::Status::Mismatch:
+        ast_context->getDiagnostics().Report(decl->getLocation(),
+                                             diag_error_odr_mismatch)
+            << name << manifest.getOwner(name);
+        return false;
+      }
+    }
+    // the skipped records are still collected, the records of this output
+    // may nest them
+    RecordInfo *ri = visitor->addRecord(decl, rd);
+    if (!ri) {
+      return false;
+    }
+    if (skip) {
+      ++records_skipped;
+    } else {
+      records_to_emit.push_back(ri);
+    }
+    return true;
+  }
+
+  // the records another output owns that the records of this output nest,
+  // the handlers of which this output has to declare too
+  std::vector<RecordInfo *> getNestedDependencies() {
+    llvm::SmallPtrSet<const clang::CXXRecordDecl *, 16> seen;
+    llvm::SmallVector<const clang::CXXRecordDecl *, 16> nested;
+    for (RecordInfo *ri : records_to_emit) {
+      seen.insert(ri->getDecl());
+      ri->addNestedRecords(nested);
+    }
+    std::vector<RecordInfo *> dependencies;
+    while (!nested.empty()) {
+      const clang::CXXRecordDecl *decl = nested.pop_back_val();
+      if (!seen.insert(decl).second) {
+        continue;
+      }
+      RecordInfo *ri = visitor->getInfo(decl);
+      ri->prepare();
+      ri->addNestedRecords(nested);
+      dependencies.push_back(ri);
+    }
+    return dependencies;
+  }
+
+  void reportConflicts(const std::vector<RecordManifest::Conflict> &conflicts,
+                       const EmitOptions &opts) {
+    for (const RecordManifest::Conflict &c : conflicts) {
+      // in header mode the guards keep the two copies apart
+      if (c.same_definition && opts.inline_definitions) {
+        SPDLOG_INFO(debug_logger, "{} also generated by {}", c.record,
+                    c.owner);
+        continue;
+      }
+      auto it = llvm::find_if(records_to_emit, [&](RecordInfo *ri) {
+        return ri->getDecl()->getQualifiedNameAsString() == c.record;
+      });
+      ast_context->getDiagnostics().Report(
+          (*it)->getDecl()->getLocation(),
+          c.same_definition ? diag_error_split_conflict
+                            : diag_error_odr_conflict)
+          << c.record << c.owner;
+    }
   }
 
 public:
   JsonGeneratorConsumer(JsonGeneratorAction *action) : action(action) {}
 
-  void Initialize(clang::ASTContext &C) override { ast_context = &C; }
+  void Initialize(clang::ASTContext &C) override {
+    ast_context = &C;
+    visitor = llvm::make_unique<JsonGenTypeVisitor>(&C);
+    diag_error_odr_mismatch = C.getDiagnostics().getCustomDiagID(
+        clang::DiagnosticsEngine::Error,
+        "record '%0' has already been generated into %1 from a different "
+        "definition (ODR violation)");
+    diag_error_odr_conflict = C.getDiagnostics().getCustomDiagID(
+        clang::DiagnosticsEngine::Error,
+        "record '%0' has been generated into %1 at the same time, from a "
+        "different definition (ODR violation)");
+    diag_error_split_conflict = C.getDiagnostics().getCustomDiagID(
+        clang::DiagnosticsEngine::Error,
+        "record '%0' has been generated into %1 at the same time, its "
+        "definitions would be linked twice; build again to leave it to %1");
+    const Config &config = action->getConfig();
+    // the manifest knows the outputs by their absolute path, the plugin may
+    // run from different directories
+    llvm::SmallString<128> output(config.output_file_name);
+    llvm::sys::fs::make_absolute(output);
+    if (!config.manifest_file_name.empty() &&
+        !manifest.load(config.manifest_file_name, output)) {
+      SPDLOG_ERROR(console_logger, "can not read manifest {}",
+                   config.manifest_file_name);
+      has_error = true;
+    }
+    if (!config.profile_file_name.empty() &&
+        !key_profile.load(config.profile_file_name)) {
+      SPDLOG_ERROR(console_logger, "can not read profile {}",
+                   config.profile_file_name);
+      has_error = true;
+    }
+  }
+
+  void writeStats() {
+    const Config &config = action->getConfig();
+    std::error_code ec;
+    llvm::raw_fd_ostream os(config.stats_file_name, ec, llvm::sys::fs::F_Text);
+    if (ec) {
+      SPDLOG_ERROR(console_logger, "can not open {}: {}",
+                   config.stats_file_name, ec.message());
+      return;
+    }
+    auto phase = [&](const char *name, const llvm::TimeRecord &t) {
+      os << "    \"" << name << "\": {\"wall_seconds\": " << t.getWallTime()
+         << ", \"user_seconds\": " << t.getUserTime()
+         << ", \"system_seconds\": " << t.getSystemTime() << "}";
+    };
+    os << "{\n";
+    os << "  \"records_generated\": " << records_to_emit.size() << ",\n";
+    os << "  \"records_skipped\": " << records_skipped << ",\n";
+    os << "  \"phases\": {\n";
+    phase("collect", collect_time);
+    os << ",\n";
+    phase("emit", emit_time);
+    os << "\n  }\n";
+    os << "}\n";
+  }
+
+  void HandleTranslationUnit(clang::ASTContext &C) override {
+    {
+      PhaseTimer timer(emit_time);
+      emitRecords(C);
+    }
+    if (!action->getConfig().stats_file_name.empty()) {
+      writeStats();
+    }
+  }
+
+  void emitRecords(clang::ASTContext &C) {
+    if (has_error || C.getDiagnostics().hasErrorOccurred()) {
+      SPDLOG_INFO(debug_logger,
+                  "HandleTranslationUnit() return: previous error");
+      return;
+    }
+    const Config &config = action->getConfig();
+    std::error_code ec;
+    llvm::raw_fd_ostream os(config.output_file_name, ec,
+                            llvm::sys::fs::F_Text);
+    if (ec) {
+      SPDLOG_ERROR(console_logger, "can not open {}: {}",
+                   config.output_file_name, ec.message());
+      return;
+    }
+    EmitOptions opts = config.emit_options;
+    if (!config.profile_file_name.empty()) {
+      opts.profile = &key_profile;
+    }
+    const clang::SourceManager &sm = C.getSourceManager();
+    os << "// generated by clang-json-gen, do not edit\n";
+    os << "#pragma once\n\n";
+    for (RecordInfo *ri : records_to_emit) {
+      ri->prepare();
+    }
+    // the records of this output come after the ones they nest, which are
+    // owned by other outputs: their handlers are declared here too, and
+    // defined here in header mode, the guards keep the copies apart when
+    // the headers are included together
+    std::vector<RecordInfo *> records;
+    if (manifest.enabled()) {
+      records = getNestedDependencies();
+    }
+    size_t first_owned = records.size();
+    records.insert(records.end(), records_to_emit.begin(),
+                   records_to_emit.end());
+    size_t n = records.size();
+    // the runtime headers of the features the records or the options use
+    bool has_interned = false;
+    bool has_inline_strings = false;
+    for (RecordInfo *ri : records) {
+      has_interned = has_interned || ri->hasInterned();
+      has_inline_strings = has_inline_strings || ri->hasInlineStrings();
+    }
+    os << "#include \""
+       << sm.getFileEntryForID(sm.getMainFileID())->getName() << "\"\n\n";
+    os << "#include \"JsonGenRuntime.hpp\"\n";
+    if (opts.files) {
+      os << "#include \"JsonGenFile.hpp\"\n";
+    }
+    if (has_interned) {
+      os << "#include \"JsonGenIntern.hpp\"\n";
+    }
+    if (has_inline_strings) {
+      os << "#include \"JsonGenInlineString.hpp\"\n";
+    }
+    if (opts.push) {
+      os << "#include \"JsonGenPush.hpp\"\n";
+    }
+    if (opts.table_driven) {
+      os << "#include \"JsonGenTable.hpp\"\n";
+    }
+    os << "#include \"rapidjson/reader.h\"\n";
+    os << "#ifdef JSONGEN_PROFILE\n";
+    os << "#include \"JsonGenProfile.hpp\"\n";
+    os << "#endif\n";
+    os << "#ifdef JSONGEN_METRICS\n";
+    os << "#include \"JsonGenMetrics.hpp\"\n";
+    os << "#endif\n";
+    if (opts.extern_templates) {
+      os << "#include \"rapidjson/stringbuffer.h\"\n";
+      os << "#include \"rapidjson/writer.h\"\n";
+    }
+    os << "\n";
+    os << "#include <cstddef>\n";
+    os << "#include <cstdint>\n";
+    os << "#include <cstring>\n\n";
+    std::vector<std::string> guards(n);
+    for (size_t i = 0; i != n; ++i) {
+      if (manifest.enabled()) {
+        guards[i] = getRecordGuard(records[i]->getDecl());
+      }
+      std::string decl;
+      llvm::raw_string_ostream ds(decl);
+      records[i]->emitForwardDecl(ds);
+      writeGuarded(os, guards[i], "_DECL", ds.str());
+    }
+    os << "\n";
+    // the records are emitted concurrently into buffers of their own, which
+    // are then written in the order of records
+    std::vector<std::string> code(n);
+    std::vector<std::string> definitions(n);
+    // not a vector<bool>, its elements are written by different threads
+    std::vector<char> emitted(n, 0);
+    auto emit = [&](size_t i) {
+      RecordInfo *ri = records[i];
+      llvm::raw_string_ostream cs(code[i]);
+      llvm::raw_string_ostream ds(definitions[i]);
+      // in split mode the owner's source has the definitions
+      bool with_definitions = i >= first_owned || opts.inline_definitions;
+      emitted[i] = ri->emitCode(cs, opts) &&
+                   (!with_definitions || ri->emitDefinitions(ds, opts));
+    };
+    if (config.jobs == 1 || n < 2) {
+      for (size_t i = 0; i != n; ++i) {
+        emit(i);
+      }
+    } else {
+      llvm::ThreadPool pool(config.jobs ? config.jobs
+                                        : llvm::hardware_concurrency());
+      for (size_t i = 0; i != n; ++i) {
+        pool.async(emit, i);
+      }
+      pool.wait();
+    }
+    for (size_t i = 0; i != n; ++i) {
+      if (!emitted[i]) {
+        SPDLOG_ERROR(console_logger, "failed to generate code for {}",
+                     records[i]->getDecl()->getQualifiedNameAsString());
+        return;
+      }
+      writeGuarded(os, guards[i], "", code[i]);
+    }
+    // in split mode the definitions are compiled once, in their own file
+    std::unique_ptr<llvm::raw_fd_ostream> source;
+    if (!opts.inline_definitions) {
+      source = llvm::make_unique<llvm::raw_fd_ostream>(
+          config.source_file_name, ec, llvm::sys::fs::F_Text);
+      if (ec) {
+        SPDLOG_ERROR(console_logger, "can not open {}: {}",
+                     config.source_file_name, ec.message());
+        return;
+      }
+      *source << "// generated by clang-json-gen, do not edit\n";
+      *source << "#include \""
+              << llvm::sys::path::filename(config.output_file_name)
+              << "\"\n\n";
+    }
+    llvm::raw_ostream &defs = source ? *source : os;
+    for (size_t i = 0; i != n; ++i) {
+      // the source is compiled once, it needs no guards
+      writeGuarded(defs, source ? "" : guards[i], "_DEFINITIONS",
+                   definitions[i]);
+    }
+    // only remember the records once their code is really on disk
+    std::vector<RecordManifest::Conflict> conflicts;
+    if (!manifest.save(conflicts)) {
+      SPDLOG_ERROR(console_logger, "can not write manifest {}",
+                   config.manifest_file_name);
+    }
+    reportConflicts(conflicts, opts);
+    if (!config.depfile_name.empty()) {
+      writeDepfile(C, records);
+    }
+    if (!config.report_file_name.empty()) {
+      writeReport(opts);
+    }
+  }
+
+  // What each emitted record costs, as JSON, for finding the records worth
+  // an \omit, an \omitBase or the table-driven mode: see
+  // RecordInfo::writeReport().
+  void writeReport(const EmitOptions &opts) {
+    const Config &config = action->getConfig();
+    std::error_code ec;
+    llvm::raw_fd_ostream os(config.report_file_name, ec,
+                            llvm::sys::fs::F_Text);
+    if (ec) {
+      SPDLOG_ERROR(console_logger, "can not open {}: {}",
+                   config.report_file_name, ec.message());
+      return;
+    }
+    os << "{\n";
+    os << "  \"records\": [";
+    const char *separator = "\n";
+    for (RecordInfo *ri : records_to_emit) {
+      os << separator;
+      ri->writeReport(os, opts);
+      separator = ",\n";
+    }
+    os << (records_to_emit.empty() ? "]\n" : "\n  ]\n");
+    os << "}\n";
+  }
+
+  // The headers that declare the emitted records, their bases and members,
+  // and what the types of the members are spelled with, as the make rule
+  // of the output: the build system reruns the plugin when one of them
+  // changes, not when any header the input includes does. System headers
+  // are left out.
+  void writeDepfile(clang::ASTContext &C,
+                    const std::vector<RecordInfo *> &records) {
+    const Config &config = action->getConfig();
+    llvm::SmallPtrSet<const clang::Decl *, 64> decls;
+    for (RecordInfo *ri : records) {
+      ri->addDependencies(decls);
+    }
+    const clang::SourceManager &sm = C.getSourceManager();
+    std::set<std::string> files;
+    files.insert(sm.getFileEntryForID(sm.getMainFileID())->getName().str());
+    for (const clang::Decl *d : decls) {
+      clang::SourceLocation loc = sm.getExpansionLoc(d->getLocation());
+      if (loc.isInvalid() || sm.isInSystemHeader(loc)) {
+        continue;
+      }
+      if (const clang::FileEntry *fe = sm.getFileEntryForID(sm.getFileID(loc))) {
+        files.insert(fe->getName().str());
+      }
+    }
+    if (!config.profile_file_name.empty()) {
+      files.insert(config.profile_file_name);
+    }
+    std::error_code ec;
+    llvm::raw_fd_ostream os(config.depfile_name, ec, llvm::sys::fs::F_Text);
+    if (ec) {
+      SPDLOG_ERROR(console_logger, "can not open {}: {}", config.depfile_name,
+                   ec.message());
+      return;
+    }
+    auto escape = [](llvm::StringRef path) {
+      std::string out;
+      for (char c : path) {
+        if (c == ' ' || c == '#') {
+          out += '\\';
+        } else if (c == '$') {
+          out += '$';
+        }
+        out += c;
+      }
+      return out;
+    };
+    os << escape(config.output_file_name) << ":";
+    for (const std::string &file : files) {
+      os << " \\\n  " << escape(file);
+    }
+    os << "\n";
+  }
 
-  void HandleTagDeclDefinition(clang::TagDecl *D) {
+  void HandleTagDeclDefinition(clang::TagDecl *D) override {
+    PhaseTimer timer(collect_time);
     SPDLOG_INFO(debug_logger, "HandleTagDeclDefinition({})",
                 D->getName().str());
     if (has_error) {
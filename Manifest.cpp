@@ -0,0 +1,160 @@
+#include "Manifest.hpp"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/LockFileManager.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <system_error>
+
+bool RecordManifest::read(llvm::StringRef file_name,
+                          llvm::StringMap<Entry> &records) {
+  auto buffer = llvm::MemoryBuffer::getFile(file_name);
+  if (!buffer) {
+    // no manifest yet, nothing has been generated
+    return buffer.getError() == std::errc::no_such_file_or_directory;
+  }
+  llvm::StringRef content = (*buffer)->getBuffer();
+  while (!content.empty()) {
+    llvm::StringRef line;
+    std::tie(line, content) = content.split('\n');
+    line = line.rtrim("\r");
+    if (line.trim().empty() || line.startswith("#")) {
+      continue;
+    }
+    llvm::SmallVector<llvm::StringRef, 4> fields;
+    line.split(fields, '\t', 3);
+    uint64_t fingerprint;
+    if (fields.size() != 4 || fields[2].empty() || fields[3].empty() ||
+        fields[1].getAsInteger(16, fingerprint)) {
+      return false;
+    }
+    Entry &e = records[fields[3]];
+    if (fields[0] == "own") {
+      e.owner = fields[2];
+      e.fingerprint = fingerprint;
+    } else if (fields[0] == "seen") {
+      e.seen[fields[2]] = fingerprint;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool RecordManifest::load(llvm::StringRef file_name, llvm::StringRef output) {
+  this->file_name = file_name;
+  this->output = output;
+  return read(file_name, records);
+}
+
+llvm::StringRef RecordManifest::getOwner(llvm::StringRef name) const {
+  auto it = records.find(name);
+  return it == records.end() ? llvm::StringRef() : it->second.owner;
+}
+
+RecordManifest::Status RecordManifest::check(llvm::StringRef name,
+                                             uint64_t fingerprint) {
+  Entry &e = records[name];
+  if (e.owner.empty() || e.owner == output) {
+    Status status = e.owner.empty() ? Status::New : Status::Owned;
+    e.owner = output;
+    e.fingerprint = fingerprint;
+    claimed.insert(name);
+    return status;
+  }
+  auto last = e.seen.find(output);
+  // what this output saw last time agreed with the owner: the definition
+  // changed since, and the owner hasn't run again yet
+  bool changed_since = last != e.seen.end() && last->second == e.fingerprint;
+  e.seen[output] = fingerprint;
+  skipped.insert(name);
+  if (e.fingerprint == fingerprint) {
+    return Status::Generated;
+  }
+  return changed_since ? Status::Stale : Status::Mismatch;
+}
+
+bool RecordManifest::save(std::vector<Conflict> &conflicts) {
+  if (!enabled()) {
+    return true;
+  }
+  for (;;) {
+    llvm::LockFileManager lock(file_name);
+    switch (lock) {
+    case llvm::LockFileManager::LFS_Error:
+      return false;
+    case llvm::LockFileManager::LFS_Shared:
+      // another output is saving, read what it wrote once it is done
+      if (lock.waitForUnlock() == llvm::LockFileManager::Res_Timeout) {
+        lock.unsafeRemoveLockFile();
+      }
+      continue;
+    case llvm::LockFileManager::LFS_Owned:
+      break;
+    }
+
+    // other outputs may have finished since we loaded the manifest, start
+    // from what they wrote and apply this run on top
+    llvm::StringMap<Entry> merged;
+    if (!read(file_name, merged)) {
+      return false;
+    }
+    for (auto &kv : merged) {
+      Entry &e = kv.getValue();
+      if (e.owner == output && !claimed.count(kv.getKey())) {
+        e.owner.clear();
+      }
+    }
+    for (const auto &kv : claimed) {
+      const Entry &ours = records[kv.getKey()];
+      Entry &e = merged[kv.getKey()];
+      if (!e.owner.empty() && e.owner != output) {
+        conflicts.push_back({kv.getKey().str(), e.owner,
+                             e.fingerprint == ours.fingerprint});
+        e.seen[output] = ours.fingerprint;
+        continue;
+      }
+      e.owner = output;
+      e.fingerprint = ours.fingerprint;
+    }
+    for (const auto &kv : skipped) {
+      merged[kv.getKey()].seen[output] = records[kv.getKey()].seen[output];
+    }
+
+    int fd;
+    llvm::SmallString<128> tmp_name;
+    if (llvm::sys::fs::createUniqueFile(file_name + "-%%%%%%", fd, tmp_name)) {
+      return false;
+    }
+    {
+      llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+      os << "# clang-json-gen record manifest\n";
+      for (const auto &kv : merged) {
+        const Entry &e = kv.getValue();
+        if (!e.owner.empty()) {
+          os << "own\t" << llvm::format_hex_no_prefix(e.fingerprint, 16)
+             << '\t' << e.owner << '\t' << kv.getKey() << '\n';
+        }
+        for (const auto &seen : e.seen) {
+          os << "seen\t" << llvm::format_hex_no_prefix(seen.getValue(), 16)
+             << '\t' << seen.getKey() << '\t' << kv.getKey() << '\n';
+        }
+      }
+      if (os.has_error()) {
+        os.clear_error();
+        llvm::sys::fs::remove(tmp_name);
+        return false;
+      }
+    }
+    if (llvm::sys::fs::rename(tmp_name, file_name)) {
+      llvm::sys::fs::remove(tmp_name);
+      return false;
+    }
+    records = std::move(merged);
+    return true;
+  }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* RecordManifest remembers which records have already been generated by
+ * previous plugin runs. When many translation units include the same header,
+ * only the output that first generated a record owns it, the others look up
+ * the record's fingerprint here and skip it. The owner keeps generating its
+ * records when it runs again.
+ *
+ * Each output also remembers the fingerprint it saw for the records it
+ * skipped. A record whose definition changed since the last run of this
+ * output, while its owner hasn't run again yet, is a header edit and is
+ * skipped too: the owner regenerates it. A fingerprint that differs from the
+ * owner's otherwise is an ODR violation.
+ *
+ * The on-disk format is a plain text file, one entry per line, the fields
+ * separated by tabs:
+ *   own <hex fingerprint> <output> <qualified record name>
+ *   seen <hex fingerprint> <output> <qualified record name>
+ * lines starting with '#' are comments.
+ */
+class RecordManifest {
+  struct Entry {
+    // empty if no output owns the record
+    std::string owner;
+    uint64_t fingerprint = 0;
+    // the fingerprint each other output saw when it skipped the record
+    llvm::StringMap<uint64_t> seen;
+  };
+  std::string file_name;
+  std::string output;
+  llvm::StringMap<Entry> records;
+  // the records this output owns, and the ones it skipped, in this run
+  llvm::StringSet<> claimed;
+  llvm::StringSet<> skipped;
+
+  static bool read(llvm::StringRef file_name,
+                   llvm::StringMap<Entry> &records);
+
+public:
+  enum class Status {
+    New,       // never generated before, this output owns it from now on
+    Owned,     // generated by this output before, generate it again
+    Generated, // generated by another output with the same fingerprint, skip
+    Stale,     // changed since this output's last run, before the owner's
+               // next run: skip it, the owner regenerates it
+    Mismatch,  // generated by another output with a different fingerprint,
+               // ODR violation
+  };
+  // a record that another output claimed while this one ran
+  struct Conflict {
+    std::string record;
+    std::string owner;
+    bool same_definition;
+  };
+
+  bool enabled() const { return !file_name.empty(); }
+  // the output that owns a record, empty if none
+  llvm::StringRef getOwner(llvm::StringRef name) const;
+
+  // load the manifest on behalf of output, a missing file is treated as an
+  // empty manifest
+  bool load(llvm::StringRef file_name, llvm::StringRef output);
+
+  // look up a record for this output, and claim it if nobody owns it
+  Status check(llvm::StringRef name, uint64_t fingerprint);
+
+  // Merge with whatever other outputs wrote in the meantime, and atomically
+  // replace the on-disk manifest, under a lock. The records this output
+  // owned before and didn't generate this time are released. The records
+  // that another output claimed in the meantime are left to it and added
+  // to conflicts.
+  bool save(std::vector<Conflict> &conflicts);
+};
@@ -0,0 +1,44 @@
+#include "Profile.hpp"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <tuple>
+
+bool KeyProfile::load(llvm::StringRef file_name) {
+  auto buffer = llvm::MemoryBuffer::getFile(file_name);
+  if (!buffer) {
+    return false;
+  }
+  llvm::StringRef content = (*buffer)->getBuffer();
+  while (!content.empty()) {
+    llvm::StringRef line;
+    std::tie(line, content) = content.split('\n');
+    line = line.trim();
+    if (line.empty() || line.startswith("#")) {
+      continue;
+    }
+    llvm::SmallVector<llvm::StringRef, 5> words;
+    line.split(words, ' ', -1, /*KeepEmpty=*/false);
+    uint64_t count;
+    if (words.size() == 4 && words[0] == "key") {
+      if (words[3].getAsInteger(10, count)) {
+        return false;
+      }
+      records[words[1]].hits[words[2]] += count;
+    } else if (words.size() == 5 && words[0] == "next") {
+      if (words[4].getAsInteger(10, count)) {
+        return false;
+      }
+      records[words[1]].next[words[2]][words[3]] += count;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+const KeyProfile::Record *KeyProfile::find(llvm::StringRef record) const {
+  auto it = records.find(record);
+  return it == records.end() ? nullptr : &it->second;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <cstdint>
+
+/* KeyProfile holds the key statistics of an instrumented build of the
+ * generated code (compiled with -DJSONGEN_PROFILE, see JsonGenProfile.hpp),
+ * given to the plugin as profile=. The generated Key() callbacks compare the
+ * most frequent keys first, and try the key that usually follows the last
+ * one before any other.
+ *
+ * The on-disk format is a plain text file, one counter per line:
+ *   key <qualified record name> <key> <count>
+ *   next <qualified record name> <previous key, ^ if none> <key> <count>
+ * lines starting with '#' are comments. Counters given twice add up.
+ */
+class KeyProfile {
+public:
+  struct Record {
+    llvm::StringMap<uint64_t> hits;
+    // the previous key, or ^ at the start of an object, to the key seen
+    // after it
+    llvm::StringMap<llvm::StringMap<uint64_t>> next;
+  };
+
+  // unlike a manifest, a missing profile is an error
+  bool load(llvm::StringRef file_name);
+
+  // nullptr if the record has never been seen by the instrumented build
+  const Record *find(llvm::StringRef record) const;
+
+private:
+  llvm::StringMap<Record> records;
+};
@@ -1,20 +1,45 @@
 #include "RecordInfo.hpp"
+#include "Profile.hpp"
 
+#include "clang/AST/ASTContext.h"
 #include "clang/AST/Decl.h"
 #include "clang/AST/DeclCXX.h"
 #include "clang/AST/Type.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
+#include <cassert>
 #include <string>
 
 namespace {
-const char *return_true = "return true\n";
-const char *return_false = "return false\n";
+const char *return_false = "return false;\n";
+
+// the failure path of the generated handlers, see FooHandler::fail()
+std::string returnError(const char *code) {
+  return std::string("return fail(jsongen::ParseError::") + code + ");\n";
+}
+
+std::string getInternTable(const Field &f) {
+  return f.directive.param.empty() ? "jsongen::InternTable::global()"
+                                   : f.directive.param;
+}
+
+// the jsongen::InlineOverflow of an \inlineString member
+const char *getInlineOverflow(const Field &f) {
+  if (f.directive.param == "truncate") {
+    return "jsongen::InlineOverflow::Truncate";
+  }
+  return f.directive.param == "spill" ? "jsongen::InlineOverflow::Spill"
+                                      : "jsongen::InlineOverflow::Reject";
+}
 
 std::string substituteDoubleDollar(const std::string & str, const std::string & substr) {
   std::string ret;
   size_t lp = 0;
-  for (size_t i = 0, s = str.size() - 1; i < s; ++i) {
+  for (size_t i = 0; i + 1 < str.size(); ++i) {
     if (str[i] == '$') {
       if (str[i + 1] == '$') {
         ret += str.substr(lp, i - lp) + substr;
@@ -24,7 +49,7 @@ std::string substituteDoubleDollar(const std::string & str, const std::string &
     }
   }
   ret += str.substr(lp, str.size() - lp);
-  return str;
+  return ret;
 }
 /*
 
@@ -93,70 +118,180 @@ void generateDouble(llvm::raw_ostream &os, clang::QualType qt,
 */
 } // namespace
 
+namespace {
+// the array member f, fixed-size or a std::vector, nullptr if it isn't one
+const TypeClass *getArrayClass(const Field &f) {
+  const TypeClass *tc = f.type_class;
+  return tc && (tc->shape == TypeClass::ConstantArray ||
+                tc->shape == TypeClass::Vector)
+             ? tc
+             : nullptr;
+}
+
+// the state of a fixed-size array member once its '[' has been seen
+std::string getItemsState(llvm::StringRef state_name) {
+  return (state_name + "_items").str();
+}
+} // namespace
+
+// check that value fits into tc and convert it into target; false if tc
+// doesn't accept this kind of value at all
+bool RecordInfo::emitScalarStore(llvm::raw_ostream &os,
+                                 const CodegenContext &cc,
+                                 const TypeClass *tc, llvm::StringRef target,
+                                 TypeClass::ValueKind kind,
+                                 const char *value) {
+  if (!tc || !tc->accepts(kind)) {
+    return false;
+  }
+  if (tc->narrows(kind)) {
+    os << cc.indent << "if (!jsongen::fits<" << tc->range_type << ">("
+       << value << ")) {\n";
+    os << cc.indent << "  " << returnError("OutOfRange");
+    os << cc.indent << "}\n";
+  }
+  os << cc.indent << target << " = ";
+  if (kind == TypeClass::VK_Bool || kind == TypeClass::VK_Double) {
+    os << value << ";\n";
+  } else {
+    os << "static_cast<" << tc->spelling << ">(" << value << ");\n";
+  }
+  return true;
+}
+
+// the next element of a fixed-size array, one past the end is rejected
+void RecordInfo::emitIndexCheck(llvm::raw_ostream &os,
+                                const CodegenContext &cc,
+                                const TypeClass *array) {
+  os << cc.indent << "if (index == " << array->array_size << ") {\n";
+  os << cc.indent << "  " << returnError("ArrayLength");
+  os << cc.indent << "}\n";
+}
+
+// a value from one of the scalar SAX callbacks, either for the member itself
+// or for the next element of a fixed-size array member
+void RecordInfo::emitScalarCase(llvm::raw_ostream &os,
+                                const CodegenContext &cc,
+                                const VisitContext &vc, const Field &f,
+                                TypeClass::ValueKind kind, const char *value) {
+  os << cc.indent << "case " << vc.state_name << ":\n";
+  if (emitScalarStore(os, cc, f.type_class, vc.self, kind, value)) {
+    emitFieldCheck(os, cc, vc, f);
+    emitValueEnd(os, cc);
+  } else {
+    os << cc.indent << returnError("TypeMismatch");
+  }
+  const TypeClass *array = getArrayClass(f);
+  if (!array || !array->element->accepts(kind)) {
+    return;
+  }
+  os << cc.indent << "case " << getItemsState(vc.state_name) << ":\n";
+  if (array->shape == TypeClass::Vector) {
+    // the value is checked before the element is added
+    emitScalarStore(os, cc, array->element,
+                    (vc.self + ".emplace_back()").str(), kind, value);
+  } else {
+    emitIndexCheck(os, cc, array);
+    emitScalarStore(os, cc, array->element, (vc.self + "[index++]").str(),
+                    kind, value);
+  }
+  os << cc.indent << "return true;\n";
+}
+
 /* INFO: name-mangling:
  * add VB to virtual base class name
  * add B to base class name
  * add M to data member name
  * append a '_' to each level of name
  */
-template <bool VisitBase, bool VisitVBase, bool VisitField, typename CB>
-bool RecordInfo::Visit(const CodegenContext &cc, CB &cb) {
-  auto visit_base = [&](const char *str, std::vector<SubClass> &bs) -> bool {
+void RecordInfo::flatten(llvm::StringRef self, llvm::StringRef prefix,
+                         Origin origin, llvm::StringSaver &saver,
+                         std::vector<FlatField> &out) {
+  const clang::PrintingPolicy &policy =
+      type->getASTContext().getPrintingPolicy();
+  auto flatten_base = [&](const char *str, std::vector<SubClass> &bs,
+                          Origin base_origin) {
     for (SubClass &b : bs) {
+      // the report names the omitted bases too
+      b.info->copyNames();
       if (b.omit) {
         continue;
       }
-      const clang::RecordType *type =
-          llvm::dyn_cast<clang::RecordType>(b.base->getType());
-      const clang::CXXRecordDecl *decl =
-          llvm::dyn_cast<clang::CXXRecordDecl>(type->getDecl());
-      std::string vbase_name = decl->getName().str();
-      std::string self = "static_cast<" + vbase_name + ">(" + cc.self + ")";
-      std::string prefix = cc.prefix + str + vbase_name + "_";
-      CodegenContext cc1;
-      cc1.indent = cc.indent;
-      cc1.self = self;
-      cc1.start_state = cc.start_state;
-      ;
-      cc1.expact_key_state = cc.expact_key_state;
-      cc1.prefix = prefix;
-      RecordInfo *ri = getRecordInfoFromDecl(decl);
-      if (!ri->Visit(cc1, cb)) {
-        return false;
-      }
+      // every field of the base shares these two strings, the base may be
+      // declared in another namespace or class
+      llvm::StringRef base_self = saver.save(
+          "static_cast<" + b.info->qualified_name + " &>(" + self + ")");
+      llvm::StringRef base_prefix =
+          saver.save(prefix + str + b.info->plain_name + "_");
+      // fields of indirect bases belong to the direct base they come from
+      b.info->flatten(base_self, base_prefix,
+                  origin == Origin::Field ? base_origin : origin, saver, out);
     }
-    return true;
   };
-  if (VisitVBase) {
-    // visit all virtual base
-    if (!visit_base("VB", vbases)) {
-      return false;
+  flatten_base("VB", vbases, Origin::VBase);
+  flatten_base("B", bases, Origin::Base);
+  for (Field &f : fields) {
+    if (f.directive.is_omit) {
+      continue;
     }
-  }
-  if (VisitBase) {
-    // visit all bases
-    if (!visit_base("B", bases)) {
-      return false;
+    if (f.field->isUnnamedBitfield()) {
+      // TODO:
+      abort();
+    }
+    f.name = f.field->getName();
+    f.qualified_name = f.field->getQualifiedNameAsString();
+    clang::QualType qt = f.field->getType();
+    clang::QualType canonical = qt.getCanonicalType();
+    if (!qt->isArrayType() && !qt.isConstQualified()) {
+      f.setter_type = canonical.getAsString(policy);
     }
+    if (canonical->isIntegerType()) {
+      f.interned = Field::Interned::Id;
+      f.id_type = canonical.getUnqualifiedType().getAsString();
+    } else if (canonical->isPointerType()) {
+      f.interned = Field::Interned::Pointer;
+    }
+    const clang::CXXRecordDecl *nested = getChildRecord(f);
+    if (!nested && getArrayClass(f)) {
+      nested = getArrayClass(f)->getNestedRecord();
+    }
+    if (nested) {
+      f.nested_name = nested->getQualifiedNameAsString();
+      f.nested_handler = getHandlerName(nested);
+    }
+    llvm::StringRef field_name = f.name;
+    FlatField ff;
+    ff.vc.state_name = saver.save(prefix + "M" + field_name);
+    ff.vc.parent = self;
+    ff.vc.self = saver.save(self + "." + field_name);
+    ff.field = &f;
+    ff.origin = origin;
+    out.push_back(ff);
   }
-  if (VisitField) {
-    // visit all direct field
-    for (Field &f : fields) {
-      if (f.directive.is_omit) {
-        continue;
-      }
-      if (f.field->isUnnamedBitfield()) {
-        // TODO:
-        abort();
-      }
-      VisitContext vc;
-      std::string field_name = f.field->getName().str();
-      vc.state_name = cc.prefix + "M" + field_name;
-      vc.parent = cc.self;
-      vc.self = cc.self + "." + field_name;
-      if (!cb(vc, f)) {
-        return false;
-      }
+}
+
+// The access paths and state names only depend on the root CodegenContext,
+// which is the same for every generate*Body, so they are computed once and
+// every later Visit only walks the table.
+template <bool VisitBase, bool VisitVBase, bool VisitField, typename CB>
+bool RecordInfo::Visit(const CodegenContext &cc, CB &cb) {
+  if (!flattened) {
+    flat_root_self = cc.self;
+    flat_root_prefix = cc.prefix;
+    flatten(flat_root_self, flat_root_prefix, Origin::Field, names,
+            flat_fields);
+    flattened = true;
+  }
+  assert(cc.self == flat_root_self && cc.prefix == flat_root_prefix &&
+         "the flattened table is only valid for one root context");
+  for (const FlatField &ff : flat_fields) {
+    if ((ff.origin == Origin::VBase && !VisitVBase) ||
+        (ff.origin == Origin::Base && !VisitBase) ||
+        (ff.origin == Origin::Field && !VisitField)) {
+      continue;
+    }
+    if (!cb(ff.vc, *ff.field)) {
+      return false;
     }
   }
   return true;
@@ -164,28 +299,76 @@ bool RecordInfo::Visit(const CodegenContext &cc, CB &cb) {
 
 bool RecordInfo::generateEnumBody(llvm::raw_ostream &os,
                                   const CodegenContext &cc) {
-  auto cb = [&](const VisitContext &vc, const Field &) {
-    os << cc.indent << vc.state_name << '\n';
+  auto cb = [&](const VisitContext &vc, const Field &f) {
+    os << cc.indent << vc.state_name << ",\n";
+    if (getArrayClass(f)) {
+      os << cc.indent << getItemsState(vc.state_name) << ",\n";
+    }
+    return true;
+  };
+  return Visit(cc, cb);
+}
+
+// the names of the states, in generateEnumBody() order
+bool RecordInfo::generateStateNameBody(llvm::raw_ostream &os,
+                                       const CodegenContext &cc) {
+  auto cb = [&](const VisitContext &vc, const Field &f) {
+    os << cc.indent << "\"" << vc.state_name << "\",\n";
+    if (getArrayClass(f)) {
+      os << cc.indent << "\"" << getItemsState(vc.state_name) << "\",\n";
+    }
     return true;
   };
   return Visit(cc, cb);
 }
 
+unsigned RecordInfo::getStateCount() {
+  unsigned states = 3;
+  auto cb = [&](const VisitContext &, const Field &f) -> bool {
+    states += getArrayClass(f) ? 2 : 1;
+    return true;
+  };
+  Visit(getRootContext(), cb);
+  return states;
+}
+
 bool RecordInfo::generateNullBody(llvm::raw_ostream &os,
                                   const CodegenContext &cc) {
   auto cb = [&](const VisitContext &vc, const Field &f) -> bool {
     os << cc.indent << "case " << vc.state_name << ":\n";
-    const clang::Type *type = f.field->getType().getTypePtr();
-    if (type->isIntegerType() || type->isFloatingType()) {
-      os << cc.indent << vc.self << " = 0;\n";
-      emitFieldCheck(os, cc, vc, f);
-      os << cc.indent << return_true;
-    } else if (type->isPointerType()) {
+    const TypeClass *tc = f.type_class;
+    // the strings and arrays described by directives are pointers
+    bool is_pointer = tc ? tc->shape == TypeClass::Pointer
+                         : f.directive.is_c_string ||
+                               f.directive.is_string_pointer ||
+                               f.directive.is_null_terminated_array ||
+                               f.directive.is_array_pointer;
+    bool accepted = !tc || tc->accepts(TypeClass::VK_Null);
+    if (is_pointer && accepted) {
       os << cc.indent << vc.self << " = nullptr;\n";
-      emitFieldCheck(os, cc, vc, f);
-      os << cc.indent << return_true;
+    } else if ((tc || f.directive.is_interned) && accepted) {
+      // an \intern member becomes id 0, nullptr or an empty view
+      os << cc.indent << vc.self << " = {};\n";
+    } else if (f.directive.is_inline_string) {
+      os << cc.indent << "jsongen::clearInline(" << vc.self << ");\n";
     } else {
-      os << cc.indent << return_false;
+      accepted = false;
+      os << cc.indent << returnError("TypeMismatch");
+    }
+    if (accepted) {
+      emitFieldCheck(os, cc, vc, f);
+      emitValueEnd(os, cc);
+    }
+    const TypeClass *array = getArrayClass(f);
+    if (array && array->element->accepts(TypeClass::VK_Null)) {
+      os << cc.indent << "case " << getItemsState(vc.state_name) << ":\n";
+      if (array->shape == TypeClass::Vector) {
+        os << cc.indent << vc.self << ".emplace_back();\n";
+      } else {
+        emitIndexCheck(os, cc, array);
+        os << cc.indent << vc.self << "[index++] = {};\n";
+      }
+      os << cc.indent << "return true;\n";
     }
     return true;
   };
@@ -195,34 +378,16 @@ bool RecordInfo::generateNullBody(llvm::raw_ostream &os,
 bool RecordInfo::generateBoolBody(llvm::raw_ostream &os,
                                   const CodegenContext &cc) {
   auto cb = [&](const VisitContext &vc, const Field &f) -> bool {
-    os << cc.indent << "case " << vc.state_name << ":\n";
-    const clang::Type *type = f.field->getType().getTypePtr();
-    if (type->isBooleanType()) {
-      os << cc.indent << vc.self << " = b;\n";
-      emitFieldCheck(os, cc, vc, f);
-      os << cc.indent << return_true;
-    } else {
-      os << cc.indent << return_false;
-    }
+    emitScalarCase(os, cc, vc, f, TypeClass::VK_Bool, "b");
     return true;
   };
   return Visit(cc, cb);
 }
 
-// TODO: handle enum as integer
-
 bool RecordInfo::generateIntBody(llvm::raw_ostream &os,
                                  const CodegenContext &cc) {
   auto cb = [&](const VisitContext &vc, const Field &f) -> bool {
-    os << cc.indent << "case " << vc.state_name << ":\n";
-    const clang::Type *type = f.field->getType().getTypePtr();
-    if (type->isIntegerType()) {
-      os << cc.indent << vc.self << " = i;\n";
-      emitFieldCheck(os, cc, vc, f);
-      os << cc.indent << return_true;
-    } else {
-      os << cc.indent << return_false;
-    }
+    emitScalarCase(os, cc, vc, f, TypeClass::VK_Int, "i");
     return true;
   };
   return Visit(cc, cb);
@@ -231,33 +396,16 @@ bool RecordInfo::generateIntBody(llvm::raw_ostream &os,
 bool RecordInfo::generateUintBody(llvm::raw_ostream &os,
                                   const CodegenContext &cc) {
   auto cb = [&](const VisitContext &vc, const Field &f) -> bool {
-    os << cc.indent << "case " << vc.state_name << ":\n";
-    const clang::Type *type = f.field->getType().getTypePtr();
-    if (type->isUnsignedIntegerOrEnumerationType()) {
-      os << cc.indent << vc.self << " = u;\n";
-      emitFieldCheck(os, cc, vc, f);
-      os << cc.indent << return_true;
-    } else {
-      os << cc.indent << return_false;
-    }
+    emitScalarCase(os, cc, vc, f, TypeClass::VK_Uint, "u");
     return true;
   };
   return Visit(cc, cb);
 }
 
-// TODO: handle integer more finely
 bool RecordInfo::generateInt64Body(llvm::raw_ostream &os,
                                    const CodegenContext &cc) {
   auto cb = [&](const VisitContext &vc, const Field &f) -> bool {
-    os << cc.indent << "case " << vc.state_name << ":\n";
-    const clang::Type *type = f.field->getType().getTypePtr();
-    if (type->isIntegerType()) {
-      os << cc.indent << vc.self << " = i;\n";
-      emitFieldCheck(os, cc, vc, f);
-      os << cc.indent << return_true;
-    } else {
-      os << cc.indent << return_false;
-    }
+    emitScalarCase(os, cc, vc, f, TypeClass::VK_Int64, "i");
     return true;
   };
   return Visit(cc, cb);
@@ -266,63 +414,87 @@ bool RecordInfo::generateInt64Body(llvm::raw_ostream &os,
 bool RecordInfo::generateUint64Body(llvm::raw_ostream &os,
                                     const CodegenContext &cc) {
   auto cb = [&](const VisitContext &vc, const Field &f) -> bool {
-    os << cc.indent << "case " << vc.state_name << ":\n";
-    const clang::Type *type = f.field->getType().getTypePtr();
-    if (type->isUnsignedIntegerOrEnumerationType()) {
-      os << cc.indent << vc.self << " = u;\n";
-      emitFieldCheck(os, cc, vc, f);
-      os << cc.indent << return_true;
-    } else {
-      os << cc.indent << return_false;
-    }
+    emitScalarCase(os, cc, vc, f, TypeClass::VK_Uint64, "u");
     return true;
   };
   return Visit(cc, cb);
 }
 
-// TODO: handle floating-point type more finely
 bool RecordInfo::generateDoubleBody(llvm::raw_ostream &os,
                                     const CodegenContext &cc) {
   auto cb = [&](const VisitContext &vc, const Field &f) -> bool {
-    os << cc.indent << "case " << vc.state_name << ":\n";
-    const clang::Type *type = f.field->getType().getTypePtr();
-    if (type->isFloatingType()) {
-      os << cc.indent << vc.self << " = u;\n";
-      emitFieldCheck(os, cc, vc, f);
-      os << cc.indent << return_true;
-    } else {
-      os << cc.indent << return_false;
-    }
+    emitScalarCase(os, cc, vc, f, TypeClass::VK_Double, "d");
     return true;
   };
   return Visit(cc, cb);
 }
 
-// TODO: handle char array
 // TODO: char8/char16/char32
 // note: only support in-site parse, that copy is guaranteed to be false
 // note: only support utf-8
 bool RecordInfo::generateStringBody(llvm::raw_ostream & os,
                                     const CodegenContext & cc) {
   auto cb = [&](const VisitContext &vc, const Field &f) -> bool {
-    os << cc.indent << "case " << vc.state_name << ":\n";
+    os << cc.indent << "case " << vc.state_name
+       << (f.directive.is_interned ? ": {\n" : ":\n");
+    if (cc.validate_utf8 && (f.directive.is_c_string ||
+                             f.directive.is_string_pointer ||
+                             f.directive.is_user_defined_string ||
+                             f.directive.is_interned ||
+                             f.directive.is_inline_string)) {
+      os << cc.indent << "if (!jsongen::validUtf8(str, length)) {\n";
+      os << cc.indent << "  " << returnError("InvalidUtf8");
+      os << cc.indent << "}\n";
+    }
     if (f.directive.is_c_string) {
       // note: self is a non-owning pointer
       // note: str's content may contains NULL, that is strlen(str) <= length
       os << cc.indent << vc.self << " = str;\n";
       emitFieldCheck(os, cc, vc, f);
-      os << cc.indent << return_true;
+      emitValueEnd(os, cc);
     } else if (f.directive.is_string_pointer) {
       os << cc.indent  << vc.self << " = str;\n";
       os << cc.indent << vc.parent << '.' << f.directive.param << " = length;\n";
       emitFieldCheck(os, cc, vc, f);
-      os << cc.indent << return_true;
+      emitValueEnd(os, cc);
     } else if (f.directive.is_user_defined_string) {
-      os << cc.indent << substituteDoubleDollar(f.directive.param, vc.self) << '\n';
+      os << cc.indent << substituteDoubleDollar(f.directive.param, vc.self.str()) << '\n';
       emitFieldCheck(os, cc, vc, f);
-      os << cc.indent << return_true;
+      emitValueEnd(os, cc);
+    } else if (f.directive.is_interned) {
+      os << cc.indent << "jsongen::InternedString interned =\n";
+      os << cc.indent << "    " << getInternTable(f)
+         << ".intern(str, length);\n";
+      switch (f.interned) {
+      case Field::Interned::Id:
+        os << cc.indent << "if (!jsongen::fits<" << f.id_type
+           << ">(interned.id)) {\n";
+        os << cc.indent << "  " << returnError("OutOfRange");
+        os << cc.indent << "}\n";
+        os << cc.indent << vc.self << " = static_cast<" << f.id_type
+           << ">(interned.id);\n";
+        break;
+      case Field::Interned::Pointer:
+        os << cc.indent << vc.self << " = interned.data;\n";
+        break;
+      case Field::Interned::View:
+        os << cc.indent << vc.self << " = {interned.data, interned.size};\n";
+        break;
+      }
+      emitFieldCheck(os, cc, vc, f);
+      emitValueEnd(os, cc);
+      os << cc.indent << "}\n";
+    } else if (f.directive.is_inline_string) {
+      os << cc.indent << "if (!jsongen::assignInline(" << vc.self
+         << ", str, length,\n";
+      os << cc.indent << "                           " << getInlineOverflow(f)
+         << ")) {\n";
+      os << cc.indent << "  " << returnError("StringTooLong");
+      os << cc.indent << "}\n";
+      emitFieldCheck(os, cc, vc, f);
+      emitValueEnd(os, cc);
     } else {
-      os << cc.indent << return_false;
+      os << cc.indent << returnError("TypeMismatch");
     }
     return true;
   };
@@ -332,17 +504,174 @@ bool RecordInfo::generateStringBody(llvm::raw_ostream & os,
   return true;
 }
 
-bool RecordInfo::generateKeyBody(llvm::raw_ostream &, const CodegenContext &) {
-  return true;
+// Without a profile the keys are compared in declaration order. With one,
+// the most frequent keys come first, and a key that follows another one more
+// often than all other keys together is tried before any other.
+RecordInfo::KeyPlan RecordInfo::getKeyPlan(const EmitOptions &opts) {
+  std::vector<llvm::StringRef> keys;
+  auto cb = [&](const VisitContext &, const Field &f) -> bool {
+    keys.push_back(f.name);
+    return true;
+  };
+  Visit(getRootContext(), cb);
+  KeyPlan plan;
+  for (unsigned n = 0; n != keys.size(); ++n) {
+    plan.order.push_back(n);
+  }
+  plan.predicted.assign(keys.size() + 1, -1);
+  const KeyProfile::Record *profile =
+      opts.profile ? opts.profile->find(qualified_name) : nullptr;
+  if (!profile) {
+    return plan;
+  }
+  auto hits = [&](unsigned n) -> uint64_t {
+    auto it = profile->hits.find(keys[n]);
+    return it == profile->hits.end() ? 0 : it->second;
+  };
+  // members of the same name count the same, and stay in Visit() order
+  std::stable_sort(plan.order.begin(), plan.order.end(),
+                   [&](unsigned a, unsigned b) { return hits(a) > hits(b); });
+  for (unsigned from = 0; from <= keys.size(); ++from) {
+    auto it = profile->next.find(from == keys.size() ? "^" : keys[from]);
+    if (it == profile->next.end()) {
+      continue;
+    }
+    uint64_t total = 0;
+    uint64_t best = 0;
+    llvm::StringRef best_key;
+    for (const auto &kv : it->second) {
+      total += kv.getValue();
+      if (kv.getValue() > best ||
+          (kv.getValue() == best && kv.getKey() < best_key)) {
+        best = kv.getValue();
+        best_key = kv.getKey();
+      }
+    }
+    if (best * 2 <= total) {
+      continue;
+    }
+    // Key() finds the first member of that name
+    auto pos = std::find(keys.begin(), keys.end(), best_key);
+    if (pos != keys.end()) {
+      plan.predicted[from] = pos - keys.begin();
+      plan.speculate = true;
+    }
+  }
+  return plan;
 }
 
-bool RecordInfo::generateStartArrayBody(llvm::raw_ostream &,
-                                        const CodegenContext &) {
+// TODO: a linear scan of memcmp is fine for small records only
+bool RecordInfo::generateKeyBody(llvm::raw_ostream &os,
+                                 const CodegenContext &cc,
+                                 const KeyPlan &plan) {
+  std::vector<std::pair<VisitContext, const Field *>> members;
+  auto cb = [&](const VisitContext &vc, const Field &f) -> bool {
+    members.emplace_back(vc, &f);
+    return true;
+  };
+  if (!Visit(cc, cb)) {
+    return false;
+  }
+  auto match = [&](const std::string &indent, unsigned n) {
+    const VisitContext &vc = members[n].first;
+    const std::string &key = members[n].second->name;
+    os << indent << "if (length == " << key.size() << " && std::memcmp(str, \""
+       << key << "\", " << key.size() << ") == 0) {\n";
+    os << "#ifdef JSONGEN_PROFILE\n";
+    os << indent << "  profileKey(" << n << ");\n";
+    os << "#endif\n";
+    if (plan.speculate) {
+      os << indent << "  last_key = " << n << ";\n";
+    }
+    os << indent << "  state = " << vc.state_name << ";\n";
+    os << indent << "  return true;\n";
+    os << indent << "}\n";
+  };
+  if (plan.speculate) {
+    os << cc.indent << "switch (last_key) {\n";
+    for (unsigned from = 0; from != plan.predicted.size(); ++from) {
+      if (plan.predicted[from] < 0) {
+        continue;
+      }
+      os << cc.indent << "case " << from << ":\n";
+      match(cc.indent + "  ", plan.predicted[from]);
+      os << cc.indent << "  break;\n";
+    }
+    os << cc.indent << "default:\n";
+    os << cc.indent << "  break;\n";
+    os << cc.indent << "}\n";
+  }
+  for (unsigned n : plan.order) {
+    match(cc.indent, n);
+  }
   return true;
 }
-bool RecordInfo::generateEndArrayBody(llvm::raw_ostream &,
-                                      const CodegenContext &) {
-  return true;
+
+// fixed-size array members are filled in place, index is the next element;
+// numeric arrays are read straight from the input when it is available;
+// std::vector members are emptied, and grow by one element per object or
+// scalar
+bool RecordInfo::generateStartArrayBody(llvm::raw_ostream &os,
+                                        const CodegenContext &cc) {
+  auto cb = [&](const VisitContext &vc, const Field &f) -> bool {
+    const TypeClass *array = getArrayClass(f);
+    if (!array) {
+      return true;
+    }
+    os << cc.indent << "case " << vc.state_name << ":\n";
+    if (array->shape == TypeClass::Vector) {
+      os << cc.indent << vc.self << ".clear();\n";
+    } else {
+      os << cc.indent << "index = 0;\n";
+    }
+    os << cc.indent << "state = " << getItemsState(vc.state_name) << ";\n";
+    if (!array->element->bulk_numeric) {
+      os << cc.indent << "return true;\n";
+      return true;
+    }
+    // read the elements in one go from the '[' the reader hasn't taken yet,
+    // the ones that can't be are left to the reader, as well as the ']'
+    if (array->shape == TypeClass::Vector) {
+      os << cc.indent << "return !stream || jsongen::scanNumbers(stream->src_, "
+         << vc.self << ");\n";
+      return true;
+    }
+    os << cc.indent << "return !stream ||\n";
+    os << cc.indent << "       jsongen::scanNumbers(stream->src_, " << vc.self
+       << ", index, " << array->array_size << ") ||\n";
+    os << cc.indent << "       fail(jsongen::ParseError::ArrayLength);\n";
+    return true;
+  };
+  return Visit(cc, cb);
+}
+
+// a short fixed-size array is zero-filled with \shortArray zero, and
+// rejected otherwise
+bool RecordInfo::generateEndArrayBody(llvm::raw_ostream &os,
+                                      const CodegenContext &cc) {
+  auto cb = [&](const VisitContext &vc, const Field &f) -> bool {
+    const TypeClass *array = getArrayClass(f);
+    if (!array) {
+      return true;
+    }
+    os << cc.indent << "case " << getItemsState(vc.state_name) << ":\n";
+    // a std::vector takes any number of elements
+    bool fixed_size = array->shape == TypeClass::ConstantArray;
+    if (fixed_size && f.directive.is_zero_fill_array) {
+      os << cc.indent << "for (; index != " << array->array_size
+         << "; ++index) {\n";
+      os << cc.indent << "  " << vc.self << "[index] = {};\n";
+      os << cc.indent << "}\n";
+    } else if (fixed_size) {
+      os << cc.indent << "if (index != " << array->array_size << ") {\n";
+      os << cc.indent << "  " << returnError("ArrayLength");
+      os << cc.indent << "}\n";
+    }
+    emitFieldCheck(os, cc, vc, f);
+    emitValueEnd(os, cc);
+    return true;
+  };
+  return Visit(cc, cb);
 }
 
 // TODO: handle raw number
@@ -351,5 +680,1600 @@ bool RecordInfo::generateRawNumberBody(llvm::raw_ostream &,
   return false;
 }
 
-void RecordInfo::emitCode(llvm::raw_ostream &) { return; }
+bool RecordInfo::generateCheckBody(llvm::raw_ostream &os,
+                                   const CodegenContext &cc) {
+  auto cb = [&](const VisitContext &vc, const Field &f) -> bool {
+    if (f.directive.is_required) {
+      os << cc.indent << "bool " << vc.state_name << "_check = false;\n";
+    }
+    return true;
+  };
+  return Visit(cc, cb);
+}
+
+bool RecordInfo::generateValidBody(llvm::raw_ostream &os,
+                                   const CodegenContext &cc) {
+  auto cb = [&](const VisitContext &vc, const Field &f) -> bool {
+    if (f.directive.is_required) {
+      os << cc.indent << "if (!" << vc.state_name << "_check) {\n";
+      os << cc.indent << "  return fail(jsongen::ParseError::MissingMember, "
+         << vc.state_name << ");\n";
+      os << cc.indent << "}\n";
+    }
+    return true;
+  };
+  return Visit(cc, cb);
+}
+
+// the Writer call that writes value of type tc, false if there is none
+bool RecordInfo::emitWriteCall(llvm::raw_ostream &os, const TypeClass *tc,
+                               llvm::StringRef value) {
+  if (tc->shape == TypeClass::Pointer && tc->record) {
+    os << "(" << value << " ? write(*" << value
+       << ", writer, depth + 1) : writer.Null())";
+  } else if (tc->shape == TypeClass::Record) {
+    os << "write(" << value << ", writer, depth + 1)";
+  } else if (tc->write_kind == TypeClass::VK_Bool) {
+    os << "writer.Bool(" << value << ")";
+  } else if (tc->write_kind == TypeClass::VK_Int) {
+    os << "writer.Int(static_cast<int>(" << value << "))";
+  } else if (tc->write_kind == TypeClass::VK_Uint) {
+    os << "writer.Uint(static_cast<unsigned>(" << value << "))";
+  } else if (tc->write_kind == TypeClass::VK_Int64) {
+    os << "writer.Int64(static_cast<int64_t>(" << value << "))";
+  } else if (tc->write_kind == TypeClass::VK_Uint64) {
+    os << "writer.Uint64(static_cast<uint64_t>(" << value << "))";
+  } else if (tc->write_kind == TypeClass::VK_Double) {
+    os << "writer.Double(" << value << ")";
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool RecordInfo::isWritten(const Field &f) {
+  const FieldDirective &d = f.directive;
+  if (d.is_c_string || d.is_string_pointer || d.is_interned ||
+      d.is_inline_string) {
+    return true;
+  }
+  const TypeClass *tc = f.type_class;
+  if (d.hasLayout() || !tc) {
+    return false;
+  }
+  if (const TypeClass *array = getArrayClass(f)) {
+    return emitWriteCall(llvm::nulls(), array->element, "element");
+  }
+  // records stored by value are only parsed as array elements
+  return tc->shape != TypeClass::Record &&
+         emitWriteCall(llvm::nulls(), tc, "value");
+}
+
+bool RecordInfo::generateWriteBody(llvm::raw_ostream &os,
+                                   const CodegenContext &cc,
+                                   const char *dirty) {
+  // with dirty, the n-th member is written only if bit n of dirty is set
+  std::string indent = dirty ? cc.indent + "  " : cc.indent;
+  unsigned bit = 0;
+  auto cb = [&](const VisitContext &vc, const Field &f) -> bool {
+    unsigned n = bit++;
+    std::string value;
+    llvm::raw_string_ostream vs(value);
+    const TypeClass *tc = f.type_class;
+    const TypeClass *array = getArrayClass(f);
+    if (f.directive.is_c_string) {
+      vs << "(" << vc.self << " ? writer.String(" << vc.self
+         << ") : writer.Null())";
+    } else if (f.directive.is_string_pointer) {
+      vs << "writer.String(" << vc.self << ", " << vc.parent << '.'
+         << f.directive.param << ")";
+    } else if (f.directive.is_interned) {
+      switch (f.interned) {
+      case Field::Interned::Id:
+        vs << "jsongen::writeInterned(writer, " << getInternTable(f) << ", "
+           << vc.self << ")";
+        break;
+      case Field::Interned::Pointer:
+        vs << "(" << vc.self << " ? writer.String(" << vc.self
+           << ") : writer.Null())";
+        break;
+      case Field::Interned::View:
+        vs << "writer.String(" << vc.self
+           << ".data(), static_cast<rapidjson::SizeType>(" << vc.self
+           << ".size()))";
+        break;
+      }
+    } else if (f.directive.is_inline_string) {
+      vs << "jsongen::writeInline(writer, " << vc.self << ")";
+    } else if (!isWritten(f)) {
+      // reported when the record was collected
+      return true;
+    } else if (array) {
+      emitWriteCall(vs, array->element, "element");
+    } else {
+      emitWriteCall(vs, tc, vc.self);
+    }
+    if (dirty) {
+      os << cc.indent << "if (" << dirty << "[" << n / 64
+         << "] & (uint64_t(1) << " << n % 64 << ")) {\n";
+    }
+    const std::string &key = f.name;
+    os << indent << "writer.Key(\"" << key << "\", " << key.size() << ");\n";
+    if (!array) {
+      os << indent << "if (!" << vs.str() << ") {\n";
+      os << indent << "  " << return_false;
+      os << indent << "}\n";
+    } else {
+      os << indent << "writer.StartArray();\n";
+      os << indent << "for (const auto &element : " << vc.self << ") {\n";
+      os << indent << "  if (!" << vs.str() << ") {\n";
+      os << indent << "    " << return_false;
+      os << indent << "  }\n";
+      os << indent << "}\n";
+      os << indent << "if (!writer.EndArray(";
+      if (array->shape == TypeClass::Vector) {
+        os << "static_cast<rapidjson::SizeType>(" << vc.self << ".size())";
+      } else {
+        os << array->array_size;
+      }
+      os << ")) {\n";
+      os << indent << "  " << return_false;
+      os << indent << "}\n";
+    }
+    if (dirty) {
+      os << cc.indent << "}\n";
+    }
+    return true;
+  };
+  return Visit(cc, cb);
+}
+
+// a nested object: allocate the child from the pool, and push its handler
+bool RecordInfo::generateStartObjectBody(llvm::raw_ostream &os,
+                                         const CodegenContext &cc) {
+  auto cb = [&](const VisitContext &vc, const Field &f) -> bool {
+    const TypeClass *array = getArrayClass(f);
+    if (array && array->getNestedRecord()) {
+      // the elements are either the records or pointers to them
+      bool by_pointer = array->element->shape == TypeClass::Pointer;
+      os << cc.indent << "case " << getItemsState(vc.state_name) << ":\n";
+      os << cc.indent << "if (!ctx) {\n";
+      os << cc.indent << "  " << returnError("NoContext");
+      os << cc.indent << "}\n";
+      if (array->shape == TypeClass::Vector) {
+        os << cc.indent << vc.self << ".emplace_back();\n";
+        os << cc.indent << "return ctx->push<" << f.nested_handler << ">("
+           << vc.self << ".back()) &&\n";
+        os << cc.indent << "       ctx->top()->StartObject();\n";
+        return true;
+      }
+      emitIndexCheck(os, cc, array);
+      if (by_pointer) {
+        os << cc.indent << vc.self << "[index] = ctx->pool.create<"
+           << f.nested_name << ">();\n";
+      }
+      os << cc.indent << "return ctx->push<" << f.nested_handler << ">("
+         << (by_pointer ? "*" : "") << vc.self << "[index++]) &&\n";
+      os << cc.indent << "       ctx->top()->StartObject();\n";
+      return true;
+    }
+    if (!getChildRecord(f)) {
+      return true;
+    }
+    os << cc.indent << "case " << vc.state_name << ":\n";
+    os << cc.indent << "if (!ctx) {\n";
+    os << cc.indent << "  " << returnError("NoContext");
+    os << cc.indent << "}\n";
+    emitFieldCheck(os, cc, vc, f);
+    os << cc.indent << vc.self << " = ctx->pool.create<" << f.nested_name
+       << ">();\n";
+    os << cc.indent << "state = " << cc.expact_key_state << ";\n";
+    os << cc.indent << "return ctx->push<" << f.nested_handler << ">(*"
+       << vc.self << ") &&\n";
+    os << cc.indent << "       ctx->top()->StartObject();\n";
+    return true;
+  };
+  return Visit(cc, cb);
+}
+
+void RecordInfo::copyNames() {
+  qualified_name = type->getQualifiedNameAsString();
+  plain_name = type->getName();
+  standard_layout = type->isStandardLayout();
+}
+
+void RecordInfo::prepare() {
+  copyNames();
+  auto cb = [](const VisitContext &, const Field &) { return true; };
+  Visit(getRootContext(), cb);
+}
+
+namespace {
+void addBaseDecls(const clang::CXXRecordDecl *decl,
+                  llvm::SmallPtrSetImpl<const clang::Decl *> &decls) {
+  for (const clang::CXXBaseSpecifier &base : decl->bases()) {
+    const clang::CXXRecordDecl *bd = base.getType()->getAsCXXRecordDecl();
+    if (bd && decls.insert(bd).second) {
+      addBaseDecls(bd, decls);
+    }
+  }
+}
+
+// the typedefs a type is spelled with, and the enum or record it ends at,
+// through arrays and pointers
+void addTypeDecls(clang::QualType qt,
+                  llvm::SmallPtrSetImpl<const clang::Decl *> &decls) {
+  for (;;) {
+    if (const auto *tt = qt->getAs<clang::TypedefType>()) {
+      decls.insert(tt->getDecl());
+      qt = tt->getDecl()->getUnderlyingType();
+    } else if (const clang::ArrayType *at = qt->getAsArrayTypeUnsafe()) {
+      qt = at->getElementType();
+    } else if (const auto *pt = qt->getAs<clang::PointerType>()) {
+      qt = pt->getPointeeType();
+    } else {
+      if (const clang::TagDecl *tag = qt->getAsTagDecl()) {
+        const clang::TagDecl *def = tag->getDefinition();
+        decls.insert(def ? def : tag);
+      }
+      return;
+    }
+  }
+}
+} // namespace
+
+void RecordInfo::addDependencies(
+    llvm::SmallPtrSetImpl<const clang::Decl *> &decls) {
+  decls.insert(type);
+  addBaseDecls(type, decls);
+  auto cb = [&](const VisitContext &, const Field &f) {
+    decls.insert(f.field);
+    addTypeDecls(f.field->getType(), decls);
+    return true;
+  };
+  Visit(getRootContext(), cb);
+}
+
+CodegenContext RecordInfo::getRootContext() const {
+  CodegenContext cc;
+  cc.indent = "    ";
+  cc.self = "self";
+  cc.start_state = "S_start";
+  cc.expact_key_state = "S_expect_key";
+  cc.prefix = "S_";
+  return cc;
+}
+
+const clang::CXXRecordDecl *RecordInfo::getChildRecord(const Field &f) {
+  if (f.directive.hasLayout()) {
+    return nullptr;
+  }
+  const TypeClass *tc = f.type_class;
+  return tc && tc->shape == TypeClass::Pointer ? tc->record : nullptr;
+}
+
+bool RecordInfo::hasChildren() {
+  bool has_children = false;
+  auto cb = [&](const VisitContext &, const Field &f) -> bool {
+    const TypeClass *array = getArrayClass(f);
+    has_children = has_children || getChildRecord(f) ||
+                   (array && array->getNestedRecord());
+    return true;
+  };
+  Visit(getRootContext(), cb);
+  return has_children;
+}
+
+void RecordInfo::addNestedRecords(
+    llvm::SmallVectorImpl<const clang::CXXRecordDecl *> &records) {
+  auto cb = [&](const VisitContext &, const Field &f) -> bool {
+    const TypeClass *array = getArrayClass(f);
+    if (const clang::CXXRecordDecl *child = getChildRecord(f)) {
+      records.push_back(child->getDefinition());
+    } else if (array && array->getNestedRecord()) {
+      records.push_back(array->getNestedRecord()->getDefinition());
+    }
+    return true;
+  };
+  Visit(getRootContext(), cb);
+}
+
+bool RecordInfo::hasArrays() {
+  bool has_arrays = false;
+  auto cb = [&](const VisitContext &, const Field &f) -> bool {
+    has_arrays = has_arrays || getArrayClass(f);
+    return true;
+  };
+  Visit(getRootContext(), cb);
+  return has_arrays;
+}
+
+bool RecordInfo::hasInterned() {
+  bool has_interned = false;
+  auto cb = [&](const VisitContext &, const Field &f) -> bool {
+    has_interned = has_interned || f.directive.is_interned;
+    return true;
+  };
+  Visit(getRootContext(), cb);
+  return has_interned;
+}
+
+bool RecordInfo::hasInlineStrings() {
+  bool has_inline_strings = false;
+  auto cb = [&](const VisitContext &, const Field &f) -> bool {
+    has_inline_strings = has_inline_strings || f.directive.is_inline_string;
+    return true;
+  };
+  Visit(getRootContext(), cb);
+  return has_inline_strings;
+}
+
+// handlers and writers of records refer to each other when records nest
+void RecordInfo::emitForwardDecl(llvm::raw_ostream &os) {
+  os << "struct " << getHandlerName() << ";\n";
+  os << "template <typename Writer>\n";
+  os << "bool write(const " << qualified_name
+     << " &value, Writer &writer, unsigned depth = 0);\n";
+}
+
+/* The generated code looks like:
+ *
+ * struct FooHandler final : public jsongen::HandlerBase {
+ *   enum State { S_start, S_expect_key, S_end, <one state per field> };
+ *   Foo &self;
+ *   State state = S_start;
+ *   bool <state>_check = false; // for each \required field
+ *   bool Null() override;
+ *   ...
+ * };
+ * template <typename Writer>
+ * bool write(const Foo &self, Writer &writer, unsigned depth);
+ *
+ * and the definitions, emitted by emitDefinitions() after every handler is
+ * complete, either inline in the same header or in a separate source file:
+ *
+ * bool FooHandler::Null() {
+ *   switch (state) {
+ *   <generateNullBody>
+ *   default:
+ *     return false;
+ *   }
+ * }
+ * ...
+ * bool parse(Foo &self, char *buffer, jsongen::ErrorInfo *error = nullptr);
+ * // or, if Foo has nested records: pointers, arrays or std::vectors of them
+ * bool parse(Foo &self, char *buffer, jsongen::ParseContext &ctx,
+ *            jsongen::ErrorInfo *error = nullptr);
+ * // with the files option, the same on a private mapping of path, kept
+ * // alive by file
+ * bool parse_file(Foo &self, jsongen::MappedFile &file, const char *path,
+ *                 jsongen::ErrorInfo *error = nullptr);
+ *
+ * Every failure of a handler goes through FooHandler::fail(), out of line,
+ * which records the error, the state and the offset into error.
+ */
+namespace {
+// the SAX callbacks whose body is a switch over the states
+struct SwitchHandler {
+  // the name of its part of the code in the report
+  const char *kind;
+  const char *signature;
+  bool (RecordInfo::*generator)(llvm::raw_ostream &, const CodegenContext &);
+};
+} // namespace
+
+// the handler of the switch mode, its callbacks are defined by
+// emitDefinitions()
+bool RecordInfo::emitSwitchHandler(llvm::raw_ostream &os,
+                                   const EmitOptions &opts) {
+  const std::string &record_name = qualified_name;
+  std::string handler_name = getHandlerName();
+  CodegenContext cc = getRootContext();
+
+  os << "struct " << handler_name << " final : public jsongen::HandlerBase {\n";
+  os << "  enum State {\n";
+  os << "    " << cc.start_state << ",\n";
+  os << "    " << cc.expact_key_state << ",\n";
+  os << "    S_end,\n";
+  if (!generateEnumBody(os, cc)) {
+    return false;
+  }
+  os << "  };\n";
+  os << "  " << record_name << " &self;\n";
+  os << "  State state = " << cc.start_state << ";\n";
+  CodegenContext member_cc = cc;
+  member_cc.indent = "  ";
+  if (!generateCheckBody(os, member_cc)) {
+    return false;
+  }
+  if (hasArrays()) {
+    os << "  rapidjson::SizeType index = 0;\n";
+  }
+  KeyPlan key_plan = getKeyPlan(opts);
+  unsigned keys = key_plan.order.size();
+  if (key_plan.speculate) {
+    os << "  // the member of the last key, " << keys << " before the first\n";
+    os << "  unsigned last_key = " << keys << ";\n";
+  }
+  if (keys) {
+    os << "#ifdef JSONGEN_PROFILE\n";
+    os << "  unsigned profile_last = " << keys << ";\n";
+    os << "  void profileKey(unsigned key) {\n";
+    os << "    static const char *const keys[] = {\n";
+    auto key_name = [&](const VisitContext &, const Field &f) -> bool {
+      os << "      \"" << f.name << "\",\n";
+      return true;
+    };
+    Visit(cc, key_name);
+    os << "    };\n";
+    os << "    static jsongen::KeyCounters counters(\"" << record_name
+       << "\", keys, " << keys << ");\n";
+    os << "    counters.hit(profile_last, key);\n";
+    os << "    profile_last = key;\n";
+    os << "  }\n";
+    os << "#endif\n";
+  }
+  if (record_directive.is_track_dirty) {
+    os << "  // set by parsePatch(), the \\required members may be missing\n";
+    os << "  bool patch = false;\n";
+  }
+  os << "  explicit " << handler_name << "(" << record_name
+     << " &self) : self(self) {}\n";
+  os << "  // the names of the states, by State\n";
+  os << "  static const char *const *stateNames();\n";
+  os << "#ifdef JSONGEN_METRICS\n";
+  os << "  static jsongen::RecordMetrics &metrics();\n";
+  os << "#endif\n";
+  os << "  // record why the parse failed, at the current state or at, and "
+        "return false\n";
+  os << "  JSONGEN_COLD bool fail(jsongen::ParseError code, State at) const;\n";
+  os << "  bool fail(jsongen::ParseError code) const { return fail(code, state); "
+        "}\n";
+  os << "  bool valid() const;\n";
+  os << "  bool done() const override { return state == S_end; }\n";
+  os << "  bool Null() override;\n";
+  os << "  bool Bool(bool b) override;\n";
+  os << "  bool Int(int i) override;\n";
+  os << "  bool Uint(unsigned u) override;\n";
+  os << "  bool Int64(int64_t i) override;\n";
+  os << "  bool Uint64(uint64_t u) override;\n";
+  os << "  bool Double(double d) override;\n";
+  os << "  bool RawNumber(const char *str, rapidjson::SizeType length, "
+        "bool copy) override;\n";
+  os << "  bool String(const char *str, rapidjson::SizeType length, "
+        "bool copy) override;\n";
+  os << "  bool StartObject() override;\n";
+  os << "  bool Key(const char *str, rapidjson::SizeType length, bool copy) "
+        "override;\n";
+  os << "  bool EndObject(rapidjson::SizeType members) override;\n";
+  os << "  bool StartArray() override;\n";
+  os << "  bool EndArray(rapidjson::SizeType elements) override;\n";
+  os << "};\n\n";
+  return true;
+}
+
+// Records whose members are all scalars of a jsongen::FieldKind or
+// \cstring: standard-layout records only, for offsetof to be valid, with at
+// most 64 members, for the \required bits.
+bool RecordInfo::isTableDriven(const EmitOptions &opts) {
+  if (!opts.table_driven || !standard_layout) {
+    return false;
+  }
+  unsigned members = 0;
+  bool described = true;
+  auto cb = [&](const VisitContext &, const Field &f) -> bool {
+    const TypeClass *tc = f.type_class;
+    ++members;
+    described = described &&
+                (f.directive.is_c_string ||
+                 (!f.directive.hasLayout() && tc && tc->table_kind));
+    return true;
+  };
+  Visit(getRootContext(), cb);
+  return described && members != 0 && members <= 64;
+}
+
+/* In the table-driven mode, the handler is only a table:
+ *
+ * struct FooHandler final : public jsongen::TableHandler {
+ *   static const jsongen::RecordTable &table() {
+ *     static constexpr jsongen::FieldInfo fields[] = {
+ *         {"x", 1, offsetof(Foo, x), jsongen::FieldKind::Int32, false},
+ *         ...
+ *     };
+ *     static constexpr jsongen::RecordTable table = {fields, ..., <required>,
+ *                                                    <validate_utf8>};
+ *     return table;
+ *   }
+ *   explicit FooHandler(Foo &self) : TableHandler(table(), &self) {}
+ * };
+ *
+ * The members are in the order Key() compares them, see getKeyPlan().
+ */
+void RecordInfo::emitTableHandler(llvm::raw_ostream &os,
+                                  const EmitOptions &opts) {
+  const std::string &record_name = qualified_name;
+  std::string handler_name = getHandlerName();
+  std::vector<const Field *> members;
+  auto cb = [&](const VisitContext &, const Field &f) -> bool {
+    members.push_back(&f);
+    return true;
+  };
+  Visit(getRootContext(), cb);
+  KeyPlan plan = getKeyPlan(opts);
+
+  os << "struct " << handler_name << " final : public jsongen::TableHandler {\n";
+  os << "  static const jsongen::RecordTable &table() {\n";
+  os << "    static constexpr jsongen::FieldInfo fields[] = {\n";
+  uint64_t required = 0;
+  unsigned size = 0;
+  for (unsigned n : plan.order) {
+    const Field &f = *members[n];
+    const std::string &key = f.name;
+    const char *kind =
+        f.directive.is_c_string ? "CString" : f.type_class->table_kind;
+    os << "        {\"" << key << "\", " << key.size() << ", offsetof("
+       << record_name << ", " << key << "), jsongen::FieldKind::" << kind
+       << ", " << (f.directive.is_required ? "true" : "false") << "},\n";
+    if (f.directive.is_required) {
+      required |= uint64_t(1) << size;
+    }
+    ++size;
+  }
+  os << "    };\n";
+  os << "    static constexpr jsongen::RecordTable table = {fields, " << size
+     << ", " << llvm::format_hex(required, 18) << ", "
+     << (opts.validate_utf8 ? "true" : "false") << "};\n";
+  os << "    return table;\n";
+  os << "  }\n";
+  os << "#ifdef JSONGEN_METRICS\n";
+  os << "  static jsongen::RecordMetrics &metrics() {\n";
+  os << "    static const char *const names[] = {\n";
+  os << "        \"S_start\", \"S_expect_key\", \"S_end\",\n";
+  for (unsigned n : plan.order) {
+    os << "        \"" << members[n]->name << "\",\n";
+  }
+  os << "    };\n";
+  os << "    static jsongen::RecordMetrics metrics(\"" << record_name
+     << "\", names, " << 3 + size << ");\n";
+  os << "    return metrics;\n";
+  os << "  }\n";
+  os << "#endif\n";
+  os << "  explicit " << handler_name << "(" << record_name
+     << " &self) : TableHandler(table(), &self) {\n";
+  os << "#ifdef JSONGEN_METRICS\n";
+  os << "    TableHandler::metrics = &" << handler_name << "::metrics();\n";
+  os << "#endif\n";
+  os << "  }\n";
+  os << "};\n\n";
+}
+
+namespace {
+// Counts the lines of code that start with a case label, the labels of
+// the generated switches are on lines of their own.
+unsigned countCaseLabels(llvm::StringRef code) {
+  unsigned cases = 0;
+  while (!code.empty()) {
+    std::pair<llvm::StringRef, llvm::StringRef> line = code.split('\n');
+    if (line.first.ltrim().startswith("case ")) {
+      ++cases;
+    }
+    code = line.second;
+  }
+  return cases;
+}
+} // namespace
+
+bool RecordInfo::emitSection(
+    llvm::raw_ostream &os, const EmitOptions &opts, const char *kind,
+    llvm::function_ref<bool(llvm::raw_ostream &)> emit) {
+  if (!opts.report) {
+    return emit(os);
+  }
+  std::string code;
+  llvm::raw_string_ostream cs(code);
+  if (!emit(cs)) {
+    return false;
+  }
+  cs.flush();
+  // the parts a record doesn't have, e.g. its tracker, are left out
+  if (!code.empty()) {
+    sections.push_back({kind, code.size(), countCaseLabels(code)});
+  }
+  os << code;
+  return true;
+}
+
+bool RecordInfo::emitWrite(llvm::raw_ostream &os, bool table_driven) {
+  const std::string &record_name = qualified_name;
+  std::string handler_name = getHandlerName();
+  CodegenContext cc = getRootContext();
+
+  os << "template <typename Writer>\n";
+  if (table_driven) {
+    os << "bool write(const " << record_name
+       << " &value, Writer &writer, unsigned) {\n";
+    os << "  return jsongen::writeTable(" << handler_name
+       << "::table(), &value, writer);\n";
+    os << "}\n\n";
+  } else {
+    os << "bool write(const " << record_name
+       << " &value, Writer &writer, unsigned depth) {\n";
+    os << "  if (depth > jsongen::kMaxWriteDepth) {\n";
+    os << "    " << return_false;
+    os << "  }\n";
+    os << "  // the access paths are shared with the parser, which needs a "
+          "mutable self\n";
+    os << "  " << record_name << " &self = const_cast<" << record_name
+       << " &>(value);\n";
+    os << "  writer.StartObject();\n";
+    CodegenContext write_cc = cc;
+    write_cc.indent = "  ";
+    if (!generateWriteBody(os, write_cc)) {
+      return false;
+    }
+    os << "  return writer.EndObject();\n";
+    os << "}\n\n";
+  }
+  return true;
+}
+
+bool RecordInfo::emitCode(llvm::raw_ostream &os, const EmitOptions &opts) {
+  const std::string &record_name = qualified_name;
+  bool table_driven = isTableDriven(opts);
+  sections.clear();
+
+  if (!emitSection(os, opts, "handler", [&](llvm::raw_ostream &out) {
+        if (table_driven) {
+          emitTableHandler(out, opts);
+          return true;
+        }
+        return emitSwitchHandler(out, opts);
+      })) {
+    return false;
+  }
+
+  if (!opts.inline_definitions) {
+    os << getParseSignature("parse", true) << ";\n";
+    if (record_directive.is_track_dirty) {
+      os << getParseSignature("parsePatch", true) << ";\n";
+    }
+    if (opts.files) {
+      os << getParseFileSignature(true) << ";\n";
+    }
+    os << "\n";
+  }
+
+  if (!emitSection(os, opts, "write", [&](llvm::raw_ostream &out) {
+        return emitWrite(out, table_driven);
+      })) {
+    return false;
+  }
+  if (opts.extern_templates && !opts.inline_definitions) {
+    // instantiated once, in the source file
+    os << "extern template bool write<" << opts.extern_writer << ">(const "
+       << record_name << " &, " << opts.extern_writer << " &, unsigned);\n\n";
+  }
+  // the optional parts, only with their plugin options
+  if (opts.files) {
+    emitSection(os, opts, "parse_ndjson_file", [&](llvm::raw_ostream &out) {
+      emitParseNdjson(out);
+      return true;
+    });
+  }
+  if (opts.push) {
+    emitSection(os, opts, "push_parser", [&](llvm::raw_ostream &out) {
+      emitPushParser(out);
+      return true;
+    });
+  }
+  if (opts.columns) {
+    emitSection(os, opts, "columns", [&](llvm::raw_ostream &out) {
+      emitColumns(out);
+      return true;
+    });
+    if (!opts.inline_definitions && !getColumns().empty()) {
+      os << getParseColumnsSignature(true) << ";\n\n";
+    }
+  }
+  if (opts.views &&
+      !emitSection(os, opts, "view", [&](llvm::raw_ostream &out) {
+        return emitView(out);
+      })) {
+    return false;
+  }
+  if (record_directive.is_track_dirty &&
+      !emitSection(os, opts, "tracker", [&](llvm::raw_ostream &out) {
+        return emitTracker(out);
+      })) {
+    return false;
+  }
+  return true;
+}
+
+// The documents of an ndjson file, parsed one after the other into self:
+// callback(self) is called after each, and stops the parse by returning
+// false. The nested records of a document are freed when the next one is
+// parsed.
+void RecordInfo::emitParseNdjson(llvm::raw_ostream &os) {
+  const std::string &record_name = qualified_name;
+  std::string handler_name = getHandlerName();
+  bool has_children = hasChildren();
+  os << "template <typename Callback>\n";
+  os << "bool parse_ndjson_file(" << record_name
+     << " &self, jsongen::MappedFile &file, const char *path,\n";
+  os << "                       Callback &&callback"
+     << (has_children ? ", jsongen::ParseContext &ctx" : "") << ") {\n";
+  os << "  if (!file.open(path)) {\n";
+  os << "    " << return_false;
+  os << "  }\n";
+  os << "  rapidjson::InsituStringStream is(file.data());\n";
+  os << "  rapidjson::Reader reader;\n";
+  os << "#ifdef JSONGEN_METRICS\n";
+  os << "  jsongen::ErrorInfo metrics_error;\n";
+  os << "#endif\n";
+  os << "  for (;;) {\n";
+  os << "    while (is.Peek() == ' ' || is.Peek() == '\\n' || "
+        "is.Peek() == '\\r' ||\n";
+  os << "           is.Peek() == '\\t') {\n";
+  os << "      is.Take();\n";
+  os << "    }\n";
+  os << "    if (is.Peek() == '\\0') {\n";
+  os << "      return true;\n";
+  os << "    }\n";
+  os << "    self = " << record_name << "();\n";
+  os << "#ifdef JSONGEN_METRICS\n";
+  os << "    size_t start = is.Tell();\n";
+  os << "    metrics_error = jsongen::ErrorInfo();\n";
+  os << "#endif\n";
+  if (has_children) {
+    os << "    ctx.reset();\n";
+    os << "    ctx.pool.clear();\n";
+    os << "    ctx.stream = &is;\n";
+    os << "    ctx.error = nullptr;\n";
+    os << "#ifdef JSONGEN_METRICS\n";
+    os << "    ctx.error = &metrics_error;\n";
+    os << "#endif\n";
+    os << "    if (!ctx.push<" << handler_name << ">(self)) {\n";
+    os << "      " << return_false;
+    os << "    }\n";
+    os << "    bool ok = !reader.Parse<rapidjson::kParseInsituFlag |\n";
+    os << "                            rapidjson::kParseIterativeFlag |\n";
+    os << "                            rapidjson::kParseStopWhenDoneFlag>(is, "
+          "ctx)\n";
+    os << "                   .IsError() &&\n";
+    os << "              ctx.depth() == 1 && ctx.top()->done();\n";
+  } else {
+    os << "    " << handler_name << " handler(self);\n";
+    os << "    handler.stream = &is;\n";
+    os << "#ifdef JSONGEN_METRICS\n";
+    os << "    handler.error = &metrics_error;\n";
+    os << "#endif\n";
+    os << "    bool ok = !reader.Parse<rapidjson::kParseInsituFlag |\n";
+    os << "                            rapidjson::kParseIterativeFlag |\n";
+    os << "                            rapidjson::kParseStopWhenDoneFlag>(is, "
+          "handler)\n";
+    os << "                   .IsError() &&\n";
+    os << "              handler.done();\n";
+  }
+  emitMetricsDocument(os, "    ", "ok", "is.Tell() - start",
+                      "metrics_error.code");
+  os << "    if (!ok) {\n";
+  os << "      " << return_false;
+  os << "    }\n";
+  os << "    if (!callback(self)) {\n";
+  os << "      return true;\n";
+  os << "    }\n";
+  os << "  }\n";
+  os << "}\n\n";
+}
+
+/* The parse of one document fed in chunks, for every record, with the push
+ * plugin option:
+ *
+ * class FooPushParser {
+ *   FooHandler handler; // or the ParseContext, for records with children
+ *   jsongen::PushParser<FooHandler> parser;
+ * public:
+ *   explicit FooPushParser(Foo &self, jsongen::ErrorInfo *error = nullptr);
+ *   bool feed(const char *data, size_t size); // false on invalid input
+ *   bool finish();                            // the end of the input
+ *   bool done() const;                        // self is complete
+ *   size_t tail() const;
+ * };
+ *
+ * The handler keeps its state from one chunk to the next. The strings of
+ * self point into the parser.
+ */
+void RecordInfo::emitPushParser(llvm::raw_ostream &os) {
+  const std::string &record_name = qualified_name;
+  std::string handler_name = getHandlerName();
+  std::string parser_name = plain_name + "PushParser";
+  bool has_children = hasChildren();
+  std::string target_name =
+      has_children ? "jsongen::ParseContext" : handler_name;
+  os << "class " << parser_name << " {\n";
+  if (has_children) {
+    os << "  jsongen::ParseContext &ctx;\n";
+    os << "  bool pushed;\n";
+  } else {
+    os << "  " << handler_name << " handler;\n";
+  }
+  os << "  jsongen::PushParser<" << target_name << "> parser;\n\n";
+  os << "public:\n";
+  if (has_children) {
+    os << "  " << parser_name << "(" << record_name
+       << " &self, jsongen::ParseContext &ctx,\n";
+    os << "      jsongen::ErrorInfo *error = nullptr)\n";
+    os << "      : ctx(ctx), parser(ctx, error) {\n";
+    os << "    if (error) {\n";
+    os << "      *error = jsongen::ErrorInfo();\n";
+    os << "    }\n";
+    os << "    ctx.reset();\n";
+    os << "    ctx.stream = nullptr;\n";
+    os << "    ctx.error = error;\n";
+    os << "    pushed = ctx.push<" << handler_name << ">(self);\n";
+    os << "  }\n";
+  } else {
+    os << "  explicit " << parser_name << "(" << record_name
+       << " &self, jsongen::ErrorInfo *error = nullptr)\n";
+    os << "      : handler(self), parser(handler, error) {\n";
+    os << "    if (error) {\n";
+    os << "      *error = jsongen::ErrorInfo();\n";
+    os << "    }\n";
+    os << "    handler.error = error;\n";
+    os << "  }\n";
+  }
+  os << "  " << parser_name << "(const " << parser_name << " &) = delete;\n";
+  os << "  " << parser_name << " &operator=(const " << parser_name
+     << " &) = delete;\n\n";
+  const char *ready = has_children ? "pushed && " : "";
+  os << "  bool feed(const char *data, size_t size) {\n";
+  os << "    return " << ready << "parser.feed(data, size);\n";
+  os << "  }\n";
+  os << "  bool finish() { return " << ready
+     << "parser.finish() && done(); }\n";
+  os << "  bool done() const {\n";
+  if (has_children) {
+    os << "    return parser.done() && ctx.depth() == 1 && "
+          "ctx.top()->done();\n";
+  } else {
+    os << "    return parser.done() && handler.done();\n";
+  }
+  os << "  }\n";
+  os << "  size_t tail() const { return parser.tail(); }\n";
+  os << "};\n\n";
+}
+
+namespace {
+std::string getErrorParameter(bool with_default) {
+  return with_default ? "jsongen::ErrorInfo *error = nullptr"
+                      : "jsongen::ErrorInfo *error";
+}
+
+// the metrics need the error code even if the caller doesn't
+void emitMetricsError(llvm::raw_ostream &os) {
+  os << "#ifdef JSONGEN_METRICS\n";
+  os << "  jsongen::ErrorInfo metrics_error;\n";
+  os << "  if (!error) {\n";
+  os << "    error = &metrics_error;\n";
+  os << "  }\n";
+  os << "#endif\n";
+}
+} // namespace
+
+// Bools are kept as uint8_t, std::vector<bool> packs them into bits.
+std::vector<RecordInfo::Column> RecordInfo::getColumns() {
+  std::vector<std::string> suffixes = getAccessorSuffixes();
+  std::vector<Column> columns;
+  unsigned n = 0;
+  auto cb = [&](const VisitContext &vc, const Field &f) -> bool {
+    const std::string &suffix = suffixes[n++];
+    const TypeClass *tc = f.type_class;
+    if (f.directive.hasLayout() || !tc || tc->shape != TypeClass::Scalar) {
+      return true;
+    }
+    columns.push_back({suffix,
+                       tc->write_kind == TypeClass::VK_Bool ? "uint8_t"
+                                                            : tc->spelling,
+                       vc.self});
+    return true;
+  };
+  Visit(getRootContext(), cb);
+  return columns;
+}
+
+/* The columnar form of records with scalar members, with the columns plugin
+ * option:
+ *
+ * struct FooColumns {
+ *   std::vector<int> x; // x of every row, in the order of the rows
+ *   ...
+ *   size_t size() const;
+ *   void clear();
+ *   void reserve(size_t rows);
+ * };
+ *
+ * bool parseColumns(FooColumns &columns, char *buffer,
+ *                   jsongen::ErrorInfo *error = nullptr);
+ *
+ * parseColumns() appends a row per element of a top-level array, or per
+ * document of ndjson. Each row is parsed by FooHandler into one Foo reused
+ * for every row, and only its scalar members are kept; a failed parse
+ * leaves the rows before it.
+ */
+void RecordInfo::emitColumns(llvm::raw_ostream &os) {
+  std::vector<Column> columns = getColumns();
+  if (columns.empty()) {
+    return;
+  }
+  os << "struct " << plain_name << "Columns {\n";
+  for (const Column &c : columns) {
+    os << "  std::vector<" << c.type << "> " << c.name << ";\n";
+  }
+  os << "  size_t size() const { return " << columns[0].name
+     << ".size(); }\n";
+  os << "  void clear() {\n";
+  for (const Column &c : columns) {
+    os << "    " << c.name << ".clear();\n";
+  }
+  os << "  }\n";
+  os << "  void reserve(size_t rows) {\n";
+  for (const Column &c : columns) {
+    os << "    " << c.name << ".reserve(rows);\n";
+  }
+  os << "  }\n";
+  os << "};\n\n";
+}
+
+std::string RecordInfo::getParseColumnsSignature(bool with_default) {
+  return "bool parseColumns(" + plain_name +
+         "Columns &columns, char *buffer, " +
+         (hasChildren() ? "jsongen::ParseContext &ctx, " : "") +
+         getErrorParameter(with_default) + ")";
+}
+
+void RecordInfo::emitParseColumns(llvm::raw_ostream &os,
+                                  const char *linkage) {
+  std::vector<Column> columns = getColumns();
+  if (columns.empty()) {
+    return;
+  }
+  const std::string &record_name = qualified_name;
+  std::string handler_name = getHandlerName();
+  bool has_children = hasChildren();
+  os << linkage << getParseColumnsSignature(linkage[0] != '\0') << " {\n";
+  emitMetricsError(os);
+  os << "  if (error) {\n";
+  os << "    *error = jsongen::ErrorInfo();\n";
+  os << "  }\n";
+  os << "  rapidjson::InsituStringStream is(buffer);\n";
+  os << "  rapidjson::Reader reader;\n";
+  os << "  jsongen::RowStream rows(is);\n";
+  os << "  " << record_name << " self;\n";
+  os << "  while (rows.next()) {\n";
+  os << "    self = " << record_name << "();\n";
+  os << "#ifdef JSONGEN_METRICS\n";
+  os << "    size_t start = is.Tell();\n";
+  os << "#endif\n";
+  if (has_children) {
+    os << "    ctx.reset();\n";
+    os << "    ctx.pool.clear();\n";
+    os << "    ctx.stream = &is;\n";
+    os << "    ctx.error = error;\n";
+    os << "    if (!ctx.push<" << handler_name << ">(self)) {\n";
+    os << "      " << return_false;
+    os << "    }\n";
+    os << "    rapidjson::ParseResult result =\n";
+    os << "        reader.Parse<rapidjson::kParseInsituFlag |\n";
+    os << "                     rapidjson::kParseIterativeFlag |\n";
+    os << "                     rapidjson::kParseStopWhenDoneFlag>(is, ctx);\n";
+    os << "    bool ok = jsongen::checkParse(\n";
+    os << "        result, ctx.depth() == 1 && ctx.top()->done(), error);\n";
+  } else {
+    os << "    " << handler_name << " handler(self);\n";
+    os << "    handler.stream = &is;\n";
+    os << "    handler.error = error;\n";
+    os << "    rapidjson::ParseResult result =\n";
+    os << "        reader.Parse<rapidjson::kParseInsituFlag |\n";
+    os << "                     rapidjson::kParseIterativeFlag |\n";
+    os << "                     rapidjson::kParseStopWhenDoneFlag>(is, "
+          "handler);\n";
+    os << "    bool ok = jsongen::checkParse(result, handler.done(), error);\n";
+  }
+  emitMetricsDocument(os, "    ", "ok", "is.Tell() - start", "error->code");
+  os << "    if (!ok) {\n";
+  os << "      " << return_false;
+  os << "    }\n";
+  for (const Column &c : columns) {
+    os << "    columns." << c.name << ".push_back(" << c.value << ");\n";
+  }
+  os << "  }\n";
+  os << "  if (rows.failed()) {\n";
+  os << "    return jsongen::recordError(error, jsongen::ParseError::Syntax, "
+        "nullptr,\n";
+  os << "                                &is);\n";
+  os << "  }\n";
+  os << "  return true;\n";
+  os << "}\n\n";
+}
+
+/* The lazy view of every record, with the views plugin option:
+ *
+ * class FooView {
+ *   Foo self;                 // the members decoded so far
+ *   jsongen::ObjectIndex index;
+ *   uint64_t loaded[...], valid[...];
+ *   bool decode(const char *key, rapidjson::SizeType length);
+ * public:
+ *   bool open(char *buffer);
+ *   const decltype(self.x) *get_x();  // nullptr if x is missing or invalid
+ * };
+ *
+ * open() only indexes the members, get_x() decodes x with FooHandler the first
+ * time it is called, as if the document had no other member. The buffer is
+ * decoded in place and must outlive the view. Of the members of the same
+ * name, only the one Key() stores the value into, the first in Visit()
+ * order, has an accessor.
+ */
+bool RecordInfo::emitView(llvm::raw_ostream &os) {
+  const std::string &record_name = qualified_name;
+  std::string handler_name = getHandlerName();
+  std::string view_name = plain_name + "View";
+  CodegenContext cc = getRootContext();
+  std::vector<std::string> suffixes = getAccessorSuffixes();
+  unsigned words = suffixes.empty() ? 1 : (suffixes.size() + 63) / 64;
+  bool has_children = hasChildren();
+
+  os << "class " << view_name << " {\n";
+  os << "  " << record_name << " " << cc.self << ";\n";
+  os << "  jsongen::ObjectIndex index;\n";
+  if (has_children) {
+    os << "  jsongen::ParseContext ctx;\n";
+  }
+  os << "  uint64_t loaded[" << words << "] = {};\n";
+  os << "  uint64_t valid[" << words << "] = {};\n\n";
+  os << "  bool decode(const char *key, rapidjson::SizeType length) {\n";
+  os << "    char *value = index.find(key, length);\n";
+  os << "    if (!value) {\n";
+  os << "      " << return_false;
+  os << "    }\n";
+  os << "    rapidjson::InsituStringStream is(value);\n";
+  if (has_children) {
+    os << "    ctx.reset();\n";
+    os << "    ctx.stream = &is;\n";
+    os << "    if (!ctx.push<" << handler_name << ">(" << cc.self << ")) {\n";
+    os << "      " << return_false;
+    os << "    }\n";
+    os << "    " << handler_name << " &handler = *static_cast<" << handler_name
+       << " *>(ctx.top());\n";
+  } else {
+    os << "    " << handler_name << " handler(" << cc.self << ");\n";
+    os << "    handler.stream = &is;\n";
+  }
+  os << "    handler.StartObject();\n";
+  os << "    handler.Key(key, length, false);\n";
+  os << "    rapidjson::Reader reader;\n";
+  os << "    return !reader.Parse<rapidjson::kParseInsituFlag |\n";
+  os << "                         rapidjson::kParseIterativeFlag |\n";
+  os << "                         rapidjson::kParseStopWhenDoneFlag>(\n";
+  os << "                 is, " << (has_children ? "ctx" : "handler")
+     << ").IsError() &&\n";
+  if (has_children) {
+    os << "           ctx.depth() == 1 &&\n";
+  }
+  os << "           handler.state == " << handler_name
+     << "::" << cc.expact_key_state << ";\n";
+  os << "  }\n\n";
+  os << "public:\n";
+  os << "  bool open(char *buffer) {\n";
+  os << "    " << cc.self << " = " << record_name << "();\n";
+  os << "    for (unsigned i = 0; i != " << words << "; ++i) {\n";
+  os << "      loaded[i] = valid[i] = 0;\n";
+  os << "    }\n";
+  os << "    return index.build(buffer);\n";
+  os << "  }\n";
+  unsigned bit = 0;
+  llvm::StringSet<> decoded;
+  auto accessor = [&](const VisitContext &vc, const Field &f) -> bool {
+    unsigned n = bit++;
+    // the others of that name are never written by Key()
+    if (!decoded.insert(f.name).second) {
+      return true;
+    }
+    std::string word = "[" + std::to_string(n / 64) + "]";
+    std::string mask = "(uint64_t(1) << " + std::to_string(n % 64) + ")";
+    const std::string &key = f.name;
+    os << "  const decltype(" << vc.self << ") *get_" << suffixes[n]
+       << "() {\n";
+    os << "    if (!(loaded" << word << " & " << mask << ")) {\n";
+    os << "      loaded" << word << " |= " << mask << ";\n";
+    os << "      if (decode(\"" << key << "\", " << key.size() << ")) {\n";
+    os << "        valid" << word << " |= " << mask << ";\n";
+    os << "      }\n";
+    os << "    }\n";
+    os << "    return valid" << word << " & " << mask << " ? &" << vc.self
+       << " : nullptr;\n";
+    os << "  }\n";
+    return true;
+  };
+  if (!Visit(cc, accessor)) {
+    return false;
+  }
+  os << "};\n\n";
+  return true;
+}
+
+// The names of the generated per-member accessors, in Visit() order: the
+// member name, or the state name for members hidden by members of the same
+// name in derived classes.
+std::vector<std::string> RecordInfo::getAccessorSuffixes() {
+  CodegenContext cc = getRootContext();
+  llvm::StringMap<unsigned> name_count;
+  auto count = [&](const VisitContext &, const Field &f) -> bool {
+    ++name_count[f.name];
+    return true;
+  };
+  Visit(cc, count);
+  std::vector<std::string> suffixes;
+  auto name = [&](const VisitContext &vc, const Field &f) -> bool {
+    suffixes.push_back(
+        name_count[f.name] == 1
+            ? f.name
+            : vc.state_name.drop_front(cc.prefix.size()).str());
+    return true;
+  };
+  Visit(cc, name);
+  return suffixes;
+}
+
+/* \trackDirty records also get:
+ *
+ * struct FooTracked {
+ *   Foo value;
+ *   uint64_t dirty[<one bit per member>] = {};
+ *   void set_x(int const &v);   // assign value.x and mark it dirty
+ *   void mark_x();              // value.x was changed in place
+ *   void markAll();
+ *   void clear();
+ *   bool any() const;
+ * };
+ * template <typename Writer>
+ * bool writeDelta(const FooTracked &tracked, Writer &writer,
+ *                 unsigned depth = 0);
+ *
+ * The n-th member in Visit() order owns bit n.
+ */
+bool RecordInfo::emitTracker(llvm::raw_ostream &os) {
+  const std::string &record_name = qualified_name;
+  std::string tracked_name = plain_name + "Tracked";
+  CodegenContext cc = getRootContext();
+
+  std::vector<std::string> suffixes = getAccessorSuffixes();
+  unsigned members = suffixes.size();
+  unsigned words = members ? (members + 63) / 64 : 1;
+
+  os << "struct " << tracked_name << " {\n";
+  os << "  " << record_name << " value;\n";
+  os << "  uint64_t dirty[" << words << "] = {};\n";
+  unsigned bit = 0;
+  auto setter = [&](const VisitContext &vc, const Field &f) -> bool {
+    unsigned n = bit++;
+    const std::string &suffix = suffixes[n];
+    std::string mark = "dirty[" + std::to_string(n / 64) +
+                       "] |= uint64_t(1) << " + std::to_string(n % 64) + ";";
+    if (!f.setter_type.empty()) {
+      os << "  void set_" << suffix << "(" << f.setter_type
+         << " const &v) {\n";
+      os << "    " << record_name << " &" << cc.self << " = value;\n";
+      os << "    " << vc.self << " = v;\n";
+      os << "    " << mark << "\n";
+      os << "  }\n";
+    }
+    os << "  void mark_" << suffix << "() { " << mark << " }\n";
+    return true;
+  };
+  if (!Visit(cc, setter)) {
+    return false;
+  }
+  os << "  void markAll() {\n";
+  for (unsigned w = 0; w != words; ++w) {
+    unsigned bits = std::min(64u, members - 64 * w);
+    os << "    dirty[" << w << "] = ";
+    if (bits == 64) {
+      os << "~uint64_t(0);\n";
+    } else if (bits == 0) {
+      os << "0;\n";
+    } else {
+      os << "~uint64_t(0) >> " << 64 - bits << ";\n";
+    }
+  }
+  os << "  }\n";
+  os << "  void clear() {\n";
+  os << "    for (uint64_t &d : dirty) {\n";
+  os << "      d = 0;\n";
+  os << "    }\n";
+  os << "  }\n";
+  os << "  bool any() const {\n";
+  os << "    for (uint64_t d : dirty) {\n";
+  os << "      if (d) {\n";
+  os << "        return true;\n";
+  os << "      }\n";
+  os << "    }\n";
+  os << "    return false;\n";
+  os << "  }\n";
+  os << "};\n\n";
+
+  os << "template <typename Writer>\n";
+  os << "bool writeDelta(const " << tracked_name
+     << " &tracked, Writer &writer, unsigned depth = 0) {\n";
+  os << "  if (depth > jsongen::kMaxWriteDepth) {\n";
+  os << "    " << return_false;
+  os << "  }\n";
+  os << "  " << record_name << " &self = const_cast<" << record_name
+     << " &>(tracked.value);\n";
+  os << "  writer.StartObject();\n";
+  CodegenContext write_cc = cc;
+  write_cc.indent = "  ";
+  if (!generateWriteBody(os, write_cc, "tracked.dirty")) {
+    return false;
+  }
+  os << "  return writer.EndObject();\n";
+  os << "}\n\n";
+  return true;
+}
+
+// file keeps the mapping the strings of self point into
+std::string RecordInfo::getParseFileSignature(bool with_default) {
+  const std::string &record_name = qualified_name;
+  return "bool parse_file(" + record_name +
+         " &self, jsongen::MappedFile &file, const char *path, " +
+         (hasChildren() ? "jsongen::ParseContext &ctx, " : "") +
+         getErrorParameter(with_default) + ")";
+}
+
+std::string RecordInfo::getParseSignature(llvm::StringRef name,
+                                          bool with_default) {
+  const std::string &record_name = qualified_name;
+  return "bool " + name.str() + "(" + record_name + " &self, char *buffer, " +
+         (hasChildren() ? "jsongen::ParseContext &ctx, " : "") +
+         getErrorParameter(with_default) + ")";
+}
+
+// parse() and parsePatch(), the latter doesn't require the \required members
+void RecordInfo::emitParse(llvm::raw_ostream &os, const char *linkage,
+                           llvm::StringRef name, bool patch) {
+  std::string handler_name = getHandlerName();
+  // only inline definitions are also the declaration
+  os << linkage << getParseSignature(name, linkage[0] != '\0') << " {\n";
+  emitMetricsError(os);
+  os << "  if (error) {\n";
+  os << "    *error = jsongen::ErrorInfo();\n";
+  os << "  }\n";
+  if (hasChildren()) {
+    os << "  rapidjson::InsituStringStream is(buffer);\n";
+    os << "  ctx.reset();\n";
+    os << "  ctx.stream = &is;\n";
+    os << "  ctx.error = error;\n";
+    os << "  if (!ctx.push<" << handler_name << ">(self)) {\n";
+    os << "    " << return_false;
+    os << "  }\n";
+    if (patch) {
+      os << "  static_cast<" << handler_name
+         << " *>(ctx.top())->patch = true;\n";
+    }
+    os << "  rapidjson::Reader reader;\n";
+    os << "  rapidjson::ParseResult result =\n";
+    os << "      reader.Parse<rapidjson::kParseInsituFlag |\n";
+    os << "                   rapidjson::kParseIterativeFlag>(is, ctx);\n";
+    os << "  bool ok = jsongen::checkParse(\n";
+    os << "      result, ctx.depth() == 1 && ctx.top()->done(), error);\n";
+  } else {
+    os << "  " << handler_name << " handler(self);\n";
+    os << "  rapidjson::InsituStringStream is(buffer);\n";
+    os << "  handler.stream = &is;\n";
+    os << "  handler.error = error;\n";
+    if (patch) {
+      os << "  handler.patch = true;\n";
+    }
+    os << "  rapidjson::Reader reader;\n";
+    os << "  rapidjson::ParseResult result =\n";
+    os << "      reader.Parse<rapidjson::kParseInsituFlag |\n";
+    os << "                   rapidjson::kParseIterativeFlag>(is, handler);\n";
+    os << "  bool ok = jsongen::checkParse(result, handler.done(), error);\n";
+  }
+  emitMetricsDocument(os, "  ", "ok", "is.Tell()", "error->code");
+  os << "  return ok;\n";
+  os << "}\n\n";
+}
+
+void RecordInfo::emitMetricsDocument(llvm::raw_ostream &os,
+                                     llvm::StringRef indent,
+                                     llvm::StringRef ok, llvm::StringRef bytes,
+                                     llvm::StringRef code) {
+  os << "#ifdef JSONGEN_METRICS\n";
+  os << indent << getHandlerName() << "::metrics().document(" << ok << ", "
+     << bytes << ", " << (hasChildren() ? "ctx.highWater()" : "1") << ", "
+     << code << ");\n";
+  os << "#endif\n";
+}
 
+// the callbacks of the switch mode handler
+bool RecordInfo::emitSwitchDefinitions(llvm::raw_ostream &os,
+                                       const EmitOptions &opts) {
+  std::string handler_name = getHandlerName();
+  const char *linkage = opts.inline_definitions ? "inline " : "";
+  CodegenContext cc = getRootContext();
+  cc.validate_utf8 = opts.validate_utf8;
+  cc.indent = "  ";
+
+  // stateNames(), metrics(), fail() and valid()
+  if (!emitSection(os, opts, "support", [&](llvm::raw_ostream &out) {
+        out << linkage << "const char *const *" << handler_name
+            << "::stateNames() {\n";
+        out << "  static const char *const names[] = {\n";
+        out << "    \"" << cc.start_state << "\",\n";
+        out << "    \"" << cc.expact_key_state << "\",\n";
+        out << "    \"S_end\",\n";
+        CodegenContext names_cc = cc;
+        names_cc.indent = "    ";
+        if (!generateStateNameBody(out, names_cc)) {
+          return false;
+        }
+        out << "  };\n";
+        out << "  return names;\n";
+        out << "}\n\n";
+
+        out << "#ifdef JSONGEN_METRICS\n";
+        out << linkage << "jsongen::RecordMetrics &" << handler_name
+            << "::metrics() {\n";
+        out << "  static jsongen::RecordMetrics metrics(\""
+            << qualified_name << "\", stateNames(), "
+            << getStateCount() << ");\n";
+        out << "  return metrics;\n";
+        out << "}\n";
+        out << "#endif\n\n";
+
+        out << linkage << "bool " << handler_name
+            << "::fail(jsongen::ParseError code, State at) const {\n";
+        out << "#ifdef JSONGEN_METRICS\n";
+        out << "  metrics().error(at);\n";
+        out << "#endif\n";
+        out << "  return jsongen::recordError(error, code, stateNames()[at], "
+               "stream);\n";
+        out << "}\n\n";
+
+        out << linkage << "bool " << handler_name << "::valid() const {\n";
+        if (!generateValidBody(out, cc)) {
+          return false;
+        }
+        out << "  return true;\n";
+        out << "}\n\n";
+        return true;
+      })) {
+    return false;
+  }
+
+  const SwitchHandler switch_handlers[] = {
+      {"Null", "Null()", &RecordInfo::generateNullBody},
+      {"Bool", "Bool(bool b)", &RecordInfo::generateBoolBody},
+      {"Int", "Int(int i)", &RecordInfo::generateIntBody},
+      {"Uint", "Uint(unsigned u)", &RecordInfo::generateUintBody},
+      {"Int64", "Int64(int64_t i)", &RecordInfo::generateInt64Body},
+      {"Uint64", "Uint64(uint64_t u)", &RecordInfo::generateUint64Body},
+      {"Double", "Double(double d)", &RecordInfo::generateDoubleBody},
+      {"String",
+       "String(const char *str, rapidjson::SizeType length, bool copy)",
+       &RecordInfo::generateStringBody},
+      {"StartArray", "StartArray()", &RecordInfo::generateStartArrayBody},
+      {"EndArray", "EndArray(rapidjson::SizeType)",
+       &RecordInfo::generateEndArrayBody},
+  };
+  for (const SwitchHandler &sh : switch_handlers) {
+    if (!emitSection(os, opts, sh.kind, [&](llvm::raw_ostream &out) {
+          out << linkage << "bool " << handler_name << "::" << sh.signature
+              << " {\n";
+          out << "  switch (state) {\n";
+          if (!(this->*sh.generator)(out, cc)) {
+            return false;
+          }
+          out << "  default:\n";
+          out << "    " << returnError("UnexpectedToken");
+          out << "  }\n";
+          out << "}\n\n";
+          return true;
+        })) {
+      return false;
+    }
+  }
+
+  // we never ask rapidjson for kParseNumbersAsStringsFlag
+  emitSection(os, opts, "RawNumber", [&](llvm::raw_ostream &out) {
+    out << linkage << "bool " << handler_name
+        << "::RawNumber(const char *, rapidjson::SizeType, bool) {\n";
+    out << "  " << returnError("UnexpectedToken");
+    out << "}\n\n";
+    return true;
+  });
+
+  if (!emitSection(os, opts, "StartObject", [&](llvm::raw_ostream &out) {
+        out << linkage << "bool " << handler_name << "::StartObject() {\n";
+        out << "  switch (state) {\n";
+        out << "  case " << cc.start_state << ":\n";
+        out << "    state = " << cc.expact_key_state << ";\n";
+        out << "    return true;\n";
+        if (!generateStartObjectBody(out, cc)) {
+          return false;
+        }
+        out << "  default:\n";
+        out << "    " << returnError("UnexpectedToken");
+        out << "  }\n";
+        out << "}\n\n";
+        return true;
+      })) {
+    return false;
+  }
+
+  if (!emitSection(os, opts, "Key", [&](llvm::raw_ostream &out) {
+        out << linkage << "bool " << handler_name
+            << "::Key(const char *str, rapidjson::SizeType length, bool) {\n";
+        out << "  if (state != " << cc.expact_key_state << ") {\n";
+        out << "    " << returnError("UnexpectedToken");
+        out << "  }\n";
+        if (!generateKeyBody(out, cc, getKeyPlan(opts))) {
+          return false;
+        }
+        out << "  " << returnError("UnknownKey");
+        out << "}\n\n";
+        return true;
+      })) {
+    return false;
+  }
+
+  emitSection(os, opts, "EndObject", [&](llvm::raw_ostream &out) {
+    out << linkage << "bool " << handler_name
+        << "::EndObject(rapidjson::SizeType) {\n";
+    out << "  if (state != " << cc.expact_key_state << ") {\n";
+    out << "    " << returnError("UnexpectedToken");
+    out << "  }\n";
+    out << "  state = S_end;\n";
+    out << (record_directive.is_track_dirty ? "  return patch || valid();\n"
+                                            : "  return valid();\n");
+    out << "}\n\n";
+    return true;
+  });
+  return true;
+}
+
+// parse() on a private mapping of path
+void RecordInfo::emitParseFile(llvm::raw_ostream &os, const char *linkage) {
+  os << linkage << getParseFileSignature(linkage[0] != '\0') << " {\n";
+  os << "  if (!file.open(path)) {\n";
+  os << "    return jsongen::recordError(error, jsongen::ParseError::Io, "
+        "nullptr,\n";
+  os << "                                nullptr);\n";
+  os << "  }\n";
+  os << "  return parse(self, file.data(), " << (hasChildren() ? "ctx, " : "")
+     << "error);\n";
+  os << "}\n\n";
+}
+
+// definitions that need the handlers of all records to be complete
+bool RecordInfo::emitDefinitions(llvm::raw_ostream &os,
+                                 const EmitOptions &opts) {
+  const std::string &record_name = qualified_name;
+  const char *linkage = opts.inline_definitions ? "inline " : "";
+
+  // the callbacks of table-driven records are jsongen::TableHandler's
+  if (!isTableDriven(opts) && !emitSwitchDefinitions(os, opts)) {
+    return false;
+  }
+
+  emitSection(os, opts, "parse", [&](llvm::raw_ostream &out) {
+    emitParse(out, linkage, "parse", false);
+    return true;
+  });
+  if (record_directive.is_track_dirty) {
+    emitSection(os, opts, "parsePatch", [&](llvm::raw_ostream &out) {
+      emitParse(out, linkage, "parsePatch", true);
+      return true;
+    });
+  }
+  if (opts.files) {
+    emitSection(os, opts, "parse_file", [&](llvm::raw_ostream &out) {
+      emitParseFile(out, linkage);
+      return true;
+    });
+  }
+  if (opts.columns) {
+    emitSection(os, opts, "parseColumns", [&](llvm::raw_ostream &out) {
+      emitParseColumns(out, linkage);
+      return true;
+    });
+  }
+
+  if (opts.extern_templates && !opts.inline_definitions) {
+    os << "template bool write<" << opts.extern_writer << ">(const "
+       << record_name << " &, " << opts.extern_writer << " &, unsigned);\n\n";
+  }
+  return true;
+}
+
+void RecordInfo::writeReportBases(llvm::raw_ostream &os,
+                                  const char *&separator) {
+  auto write_bases = [&](std::vector<SubClass> &bs, bool is_virtual) {
+    for (SubClass &b : bs) {
+      os << separator << "        {\"name\": \""
+         << b.info->qualified_name << "\", \"derived\": \"" << qualified_name
+         << "\", \"virtual\": "
+         << (is_virtual ? "true" : "false")
+         << ", \"omitted\": " << (b.omit ? "true" : "false") << "}";
+      separator = ",\n";
+      if (!b.omit) {
+        b.info->writeReportBases(os, separator);
+      }
+    }
+  };
+  write_bases(vbases, true);
+  write_bases(bases, false);
+}
+
+namespace {
+// the names of the TypeClass::Fallback bits in the report
+const char *const fallback_names[] = {
+    "pointer_as_integer", "function_proto_as_integer",
+    "function_no_proto_as_integer", "paren_as_integer", "enum_as_integer"};
+} // namespace
+
+void RecordInfo::writeReport(llvm::raw_ostream &os, const EmitOptions &opts) {
+  os << "    {\n";
+  os << "      \"record\": \"" << qualified_name << "\",\n";
+  os << "      \"table_driven\": " << (isTableDriven(opts) ? "true" : "false")
+     << ",\n";
+  os << "      \"states\": " << getStateCount() << ",\n";
+
+  // a virtual base is walked once for each path to it, as flatten() does
+  os << "      \"bases\": [";
+  const char *separator = "\n";
+  writeReportBases(os, separator);
+  os << (separator[0] == ',' ? "\n      ],\n" : "],\n");
+
+  size_t bytes = 0;
+  unsigned cases = 0;
+  os << "      \"code\": {";
+  separator = "\n";
+  for (const CodeSection &cs : sections) {
+    os << separator << "        \"" << cs.kind << "\": {\"bytes\": " << cs.bytes
+       << ", \"cases\": " << cs.cases << "}";
+    separator = ",\n";
+    bytes += cs.bytes;
+    cases += cs.cases;
+  }
+  os << (separator[0] == ',' ? "\n      },\n" : "},\n");
+  os << "      \"bytes\": " << bytes << ",\n";
+  os << "      \"cases\": " << cases << ",\n";
+
+  os << "      \"fallbacks\": [";
+  separator = "\n";
+  auto cb = [&](const VisitContext &, const Field &f) -> bool {
+    const TypeClass *tc = f.type_class;
+    if (!tc || !tc->fallbacks) {
+      return true;
+    }
+    os << separator << "        {\"member\": \""
+       << f.qualified_name << "\", \"warnings\": [";
+    const char *comma = "";
+    for (unsigned i = 0; i != llvm::array_lengthof(fallback_names); ++i) {
+      if (tc->fallbacks & (1u << i)) {
+        os << comma << "\"" << fallback_names[i] << "\"";
+        comma = ", ";
+      }
+    }
+    os << "]}";
+    separator = ",\n";
+    return true;
+  };
+  Visit(getRootContext(), cb);
+  os << (separator[0] == ',' ? "\n      ]\n" : "]\n");
+  os << "    }";
+}
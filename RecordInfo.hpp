@@ -1,8 +1,15 @@
 #pragma once
 
 #include "Directive.hpp"
+#include "TypeClass.hpp"
 
 #include "clang/AST/DeclCXX.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/StringSaver.h"
 #include "llvm/Support/raw_ostream.h"
 
 namespace clang {
@@ -11,6 +18,39 @@ class CXXRecordDecl;
 class CXXBaseSpecifier;
 } // namespace clang
 
+class KeyProfile;
+
+// how the generated code is laid out, shared by every record
+struct EmitOptions {
+  // definitions go to the header as inline functions, otherwise they go to
+  // a separate source file, compiled once
+  bool inline_definitions = true;
+  // declare the instantiation of write() for extern_writer extern in the
+  // header, and instantiate it in the source file
+  bool extern_templates = false;
+  std::string extern_writer =
+      "rapidjson::Writer<rapidjson::StringBuffer>";
+  // orders the key comparisons of Key(), nullptr for the declaration order
+  const KeyProfile *profile = nullptr;
+  // the records the tables of JsonGenTable.hpp can describe are parsed and
+  // written by the shared jsongen::TableHandler and jsongen::writeTable()
+  bool table_driven = false;
+  // string values are checked to be UTF-8 before they are stored
+  bool validate_utf8 = false;
+  // measure the code emitted for each record, see RecordInfo::writeReport()
+  bool report = false;
+  // the optional parts of the code of every record, each with the runtime
+  // header it needs: parse_file() and parse_ndjson_file(), on POSIX
+  // mappings (JsonGenFile.hpp)
+  bool files = false;
+  // FooPushParser (JsonGenPush.hpp)
+  bool push = false;
+  // FooView
+  bool views = false;
+  // FooColumns and parseColumns()
+  bool columns = false;
+};
+
 // the information needed by codegen functions
 struct CodegenContext {
   std::string indent;
@@ -18,20 +58,45 @@ struct CodegenContext {
   std::string start_state;      // the source code for the start state
   std::string expact_key_state; // the source code for the expect-key state
   std::string prefix; // the prefix that should be append to your state's name
+  bool validate_utf8 = false; // reject string values that aren't UTF-8
 };
 
 struct Field {
   const clang::FieldDecl *field;
   FieldDirective directive;
-  Field(const clang::FieldDecl *field, FieldDirective directive)
-      : field(field), directive(directive) {}
+  // owned by JsonGenTypeVisitor, nullptr for the fields whose directive
+  // decides how they are parsed
+  const TypeClass *type_class;
+  // the following are copied from the AST by RecordInfo::prepare(), the
+  // code is emitted from them alone
+  std::string name;
+  std::string qualified_name;
+  // the canonical type taken by the setter of the tracker, empty for arrays
+  // and const members, which have none
+  std::string setter_type;
+  // what an \intern member holds, decided by its type: an id of id_type, a
+  // pointer or a view
+  enum class Interned : unsigned char { Id, Pointer, View };
+  Interned interned = Interned::View;
+  std::string id_type;
+  // the record parsed by a handler of its own, through a pointer member or
+  // as array elements, and the name of that handler
+  std::string nested_name;
+  std::string nested_handler;
+  Field(const clang::FieldDecl *field, FieldDirective directive,
+        const TypeClass *type_class = nullptr)
+      : field(field), directive(directive), type_class(type_class) {}
 };
 
+class RecordInfo;
+
 // this class doesn't record whether this is a virtual base
 struct SubClass {
   const clang::CXXBaseSpecifier *base;
+  RecordInfo *info;
   bool omit : 1;
-  SubClass(const clang::CXXBaseSpecifier *base) : base(base) {}
+  SubClass(const clang::CXXBaseSpecifier *base, RecordInfo *info)
+      : base(base), info(info), omit(false) {}
 };
 
 class RecordInfo {
@@ -41,12 +106,46 @@ class RecordInfo {
   std::vector<SubClass> vbases;
   std::vector<Field> fields;
   RecordDirective record_directive;
-  clang::CXXRecordDecl *type;
+  const clang::CXXRecordDecl *type;
+  // copied from the AST by copyNames()
+  std::string qualified_name;
+  std::string plain_name;
+  bool standard_layout = false;
+  void copyNames();
+  // the strings are owned by the StringSaver of the root record
   struct VisitContext {
-    std::string state_name;
-    std::string self;
-    std::string parent;
+    llvm::StringRef state_name;
+    llvm::StringRef self;
+    llvm::StringRef parent;
   };
+  // where a flattened field comes from, seen from the root record
+  enum class Origin : unsigned char { VBase, Base, Field };
+  struct FlatField {
+    VisitContext vc;
+    const Field *field;
+    Origin origin;
+  };
+  llvm::StringSaver names;
+  std::vector<FlatField> flat_fields;
+  std::string flat_root_self;
+  std::string flat_root_prefix;
+  bool flattened = false;
+  // a part of the generated code, measured for the report
+  struct CodeSection {
+    const char *kind;
+    size_t bytes;
+    unsigned cases;
+  };
+  std::vector<CodeSection> sections;
+  // emit(os), measured as kind if opts.report
+  bool emitSection(llvm::raw_ostream &os, const EmitOptions &opts,
+                   const char *kind,
+                   llvm::function_ref<bool(llvm::raw_ostream &)> emit);
+  // the bases flatten() walks, in its order, for writeReport()
+  void writeReportBases(llvm::raw_ostream &os, const char *&separator);
+  // append the fields of this record and all its bases to out
+  void flatten(llvm::StringRef self, llvm::StringRef prefix, Origin origin,
+               llvm::StringSaver &saver, std::vector<FlatField> &out);
   // class CB {
   // public:
   // // handle the specified field, no matter it is a
@@ -60,6 +159,10 @@ class RecordInfo {
   // codegen functions
   // the following codegen functions only generate code for non-virtual bases
   bool generateEnumBody(llvm::raw_ostream &, const CodegenContext &);
+  bool generateStateNameBody(llvm::raw_ostream &, const CodegenContext &);
+  // the number of states of the switch handler, S_start and S_expect_key
+  // and S_end included
+  unsigned getStateCount();
   bool generateNullBody(llvm::raw_ostream &, const CodegenContext &);
   bool generateBoolBody(llvm::raw_ostream &, const CodegenContext &);
   bool generateIntBody(llvm::raw_ostream &, const CodegenContext &);
@@ -68,25 +171,106 @@ class RecordInfo {
   bool generateUint64Body(llvm::raw_ostream &, const CodegenContext &);
   bool generateDoubleBody(llvm::raw_ostream &, const CodegenContext &);
   bool generateStringBody(llvm::raw_ostream &, const CodegenContext &);
-  bool generateKeyBody(llvm::raw_ostream &, const CodegenContext &);
+  // the order Key() compares the keys in, and the key it tries first after
+  // each one
+  struct KeyPlan {
+    // members, by their index in Visit() order
+    std::vector<unsigned> order;
+    // predicted[n]: the member that likely follows member n, or the start
+    // of the object for n == the number of members; -1 if none does
+    std::vector<int> predicted;
+    // some key is predicted, the handler remembers the last key
+    bool speculate = false;
+  };
+  KeyPlan getKeyPlan(const EmitOptions &);
+  bool generateKeyBody(llvm::raw_ostream &, const CodegenContext &,
+                       const KeyPlan &);
   bool generateStartArrayBody(llvm::raw_ostream &, const CodegenContext &);
   bool generateEndArrayBody(llvm::raw_ostream &, const CodegenContext &);
   bool generateRawNumberBody(llvm::raw_ostream &, const CodegenContext &);
+  bool generateStartObjectBody(llvm::raw_ostream &, const CodegenContext &);
+  // the body of write(), one Writer call per field; the body of writeDelta()
+  // if dirty names the dirty bits
+  bool generateWriteBody(llvm::raw_ostream &, const CodegenContext &,
+                         const char *dirty = nullptr);
+  // the following two generate the bookkeeping of \required fields
+  bool generateCheckBody(llvm::raw_ostream &, const CodegenContext &);
+  bool generateValidBody(llvm::raw_ostream &, const CodegenContext &);
+  // <state>_check records whether a required field has been seen, seeing it
+  // twice is an error
   void emitFieldCheck(llvm::raw_ostream &os, const CodegenContext &cc,
                       const VisitContext &vc, const Field &f) {
     if (!f.directive.is_required) {
       return;
     }
-    std::string check_name = vc.state_name + "_check";
+    std::string check_name = (vc.state_name + "_check").str();
     os << cc.indent << "if (" << check_name << ") {\n";
-    os << cc.indent << "  return false\n";
+    os << cc.indent
+       << "  return fail(jsongen::ParseError::DuplicateMember);\n";
     os << cc.indent << "} else {\n";
-    os << cc.indent << "  " << check_name << " = false;\n";
+    os << cc.indent << "  " << check_name << " = true;\n";
     os << cc.indent << "}\n";
   }
+  bool emitScalarStore(llvm::raw_ostream &os, const CodegenContext &cc,
+                       const TypeClass *tc, llvm::StringRef target,
+                       TypeClass::ValueKind kind, const char *value);
+  void emitIndexCheck(llvm::raw_ostream &os, const CodegenContext &cc,
+                      const TypeClass *array);
+  void emitScalarCase(llvm::raw_ostream &os, const CodegenContext &cc,
+                      const VisitContext &vc, const Field &f,
+                      TypeClass::ValueKind kind, const char *value);
+  static bool emitWriteCall(llvm::raw_ostream &os, const TypeClass *tc,
+                            llvm::StringRef value);
+  // a value has been consumed, go back to wait for the next key
+  void emitValueEnd(llvm::raw_ostream &os, const CodegenContext &cc) {
+    os << cc.indent << "state = " << cc.expact_key_state << ";\n";
+    os << cc.indent << "return true;\n";
+  }
 
 public:
+  // strings computed by the codegen functions live in allocator
+  RecordInfo(const clang::CXXRecordDecl *type,
+             llvm::BumpPtrAllocator &allocator)
+      : record_directive(nullptr), type(type), names(allocator) {}
+
+  const clang::CXXRecordDecl *getDecl() const { return type; }
+  // the name of the generated SAX handler class
+  static std::string getHandlerName(const clang::CXXRecordDecl *decl) {
+    return decl->getName().str() + "Handler";
+  }
+  // after prepare()
+  std::string getHandlerName() const { return plain_name + "Handler"; }
+  // the context every codegen function starts from
+  CodegenContext getRootContext() const;
+  // Build the flattened field table, and copy from the AST the names and
+  // type spellings the code is emitted from. The table's strings live in the
+  // allocator shared by all records, so this has to be called for every
+  // record before they are emitted concurrently; the codegen functions only
+  // read the table after it, never the AST.
+  void prepare();
+  // add the declarations the generated code depends on to decls: the record,
+  // its bases, its members and what their types are spelled with; after
+  // prepare()
+  void addDependencies(llvm::SmallPtrSetImpl<const clang::Decl *> &decls);
+  // a pointer member to a nested record, allocated while parsing
+  static const clang::CXXRecordDecl *getChildRecord(const Field &f);
+  // whether write() writes f back: \usrString, \usrArray, the arrays
+  // described by directives and the records stored by value are left out
+  static bool isWritten(const Field &f);
+  bool hasChildren();
+  // add the records parsed by handlers of their own, through a pointer
+  // member or as array elements, to records; after prepare()
+  void addNestedRecords(
+      llvm::SmallVectorImpl<const clang::CXXRecordDecl *> &records);
+  // fixed-size array members need an index in the handler
+  bool hasArrays();
+  // whether a member, of the record or of its bases, is \intern or
+  // \inlineString, for the runtime headers they need
+  bool hasInterned();
+  bool hasInlineStrings();
+
   void setDirective(RecordDirective rd) { record_directive = rd; }
+  const RecordDirective &getDirective() const { return record_directive; }
 
   bool addMember(const Field &f) {
     fields.push_back(f);
@@ -109,8 +293,8 @@ public:
     bases.push_back(b);
     return true;
   }
-  bool emplaceBase(const clang::CXXBaseSpecifier *base) {
-    bases.emplace_back(base);
+  bool emplaceBase(const clang::CXXBaseSpecifier *base, RecordInfo *info) {
+    bases.emplace_back(base, info);
     return true;
   }
 
@@ -122,12 +306,57 @@ public:
     vbases.push_back(b);
     return true;
   }
-  bool emplaceVBase(const clang::CXXBaseSpecifier *vbase) {
-    vbases.emplace_back(vbase);
+  bool emplaceVBase(const clang::CXXBaseSpecifier *vbase, RecordInfo *info) {
+    vbases.emplace_back(vbase, info);
     return true;
   }
 
-  void emitCode(llvm::raw_ostream &);
+  // with_default: the declaration that carries the default arguments
+  std::string getParseSignature(llvm::StringRef name, bool with_default);
+  std::string getParseFileSignature(bool with_default);
+  // parse_ndjson_file(), a template over the callback
+  void emitParseNdjson(llvm::raw_ostream &);
+  // FooPushParser, the parse of chunked input
+  void emitPushParser(llvm::raw_ostream &);
+  // the scalar members, one column each in <Record>Columns
+  struct Column {
+    std::string name;
+    std::string type;
+    llvm::StringRef value;
+  };
+  std::vector<Column> getColumns();
+  // <Record>Columns, if the record has a scalar member
+  void emitColumns(llvm::raw_ostream &);
+  std::string getParseColumnsSignature(bool with_default);
+  void emitParseColumns(llvm::raw_ostream &, const char *linkage);
+  bool emitSwitchHandler(llvm::raw_ostream &, const EmitOptions &);
+  bool emitSwitchDefinitions(llvm::raw_ostream &, const EmitOptions &);
+  // whether the record is emitted in the table-driven mode
+  bool isTableDriven(const EmitOptions &);
+  // FooHandler as a jsongen::TableHandler over the table of Foo
+  void emitTableHandler(llvm::raw_ostream &, const EmitOptions &);
+  void emitParse(llvm::raw_ostream &, const char *linkage, llvm::StringRef name,
+                 bool patch);
+  // the count of a document parsed by an entry point, with -DJSONGEN_METRICS
+  void emitMetricsDocument(llvm::raw_ostream &, llvm::StringRef indent,
+                           llvm::StringRef ok, llvm::StringRef bytes,
+                           llvm::StringRef code);
+  std::vector<std::string> getAccessorSuffixes();
+  // <Record>View, decodes members on first access
+  bool emitView(llvm::raw_ostream &);
+  // <Record>Tracked and writeDelta() of \trackDirty records
+  bool emitTracker(llvm::raw_ostream &);
+  void emitForwardDecl(llvm::raw_ostream &);
+  // write(), the generic one or the table-driven one
+  bool emitWrite(llvm::raw_ostream &, bool table_driven);
+  void emitParseFile(llvm::raw_ostream &, const char *linkage);
+  // the handler class and write()
+  bool emitCode(llvm::raw_ostream &, const EmitOptions &);
+  // the member functions of the handler and parse()
+  bool emitDefinitions(llvm::raw_ostream &, const EmitOptions &);
+  // this record in the report= file, a JSON object: its states, the bases
+  // flattened into it, the code emitted for it by kind, and the members
+  // whose types were treated as something else; after emitCode() and
+  // emitDefinitions() with EmitOptions::report
+  void writeReport(llvm::raw_ostream &, const EmitOptions &);
 };
-
-RecordInfo *getRecordInfoFromDecl(const clang::CXXRecordDecl *);
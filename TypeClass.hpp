@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace clang {
+class CXXRecordDecl;
+} // namespace clang
+
+// What a field's type accepts from the SAX callbacks and how values are
+// converted into it. JsonGenTypeVisitor computes it once per canonical type,
+// every codegen function only reads it.
+struct TypeClass {
+  // Vector is a std::vector of records or scalars, grown as the elements
+  // are parsed
+  enum Shape : unsigned char {
+    Scalar,
+    Pointer,
+    Record,
+    ConstantArray,
+    Vector,
+    Other
+  };
+  enum ValueKind : unsigned {
+    VK_None = 0,
+    VK_Null = 1 << 0,
+    VK_Bool = 1 << 1,
+    VK_Int = 1 << 2,
+    VK_Uint = 1 << 3,
+    VK_Int64 = 1 << 4,
+    VK_Uint64 = 1 << 5,
+    VK_Double = 1 << 6,
+    VK_String = 1 << 7,
+    VK_Object = 1 << 8,
+    VK_Array = 1 << 9,
+  };
+  // the types treated as something else, with a warning
+  enum Fallback : unsigned {
+    FB_None = 0,
+    FB_PointerAsInteger = 1 << 0,
+    FB_FunctionProtoAsInteger = 1 << 1,
+    FB_FunctionNoProtoAsInteger = 1 << 2,
+    FB_ParenAsInteger = 1 << 3,
+    FB_EnumAsInteger = 1 << 4,
+  };
+
+  Shape shape = Other;
+  // the SAX callbacks a value of this type may come from
+  unsigned value_kinds = VK_None;
+  // the callbacks whose values may not fit, they are checked with
+  // jsongen::fits<range_type>() before the conversion
+  unsigned narrowing_kinds = VK_None;
+  // how the type is spelled in the generated code, values are converted with
+  // static_cast<spelling>
+  std::string spelling;
+  // the integer type values are range checked against, for enums this is
+  // the underlying type
+  std::string range_type;
+  // the Writer function used by write()
+  ValueKind write_kind = VK_None;
+  // an arithmetic type, not bool or enum, that arrays of it can be read
+  // by jsongen::scanNumbers()
+  bool bulk_numeric = false;
+  // the jsongen::FieldKind of a scalar in the table-driven mode, nullptr if
+  // the tables can't describe the type
+  const char *table_kind = nullptr;
+  // Record: the record itself, Pointer: the pointee if it is a record
+  const clang::CXXRecordDecl *record = nullptr;
+  // ConstantArray: the element and the number of elements, Vector: the
+  // element
+  const TypeClass *element = nullptr;
+  uint64_t array_size = 0;
+  // the fallbacks taken for the type and the types it is made of; the
+  // warnings are reported once per type, this remembers them for each member
+  unsigned fallbacks = FB_None;
+
+  bool accepts(ValueKind kind) const { return value_kinds & kind; }
+  // the record parsed by a handler of its own: the pointee of a pointer, or
+  // the element of an array
+  const clang::CXXRecordDecl *getNestedRecord() const {
+    if (shape == Pointer) {
+      return record;
+    }
+    if ((shape == ConstantArray || shape == Vector) && element) {
+      return element->shape == Record ? element->record
+                                      : element->getNestedRecord();
+    }
+    return nullptr;
+  }
+  bool narrows(ValueKind kind) const { return narrowing_kinds & kind; }
+};
@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+"""Generator-side benchmark for the jsongen clang plugin.
+
+Writes a corpus of synthetic headers of configurable shape, runs the plugin
+over each of them and reports wall time, peak RSS and the per-phase timings
+the plugin records with stats=<file>, as JSON.
+
+  generator_bench.py --clang clang++ --plugin libjsongen.so --out result.json
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+# the commands understood by Directive.cpp, clang has to know them to attach
+# them to the comments
+COMMENT_COMMANDS = ["jsongen", "omitBase", "required", "omit", "cstring",
+                    "usrString", "string", "nullArray", "usrArray", "array",
+                    "shortArray", "trackDirty", "intern", "inlineString"]
+
+
+def wide(fields):
+    out = ["/// \\jsongen", "struct Wide {"]
+    out += ["  int f%d;" % i for i in range(fields)]
+    out.append("};")
+    return out
+
+
+def deep(depth, virtual):
+    inherit = "virtual " if virtual else ""
+    out = ["struct D0 {", "  int m0;", "};"]
+    for i in range(1, depth + 1):
+        if i == depth:
+            out.append("/// \\jsongen")
+        out += ["struct D%d : %sD%d {" % (i, inherit, i - 1),
+                "  int m%d;" % i, "};"]
+    return out
+
+
+def many_small(records, fields):
+    out = []
+    for r in range(records):
+        out += ["/// \\jsongen", "struct Small%d {" % r]
+        out += ["  int f%d;" % i for i in range(fields)]
+        out.append("};")
+    return out
+
+
+def long_usr_string(fields, length):
+    statement = "$$ = std::string(str, length); " * (length // 32 + 1)
+    out = ["#include <string>", "/// \\jsongen", "struct LongUsrString {"]
+    for i in range(fields):
+        out.append("  std::string s%d; /// \\usrString %s" %
+                   (i, statement[:length]))
+    out.append("};")
+    return out
+
+
+def corpus(args):
+    return {
+        "wide": ({"fields": args.wide_fields}, wide(args.wide_fields)),
+        "deep": ({"depth": args.depth}, deep(args.depth, False)),
+        "deep_virtual": ({"depth": args.depth}, deep(args.depth, True)),
+        "many_small": ({"records": args.small_records, "fields": 4},
+                       many_small(args.small_records, 4)),
+        "long_usr_string": ({"fields": args.usr_fields,
+                             "length": args.usr_length},
+                            long_usr_string(args.usr_fields,
+                                            args.usr_length)),
+    }
+
+
+def run_once(args, header, workdir):
+    output = os.path.join(workdir, "jsongen.hpp")
+    stats = os.path.join(workdir, "stats.json")
+    cmd = [args.clang, "-std=c++17", "-fsyntax-only",
+           "-fcomment-block-commands=" + ",".join(COMMENT_COMMANDS),
+           "-Xclang", "-load", "-Xclang", args.plugin,
+           "-Xclang", "-plugin", "-Xclang", "jsongen",
+           "-Xclang", "-plugin-arg-jsongen", "-Xclang", "output=" + output,
+           "-Xclang", "-plugin-arg-jsongen", "-Xclang", "stats=" + stats,
+           header]
+    for stale in (output, stats):
+        if os.path.exists(stale):
+            os.remove(stale)
+    with tempfile.TemporaryFile() as err:
+        start = time.perf_counter()
+        proc = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=err)
+        # wait4 gives the rusage of this child only, unlike RUSAGE_CHILDREN
+        _, status, rusage = os.wait4(proc.pid, 0)
+        wall = time.perf_counter() - start
+        proc.returncode = os.waitstatus_to_exitcode(status)
+        err.seek(0)
+        stderr = err.read().decode(errors="replace")
+    result = {
+        "exit_status": proc.returncode,
+        "wall_seconds": wall,
+        "max_rss_kb": rusage.ru_maxrss,
+    }
+    if os.path.exists(stats):
+        with open(stats) as f:
+            result.update(json.load(f))
+    if os.path.exists(output):
+        result["output_bytes"] = os.path.getsize(output)
+    if result["exit_status"] != 0:
+        result["stderr"] = stderr[-4096:]
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--clang", required=True)
+    parser.add_argument("--plugin", required=True)
+    parser.add_argument("--out", help="write JSON here instead of stdout")
+    parser.add_argument("--repeat", type=int, default=3,
+                        help="keep the fastest of N runs")
+    parser.add_argument("--shape", action="append",
+                        help="only run these shapes")
+    parser.add_argument("--wide-fields", type=int, default=1000)
+    parser.add_argument("--depth", type=int, default=12)
+    parser.add_argument("--small-records", type=int, default=2000)
+    parser.add_argument("--usr-fields", type=int, default=200)
+    parser.add_argument("--usr-length", type=int, default=4096)
+    args = parser.parse_args()
+
+    results = []
+    with tempfile.TemporaryDirectory(prefix="jsongen-bench-") as workdir:
+        for shape, (params, lines) in corpus(args).items():
+            if args.shape and shape not in args.shape:
+                continue
+            header = os.path.join(workdir, shape + ".hpp")
+            with open(header, "w") as f:
+                f.write("\n".join(lines) + "\n")
+            runs = [run_once(args, header, workdir)
+                    for _ in range(args.repeat)]
+            best = min(runs, key=lambda r: r["wall_seconds"])
+            best["max_rss_kb"] = max(r["max_rss_kb"] for r in runs)
+            results.append({"shape": shape, "params": params,
+                            "header_bytes": os.path.getsize(header),
+                            "runs": len(runs), "result": best})
+            print("%-16s %8.3fs %8d KB" % (shape, best["wall_seconds"],
+                                           best["max_rss_kb"]),
+                  file=sys.stderr)
+
+    report = {"benchmark": "generator", "version": 1, "results": results}
+    if args.out:
+        with open(args.out, "w") as f:
+            json.dump(report, f, indent=2)
+    else:
+        json.dump(report, sys.stdout, indent=2)
+    failed = [r["shape"] for r in results if r["result"]["exit_status"]]
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,420 @@
+// Throughput of the generated parsers and writers, compared with rapidjson's
+// DOM on the same documents. Prints one JSON object to stdout (or --out).
+//
+//   runtime_bench [--docs N] [--seconds S] [--out file]
+//
+// runtime_bench_tables is the same over the code of the table-driven mode;
+// the records the tables can't describe are in the switch mode in both.
+
+#include "jsongen.hpp"
+
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifndef JSONGEN_BENCH_MODE
+#define JSONGEN_BENCH_MODE "switch"
+#endif
+
+namespace {
+
+// every allocation of the process goes through here
+size_t allocation_count = 0;
+
+// hardware counters, only when perf_event_open is allowed
+class PerfCounters {
+  int cycles_fd = -1;
+  int branch_misses_fd = -1;
+
+#ifdef __linux__
+  static int open(uint64_t config, int group) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = group == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(
+        syscall(__NR_perf_event_open, &attr, 0, -1, group, 0));
+  }
+  static uint64_t read(int fd) {
+    uint64_t value = 0;
+    if (::read(fd, &value, sizeof(value)) != sizeof(value)) {
+      return 0;
+    }
+    return value;
+  }
+#endif
+
+public:
+  PerfCounters() {
+#ifdef __linux__
+    cycles_fd = open(PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (cycles_fd != -1) {
+      branch_misses_fd = open(PERF_COUNT_HW_BRANCH_MISSES, cycles_fd);
+    }
+    if (branch_misses_fd == -1 && cycles_fd != -1) {
+      close(cycles_fd);
+      cycles_fd = -1;
+    }
+#endif
+  }
+  ~PerfCounters() {
+#ifdef __linux__
+    if (cycles_fd != -1) {
+      close(branch_misses_fd);
+      close(cycles_fd);
+    }
+#endif
+  }
+  bool available() const { return cycles_fd != -1; }
+  void start() {
+#ifdef __linux__
+    if (available()) {
+      ioctl(cycles_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(cycles_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+  }
+  void stop(uint64_t &cycles, uint64_t &branch_misses) {
+    cycles = branch_misses = 0;
+#ifdef __linux__
+    if (available()) {
+      ioctl(cycles_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+      cycles = read(cycles_fd);
+      branch_misses = read(branch_misses_fd);
+    }
+#endif
+  }
+};
+
+struct Result {
+  std::string name;
+  bool ok = true;
+  size_t docs = 0;
+  size_t bytes = 0;
+  size_t allocations = 0;
+  double seconds = 0;
+  uint64_t cycles = 0;
+  uint64_t branch_misses = 0;
+};
+
+struct Options {
+  size_t docs = 1000;
+  double seconds = 1.0;
+  const char *out = nullptr;
+};
+
+// run op over every document until the time budget is used up
+Result measure(const char *name, const Options &opts, PerfCounters &perf,
+               const std::vector<std::string> &corpus,
+               const std::function<bool(const std::string &)> &op) {
+  Result r;
+  r.name = name;
+  size_t corpus_bytes = 0;
+  for (const std::string &doc : corpus) {
+    corpus_bytes += doc.size();
+  }
+  // warm up, and check that every document is accepted
+  for (const std::string &doc : corpus) {
+    r.ok = op(doc) && r.ok;
+  }
+  using clock = std::chrono::steady_clock;
+  size_t allocations = allocation_count;
+  perf.start();
+  auto start = clock::now();
+  do {
+    for (const std::string &doc : corpus) {
+      op(doc);
+    }
+    r.docs += corpus.size();
+    r.bytes += corpus_bytes;
+    r.seconds = std::chrono::duration<double>(clock::now() - start).count();
+  } while (r.seconds < opts.seconds);
+  perf.stop(r.cycles, r.branch_misses);
+  r.allocations = allocation_count - allocations;
+  return r;
+}
+
+// deterministic documents for each schema
+class CorpusBuilder {
+  std::mt19937_64 rng{42};
+
+  template <typename T> T uniform(T lo, T hi) {
+    return std::uniform_int_distribution<T>(lo, hi)(rng);
+  }
+  double real() {
+    return std::uniform_real_distribution<double>(-1e6, 1e6)(rng);
+  }
+  std::string word(size_t min, size_t max) {
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789-/._ ";
+    std::string s(uniform<size_t>(min, max), ' ');
+    for (char &c : s) {
+      c = chars[uniform<size_t>(0, sizeof(chars) - 2)];
+    }
+    return s;
+  }
+  template <typename... Args> static std::string format(const char *fmt,
+                                                        Args... args) {
+    std::vector<char> buffer(4096);
+    int n = std::snprintf(buffer.data(), buffer.size(), fmt, args...);
+    if (n >= static_cast<int>(buffer.size())) {
+      buffer.resize(n + 1);
+      std::snprintf(buffer.data(), buffer.size(), fmt, args...);
+    }
+    return buffer.data();
+  }
+
+public:
+  std::string flat() {
+    return format("{\"id\":%d,\"timestamp\":%lld,\"flags\":%u,\"sequence\":"
+                  "%llu,\"price\":%.17g,\"quantity\":%.17g,\"level\":%d,"
+                  "\"active\":%s}",
+                  uniform(-100000, 100000),
+                  static_cast<long long>(uniform<int64_t>(0, 1LL << 50)),
+                  uniform(0u, 0xffffffffu),
+                  static_cast<unsigned long long>(uniform<uint64_t>(0, ~0ULL)),
+                  real(), real(), uniform(-10, 10),
+                  uniform(0, 1) ? "true" : "false");
+  }
+  std::string derived() {
+    return format("{\"timestamp\":%lld,\"source\":%u,\"x\":%.17g,\"y\":%.17g,"
+                  "\"z\":%.17g,\"id\":%d,\"heading\":%.17g,\"valid\":%s}",
+                  static_cast<long long>(uniform<int64_t>(0, 1LL << 50)),
+                  uniform(0u, 1000u), real(), real(), real(),
+                  uniform(0, 1000000), real(), uniform(0, 1) ? "true" : "false");
+  }
+  std::string point() {
+    return format("{\"x\":%.17g,\"y\":%.17g,\"z\":%.17g}", real(), real(),
+                  real());
+  }
+  std::string nested() {
+    std::string s = format(
+        "{\"id\":%d,\"source\":{\"timestamp\":%lld,\"id\":%u},\"position\":",
+        uniform(0, 1000000),
+        static_cast<long long>(uniform<int64_t>(0, 1LL << 50)),
+        uniform(0u, 1000u));
+    s += point() + ",\"waypoints\":[";
+    for (int i = 0; i < 4; ++i) {
+      s += (i ? "," : "") + point();
+    }
+    return s + format("],\"valid\":%s}", uniform(0, 1) ? "true" : "false");
+  }
+  std::string arrayHeavy() {
+    std::string s = format("{\"id\":%d,\"samples\":[", uniform(0, 1000000));
+    for (int i = 0; i < 64; ++i) {
+      s += format(i ? ",%.17g" : "%.17g", real());
+    }
+    s += "],\"bins\":[";
+    for (int i = 0; i < 32; ++i) {
+      s += format(i ? ",%d" : "%d", uniform(-1000, 1000));
+    }
+    return s + "]}";
+  }
+  std::string stringHeavy() {
+    return format("{\"host\":\"%s\",\"path\":\"%s\",\"agent\":\"%s\","
+                  "\"message\":\"%s\"}",
+                  word(8, 32).c_str(), word(16, 96).c_str(),
+                  word(32, 128).c_str(), word(256, 2048).c_str());
+  }
+  std::string enumHeavy() {
+    return format("{\"level\":%d,\"kind\":%d,\"min_level\":%d,"
+                  "\"reply_kind\":%d,\"max_level\":%d,\"last_kind\":%d}",
+                  uniform(0, 5), uniform(0, 3), uniform(0, 5), uniform(0, 3),
+                  uniform(0, 5), uniform(0, 3));
+  }
+};
+
+// in-situ parsing destroys its input, every run parses a fresh copy
+class Scratch {
+  std::vector<char> buffer;
+
+public:
+  char *copy(const std::string &doc) {
+    buffer.assign(doc.begin(), doc.end());
+    buffer.push_back('\0');
+    return buffer.data();
+  }
+};
+
+// the records with nested records are parsed with a ParseContext, whose
+// pool owns the nested records
+template <typename Record>
+auto parseRecord(Record &record, char *buffer, jsongen::ParseContext &ctx,
+                 int) -> decltype(parse(record, buffer, ctx)) {
+  return parse(record, buffer, ctx);
+}
+template <typename Record>
+bool parseRecord(Record &record, char *buffer, jsongen::ParseContext &,
+                 long) {
+  return parse(record, buffer);
+}
+
+template <typename Record>
+void benchSchema(const char *schema, const Options &opts, PerfCounters &perf,
+                 const std::vector<std::string> &corpus,
+                 std::vector<std::pair<std::string, Result>> &results) {
+  Scratch scratch;
+  jsongen::ParseContext ctx;
+  results.emplace_back(
+      schema,
+      measure("jsongen_parse", opts, perf, corpus,
+              [&](const std::string &doc) {
+                Record record{};
+                ctx.pool.clear();
+                return parseRecord(record, scratch.copy(doc), ctx, 0);
+              }));
+  results.emplace_back(
+      schema, measure("rapidjson_dom_parse", opts, perf, corpus,
+                      [&](const std::string &doc) {
+                        rapidjson::Document d;
+                        d.ParseInsitu(scratch.copy(doc));
+                        return !d.HasParseError();
+                      }));
+
+  // serialize what has been parsed, the bytes are those of the input; the
+  // nested records live in the pool of nodes until the end
+  jsongen::ParseContext nodes;
+  std::vector<Record> records(corpus.size());
+  std::vector<rapidjson::Document> documents(corpus.size());
+  std::vector<std::vector<char>> buffers(corpus.size());
+  for (size_t i = 0; i < corpus.size(); ++i) {
+    buffers[i].assign(corpus[i].begin(), corpus[i].end());
+    buffers[i].push_back('\0');
+    std::vector<char> dom_buffer = buffers[i];
+    parseRecord(records[i], buffers[i].data(), nodes, 0);
+    documents[i].Parse(dom_buffer.data());
+  }
+  size_t index = 0;
+  rapidjson::StringBuffer sb;
+  results.emplace_back(
+      schema, measure("jsongen_write", opts, perf, corpus,
+                      [&](const std::string &) {
+                        sb.Clear();
+                        rapidjson::Writer<rapidjson::StringBuffer> w(sb);
+                        bool ok = write(records[index], w);
+                        index = (index + 1) % records.size();
+                        return ok;
+                      }));
+  index = 0;
+  results.emplace_back(
+      schema, measure("rapidjson_dom_write", opts, perf, corpus,
+                      [&](const std::string &) {
+                        sb.Clear();
+                        rapidjson::Writer<rapidjson::StringBuffer> w(sb);
+                        bool ok = documents[index].Accept(w);
+                        index = (index + 1) % documents.size();
+                        return ok;
+                      }));
+}
+
+void report(FILE *out, const PerfCounters &perf,
+            const std::vector<std::pair<std::string, Result>> &results) {
+  std::fprintf(out, "{\n  \"benchmark\": \"runtime\",\n  \"version\": 1,\n");
+  std::fprintf(out, "  \"mode\": \"%s\",\n", JSONGEN_BENCH_MODE);
+  std::fprintf(out, "  \"perf_counters\": %s,\n",
+               perf.available() ? "true" : "false");
+  std::fprintf(out, "  \"results\": [\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result &r = results[i].second;
+    double mb = r.bytes / (1024.0 * 1024.0);
+    std::fprintf(out,
+                 "    {\"schema\": \"%s\", \"case\": \"%s\", \"ok\": %s, "
+                 "\"docs\": %zu, \"bytes\": %zu, \"seconds\": %.6f, "
+                 "\"mb_per_second\": %.3f, \"docs_per_second\": %.1f, "
+                 "\"allocations_per_doc\": %.3f",
+                 results[i].first.c_str(), r.name.c_str(),
+                 r.ok ? "true" : "false", r.docs, r.bytes, r.seconds,
+                 mb / r.seconds, r.docs / r.seconds,
+                 static_cast<double>(r.allocations) / r.docs);
+    if (perf.available()) {
+      std::fprintf(out,
+                   ", \"cycles_per_byte\": %.4f, "
+                   "\"branch_misses_per_doc\": %.4f",
+                   static_cast<double>(r.cycles) / r.bytes,
+                   static_cast<double>(r.branch_misses) / r.docs);
+    }
+    std::fprintf(out, "}%s\n", i + 1 == results.size() ? "" : ",");
+  }
+  std::fprintf(out, "  ]\n}\n");
+}
+
+} // namespace
+
+void *operator new(size_t size) {
+  ++allocation_count;
+  if (void *p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+int main(int argc, char **argv) {
+  Options opts;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!std::strcmp(argv[i], "--docs")) {
+      opts.docs = std::strtoul(argv[i + 1], nullptr, 10);
+    } else if (!std::strcmp(argv[i], "--seconds")) {
+      opts.seconds = std::strtod(argv[i + 1], nullptr);
+    } else if (!std::strcmp(argv[i], "--out")) {
+      opts.out = argv[i + 1];
+    } else {
+      std::fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  PerfCounters perf;
+  CorpusBuilder builder;
+  auto build = [&](std::string (CorpusBuilder::*gen)()) {
+    std::vector<std::string> corpus(opts.docs);
+    for (std::string &doc : corpus) {
+      doc = (builder.*gen)();
+    }
+    return corpus;
+  };
+  std::vector<std::pair<std::string, Result>> results;
+  benchSchema<Flat>("flat", opts, perf, build(&CorpusBuilder::flat), results);
+  benchSchema<Derived>("derived", opts, perf, build(&CorpusBuilder::derived),
+                       results);
+  benchSchema<Nested>("nested", opts, perf, build(&CorpusBuilder::nested),
+                      results);
+  benchSchema<ArrayHeavy>("array_heavy", opts, perf,
+                          build(&CorpusBuilder::arrayHeavy), results);
+  benchSchema<StringHeavy>("string_heavy", opts, perf,
+                           build(&CorpusBuilder::stringHeavy), results);
+  benchSchema<EnumHeavy>("enum_heavy", opts, perf,
+                         build(&CorpusBuilder::enumHeavy), results);
+
+  FILE *out = opts.out ? std::fopen(opts.out, "w") : stdout;
+  if (!out) {
+    std::perror(opts.out);
+    return 1;
+  }
+  report(out, perf, results);
+  bool ok = true;
+  for (const auto &r : results) {
+    ok = ok && r.second.ok;
+  }
+  return ok ? 0 : 2;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+// the representative schemas measured by RuntimeBench.cpp
+
+#include <cstdint>
+
+/// \jsongen
+struct Flat {
+  int32_t id;
+  int64_t timestamp;
+  uint32_t flags;
+  uint64_t sequence;
+  double price;
+  double quantity;
+  int32_t level;
+  bool active;
+};
+
+// the bases are flattened into the record, its members are one object
+struct Origin {
+  int64_t timestamp;
+  uint32_t source;
+};
+
+struct Position : Origin {
+  double x;
+  double y;
+  double z;
+};
+
+/// \jsongen
+struct Derived : Position {
+  int32_t id;
+  double heading;
+  bool valid;
+};
+
+// nested objects, each parsed by a handler of its own
+/// \jsongen
+struct Source {
+  int64_t timestamp;
+  uint32_t id;
+};
+
+/// \jsongen
+struct Point {
+  double x;
+  double y;
+  double z;
+};
+
+/// \jsongen
+struct Nested {
+  int32_t id;
+  Source *source;
+  Point *position;
+  Point waypoints[4];
+  bool valid;
+};
+
+/// \jsongen
+struct ArrayHeavy {
+  int32_t id;
+  double samples[64];
+  int32_t bins[32];
+};
+
+/// \jsongen
+struct StringHeavy {
+  const char *host; /// \cstring
+  const char *path; /// \cstring
+  const char *agent; /// \cstring
+  const char *message; /// \string message_length
+  unsigned message_length;
+};
+
+enum Level { Trace, Debug, Info, Warn, Error, Fatal };
+enum Kind { Request, Response, Event, Heartbeat };
+
+/// \jsongen
+struct EnumHeavy {
+  Level level;
+  Kind kind;
+  Level min_level;
+  Kind reply_kind;
+  Level max_level;
+  Kind last_kind;
+};
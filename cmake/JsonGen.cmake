@@ -0,0 +1,92 @@
+# jsongen_generate(<target> HEADERS <header>...
+#                  [OUTPUT <header>] [SOURCE <source>]
+#                  [INCLUDE_DIRECTORIES <dir>...] [ARGS <plugin arg>...])
+#
+# Runs the plugin over the headers and adds what it generates to <target>.
+# The output defaults to ${CMAKE_CURRENT_BINARY_DIR}/jsongen/<target>/
+# jsongen.hpp, its directory and the runtime headers are added to the include
+# path of <target>. SOURCE puts the definitions into a source file compiled
+# with <target> (the source= plugin option). INCLUDE_DIRECTORIES are what the
+# headers need to be parsed besides the runtime headers, which records with
+# jsongen::InlineString members include. ARGS are more plugin options, e.g.
+# tables, or files, push, views and columns for the optional parts of the
+# generated code.
+#
+# The plugin reruns when any of HEADERS changes. It also writes a depfile
+# listing the headers the generated code depends on, which HEADERS include:
+# with Ninja, or CMake 3.20 and later, it reruns when one of those changes
+# too.
+
+set (JSONGEN_RUNTIME_INCLUDE_DIR ${CMAKE_CURRENT_LIST_DIR}/..)
+set (JSONGEN_COMMENT_COMMANDS
+  jsongen omitBase required omit cstring usrString string nullArray usrArray
+  array shortArray trackDirty intern inlineString)
+find_program (JSONGEN_CLANG clang++ HINTS ${LLVM_TOOLS_BINARY_DIR})
+
+function (jsongen_generate target)
+  cmake_parse_arguments (JG "" "OUTPUT;SOURCE"
+    "HEADERS;INCLUDE_DIRECTORIES;ARGS" ${ARGN})
+  if (NOT JG_HEADERS)
+    message (FATAL_ERROR "jsongen_generate(${target}): no HEADERS")
+  endif ()
+  set (dir ${CMAKE_CURRENT_BINARY_DIR}/jsongen/${target})
+  if (NOT JG_OUTPUT)
+    set (JG_OUTPUT ${dir}/jsongen.hpp)
+  endif ()
+  get_filename_component (output ${JG_OUTPUT} ABSOLUTE
+    BASE_DIR ${CMAKE_CURRENT_BINARY_DIR})
+  get_filename_component (output_dir ${output} DIRECTORY)
+  set (depfile ${output}.d)
+
+  # the plugin parses one file, which includes every header; rewritten only
+  # when the list changes, so that it doesn't trigger a rerun by itself
+  set (input ${dir}/jsongen_input.hpp)
+  set (content "// generated by jsongen_generate(), do not edit\n")
+  set (headers)
+  foreach (header ${JG_HEADERS})
+    get_filename_component (header ${header} ABSOLUTE)
+    list (APPEND headers ${header})
+    set (content "${content}#include \"${header}\"\n")
+  endforeach ()
+  file (WRITE ${input}.tmp "${content}")
+  configure_file (${input}.tmp ${input} COPYONLY)
+
+  set (outputs ${output})
+  set (plugin_args output=${output} depfile=${depfile})
+  if (JG_SOURCE)
+    get_filename_component (source ${JG_SOURCE} ABSOLUTE
+      BASE_DIR ${CMAKE_CURRENT_BINARY_DIR})
+    list (APPEND outputs ${source})
+    list (APPEND plugin_args source=${source})
+  endif ()
+  list (APPEND plugin_args ${JG_ARGS})
+  set (clang_args)
+  foreach (arg ${plugin_args})
+    list (APPEND clang_args -Xclang -plugin-arg-jsongen -Xclang ${arg})
+  endforeach ()
+  foreach (include ${JG_INCLUDE_DIRECTORIES} ${JSONGEN_RUNTIME_INCLUDE_DIR})
+    list (APPEND clang_args -I${include})
+  endforeach ()
+  string (REPLACE ";" "," commands "${JSONGEN_COMMENT_COMMANDS}")
+
+  # HEADERS stay listed, a header without records yet isn't in the depfile
+  set (depends ${headers})
+  if (CMAKE_GENERATOR MATCHES "Ninja" OR NOT CMAKE_VERSION VERSION_LESS 3.20)
+    list (APPEND depends DEPFILE ${depfile})
+  endif ()
+  add_custom_command(OUTPUT ${outputs}
+    COMMAND ${CMAKE_COMMAND} -E make_directory ${output_dir}
+    COMMAND ${JSONGEN_CLANG} -x c++ -std=c++17 -fsyntax-only
+            -fcomment-block-commands=${commands}
+            -Xclang -load -Xclang $<TARGET_FILE:jsongen>
+            -Xclang -plugin -Xclang jsongen
+            ${clang_args}
+            ${input}
+    DEPENDS jsongen ${input}
+    ${depends}
+    COMMENT "Generating json code for ${target}"
+    VERBATIM)
+  target_sources(${target} PRIVATE ${outputs})
+  target_include_directories(${target} PRIVATE
+    ${output_dir} ${JSONGEN_RUNTIME_INCLUDE_DIR})
+endfunction ()
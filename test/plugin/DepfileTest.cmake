@@ -0,0 +1,26 @@
+# The depfile of an output lists the headers its records are declared and
+# spelled with: the input, and the header of the type of a member. Neither an
+# included header nothing is emitted from nor a system header is listed.
+
+include (${CMAKE_CURRENT_LIST_DIR}/RunPlugin.cmake)
+
+run_plugin(depfile/Trip.hpp trip.hpp result depfile=${WORK_DIR}/trip.hpp.d)
+if (NOT result EQUAL 0)
+  message (FATAL_ERROR "Trip.hpp failed: ${result_ERROR}")
+endif ()
+
+file (READ ${WORK_DIR}/trip.hpp.d rule)
+if (NOT rule MATCHES "^[^\n]*/trip\\.hpp:")
+  message (FATAL_ERROR "the rule isn't for trip.hpp:\n${rule}")
+endif ()
+foreach (header Trip.hpp Types.hpp)
+  if (NOT rule MATCHES "/depfile/${header}")
+    message (FATAL_ERROR "${header} isn't listed:\n${rule}")
+  endif ()
+endforeach ()
+if (rule MATCHES "Unused\\.hpp")
+  message (FATAL_ERROR "Unused.hpp is listed:\n${rule}")
+endif ()
+if (rule MATCHES "cstdint|stdint")
+  message (FATAL_ERROR "a system header is listed:\n${rule}")
+endif ()
@@ -0,0 +1,47 @@
+# Two translation units that include the same record, sharing a manifest: the
+# first output generates it and owns it, the second leaves it out. A third
+# output that sees another definition of it is an ODR violation.
+
+include (${CMAKE_CURRENT_LIST_DIR}/RunPlugin.cmake)
+
+set (manifest manifest=${WORK_DIR}/manifest.txt)
+run_plugin(manifest/A.hpp a.hpp result ${manifest})
+if (NOT result EQUAL 0)
+  message (FATAL_ERROR "A.hpp failed: ${result_ERROR}")
+endif ()
+run_plugin(manifest/B.hpp b.hpp result ${manifest})
+if (NOT result EQUAL 0)
+  message (FATAL_ERROR "B.hpp failed: ${result_ERROR}")
+endif ()
+
+file (READ ${WORK_DIR}/a.hpp a)
+file (READ ${WORK_DIR}/b.hpp b)
+if (NOT a MATCHES "struct SharedHandler" OR NOT a MATCHES "struct AHandler")
+  message (FATAL_ERROR "a.hpp lacks the handlers of Shared and A")
+endif ()
+if (b MATCHES "struct SharedHandler" OR NOT b MATCHES "struct BHandler")
+  message (FATAL_ERROR "b.hpp should have the handler of B only")
+endif ()
+file (READ ${WORK_DIR}/manifest.txt entries)
+if (NOT entries MATCHES "own\t[0-9a-f]+\t[^\n]*/a\\.hpp\tShared\n")
+  message (FATAL_ERROR "a.hpp doesn't own Shared:\n${entries}")
+endif ()
+if (NOT entries MATCHES "seen\t[0-9a-f]+\t[^\n]*/b\\.hpp\tShared\n")
+  message (FATAL_ERROR "b.hpp didn't remember skipping Shared:\n${entries}")
+endif ()
+
+# the owner keeps generating it
+run_plugin(manifest/A.hpp a.hpp result ${manifest})
+file (READ ${WORK_DIR}/a.hpp a)
+if (NOT result EQUAL 0 OR NOT a MATCHES "struct SharedHandler")
+  message (FATAL_ERROR "A.hpp again: ${result_ERROR}")
+endif ()
+
+run_plugin(manifest/B.hpp c.hpp result ${manifest} -DSHARED_WIDE)
+if (result EQUAL 0)
+  message (FATAL_ERROR "the other definition of Shared was accepted")
+endif ()
+if (NOT result_ERROR MATCHES
+    "record 'Shared' has already been generated into [^\n]*/a\\.hpp from a different definition \\(ODR violation\\)")
+  message (FATAL_ERROR "no ODR violation reported: ${result_ERROR}")
+endif ()
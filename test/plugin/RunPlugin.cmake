@@ -0,0 +1,36 @@
+# Included by the test scripts of this directory, which are run by ctest with
+#   -DJSONGEN_CLANG=<clang++> -DJSONGEN_PLUGIN=<libjsongen>
+#   -DJSONGEN_COMMANDS=<the comment commands, separated by commas>
+#   -DSOURCE_DIR=<this directory> -DWORK_DIR=<an empty directory>
+#
+# run_plugin(<input> <output> <result> [<plugin option or -D flag>...])
+#
+# Runs the plugin like jsongen_generate() does, over <input> of SOURCE_DIR,
+# into <output> of WORK_DIR. Sets <result> to the exit code of clang and
+# <result>_ERROR to what it printed.
+
+file (REMOVE_RECURSE ${WORK_DIR})
+file (MAKE_DIRECTORY ${WORK_DIR})
+
+function (run_plugin input output result)
+  set (clang_args)
+  foreach (arg ${ARGN})
+    if (arg MATCHES "^-D")
+      list (APPEND clang_args ${arg})
+    else ()
+      list (APPEND clang_args -Xclang -plugin-arg-jsongen -Xclang ${arg})
+    endif ()
+  endforeach ()
+  execute_process(
+    COMMAND ${JSONGEN_CLANG} -x c++ -std=c++17 -fsyntax-only
+            -fcomment-block-commands=${JSONGEN_COMMANDS}
+            -Xclang -load -Xclang ${JSONGEN_PLUGIN}
+            -Xclang -plugin -Xclang jsongen
+            -Xclang -plugin-arg-jsongen -Xclang output=${WORK_DIR}/${output}
+            ${clang_args}
+            ${SOURCE_DIR}/${input}
+    RESULT_VARIABLE code
+    ERROR_VARIABLE error)
+  set (${result} ${code} PARENT_SCOPE)
+  set (${result}_ERROR "${error}" PARENT_SCOPE)
+endfunction ()
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "Types.hpp"
+#include "Unused.hpp"
+
+#include <cstdint>
+
+/// \jsongen
+struct Trip {
+  Meters distance;
+  int32_t legs;
+};
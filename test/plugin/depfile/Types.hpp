@@ -0,0 +1,5 @@
+#pragma once
+
+// spells the type of a member of Trip, so Trip depends on it
+
+using Meters = double;
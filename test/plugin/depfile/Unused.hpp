@@ -0,0 +1,7 @@
+#pragma once
+
+// included by Trip.hpp, but nothing of it is emitted
+
+struct Unused {
+  int u;
+};
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "Shared.hpp"
+
+/// \jsongen
+struct A {
+  int32_t a;
+};
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "Shared.hpp"
+
+/// \jsongen
+struct B {
+  int32_t b;
+};
@@ -0,0 +1,15 @@
+#pragma once
+
+// included by both translation units, SHARED_WIDE gives it another
+// definition
+
+#include <cstdint>
+
+/// \jsongen
+struct Shared {
+#ifdef SHARED_WIDE
+  int64_t x;
+#else
+  int32_t x;
+#endif
+};
@@ -0,0 +1,596 @@
+// The generated code at runtime. The bulk path of numeric arrays,
+// jsongen::scanNumbers(), is checked through parse(), and through a reader set
+// up like parse() does, which counts the SAX calls the handler gets: the
+// elements read in bulk don't get one. A std::vector of numbers takes the same
+// path, and grows with the elements it reads. The statement of a \usrString
+// member is checked to get the string, and the members of a base in another
+// namespace to be reached. write() is checked to refuse lists nested deeper
+// than jsongen::kMaxWriteDepth. A \trackDirty record is checked to write the
+// members marked dirty only, and parsePatch() to apply such a delta. The lazy
+// view is checked to decode each member on its own. Files are parsed from their
+// mapping, one document or one per line of ndjson. Failed parses are checked to
+// report their jsongen::ParseError, state and offset. The push parser is fed
+// documents split at every byte, and one byte at a time. The \inlineString
+// members are checked to reject, truncate or spill the strings longer than they
+// hold. parseColumns() is checked to append a row per element of an array, or
+// per document of ndjson.
+//
+//   runtime_test
+//
+// Prints the failed checks, and exits with 1 if there are any.
+
+#include "jsongen.hpp"
+
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char *what, const std::string &doc) {
+  if (!ok) {
+    std::fprintf(stderr, "FAILED: %s: %s\n", what, doc.c_str());
+    ++failures;
+  }
+}
+
+// forwards every SAX call to the generated handler, and counts them
+struct CountingHandler {
+  SamplesHandler &handler;
+  unsigned calls = 0;
+
+  bool Null() {
+    ++calls;
+    return handler.Null();
+  }
+  bool Bool(bool b) {
+    ++calls;
+    return handler.Bool(b);
+  }
+  bool Int(int i) {
+    ++calls;
+    return handler.Int(i);
+  }
+  bool Uint(unsigned u) {
+    ++calls;
+    return handler.Uint(u);
+  }
+  bool Int64(int64_t i) {
+    ++calls;
+    return handler.Int64(i);
+  }
+  bool Uint64(uint64_t u) {
+    ++calls;
+    return handler.Uint64(u);
+  }
+  bool Double(double d) {
+    ++calls;
+    return handler.Double(d);
+  }
+  bool RawNumber(const char *str, rapidjson::SizeType length, bool copy) {
+    ++calls;
+    return handler.RawNumber(str, length, copy);
+  }
+  bool String(const char *str, rapidjson::SizeType length, bool copy) {
+    ++calls;
+    return handler.String(str, length, copy);
+  }
+  bool StartObject() {
+    ++calls;
+    return handler.StartObject();
+  }
+  bool Key(const char *str, rapidjson::SizeType length, bool copy) {
+    ++calls;
+    return handler.Key(str, length, copy);
+  }
+  bool EndObject(rapidjson::SizeType members) {
+    ++calls;
+    return handler.EndObject(members);
+  }
+  bool StartArray() {
+    ++calls;
+    return handler.StartArray();
+  }
+  bool EndArray(rapidjson::SizeType elements) {
+    ++calls;
+    return handler.EndArray(elements);
+  }
+};
+
+struct Case {
+  const char *doc;
+  bool ok;
+  double samples[3];
+  int32_t id;
+  // the SAX calls the handler gets
+  unsigned calls;
+};
+
+const Case cases[] = {
+    // every element in bulk: StartObject, Key, StartArray, EndArray,
+    // EndObject
+    {"{\"samples\":[1,2,3]}", true, {1, 2, 3}, 0, 5},
+    {"{\"samples\":[ 1.5 , -2 , 3e2 ] }", true, {1.5, -2, 300}, 0, 5},
+    // the reader resumes after the ']', + Key, Uint
+    {"{\"samples\":[1,2,3],\"id\":7}", true, {1, 2, 3}, 7, 7},
+    // the reader resumes at null, + Null, Uint
+    {"{\"samples\":[1,null,3]}", true, {1, 0, 3}, 0, 7},
+    // too many elements, or a trailing comma, for the reader to report
+    {"{\"samples\":[1,2,3,4]}", false, {}, 0, 0},
+    {"{\"samples\":[1,2,3,]}", false, {}, 0, 0},
+};
+
+// in-situ parsing destroys its input, every parse gets a copy
+std::vector<char> copy(const char *doc) {
+  return std::vector<char>(doc, doc + std::strlen(doc) + 1);
+}
+
+void checkValues(const Case &c, const Samples &s, const char *what) {
+  for (int i = 0; i != 3; ++i) {
+    check(s.samples[i] == c.samples[i], what, c.doc);
+  }
+  check(s.id == c.id, what, c.doc);
+}
+
+void testBulkArrays() {
+  for (const Case &c : cases) {
+    std::vector<char> buffer = copy(c.doc);
+    Samples s{};
+    check(parse(s, buffer.data()) == c.ok, "parse() result", c.doc);
+    if (c.ok) {
+      checkValues(c, s, "parse() values");
+    }
+
+    buffer = copy(c.doc);
+    Samples counted{};
+    rapidjson::InsituStringStream is(buffer.data());
+    SamplesHandler handler(counted);
+    handler.stream = &is;
+    CountingHandler counting{handler};
+    rapidjson::Reader reader;
+    rapidjson::ParseResult result =
+        reader.Parse<rapidjson::kParseInsituFlag |
+                     rapidjson::kParseIterativeFlag |
+                     rapidjson::kParseStopWhenDoneFlag>(is, counting);
+    bool ok = !result.IsError() && handler.done();
+    check(ok == c.ok, "counted result", c.doc);
+    if (c.ok) {
+      checkValues(c, counted, "counted values");
+      check(counting.calls == c.calls, "SAX calls", c.doc);
+    }
+  }
+}
+
+void testBulkVector() {
+  const char *doc = "{\"values\":[1,2.5,null,-4],\"id\":5}";
+  std::vector<char> buffer = copy(doc);
+  Series s;
+  s.values = {9, 9, 9, 9, 9, 9};
+  check(parse(s, buffer.data()), "parse() result", doc);
+  check(s.values == std::vector<double>{1, 2.5, 0, -4}, "vector values", doc);
+  check(s.id == 5, "parse() values", doc);
+
+  doc = "{\"values\":[]}";
+  buffer = copy(doc);
+  check(parse(s, buffer.data()) && s.values.empty(), "empty vector", doc);
+  doc = "{\"values\":[1,\"2\"]}";
+  buffer = copy(doc);
+  check(!parse(s, buffer.data()), "string element", doc);
+}
+
+void testUsrString() {
+  const char *doc = "{\"name\":\"a\\\"b\",\"id\":3}";
+  std::vector<char> buffer = copy(doc);
+  Named n;
+  check(parse(n, buffer.data()), "parse() result", doc);
+  check(n.name == "a\"b", "\\usrString value", doc);
+  check(n.id == 3, "parse() values", doc);
+}
+
+void testQualifiedBase() {
+  const char *doc = "{\"x\":1,\"y\":2,\"label\":3}";
+  std::vector<char> buffer = copy(doc);
+  Labeled l{};
+  check(parse(l, buffer.data()), "parse() result", doc);
+  check(l.x == 1 && l.y == 2 && l.label == 3, "base values", doc);
+}
+
+// a list of length links, written
+bool writeList(size_t length) {
+  std::vector<Link> links(length);
+  for (size_t i = 0; i != length; ++i) {
+    links[i].value = static_cast<int32_t>(i);
+    links[i].next = i + 1 == length ? nullptr : &links[i + 1];
+  }
+  rapidjson::StringBuffer buffer;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+  return write(links[0], writer);
+}
+
+void testWriteDepth() {
+  check(writeList(jsongen::kMaxWriteDepth), "write() of the deepest list",
+        "");
+  check(!writeList(jsongen::kMaxWriteDepth + 2), "write() too deep", "");
+}
+
+// what write() or writeDelta() writes with a rapidjson::Writer
+template <typename Write> std::string written(Write &&write) {
+  rapidjson::StringBuffer buffer;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+  return write(writer) ? buffer.GetString() : "<failed>";
+}
+
+void testDirtyTracking() {
+  AccountTracked tracked;
+  tracked.value = Account{1, 100, true};
+  auto delta = [&] {
+    return written([&](rapidjson::Writer<rapidjson::StringBuffer> &writer) {
+      return writeDelta(tracked, writer);
+    });
+  };
+  check(!tracked.any() && delta() == "{}", "nothing dirty", delta());
+  tracked.set_balance(250);
+  check(tracked.any() && tracked.value.balance == 250, "set_balance()",
+        delta());
+  check(delta() == "{\"balance\":250}", "writeDelta() of a setter", delta());
+  tracked.value.active = false;
+  tracked.mark_active();
+  check(delta() == "{\"balance\":250,\"active\":false}",
+        "writeDelta() of a mark", delta());
+
+  // the delta applied to the object it came from
+  Account patched{1, 100, true};
+  std::string doc = delta();
+  std::vector<char> buffer = copy(doc.c_str());
+  check(parsePatch(patched, buffer.data()), "parsePatch() result", doc);
+  check(patched.id == 1 && patched.balance == 250 && !patched.active,
+        "parsePatch() values", doc);
+  // which parse() rejects, it lacks the \required id
+  buffer = copy(doc.c_str());
+  Account parsed{};
+  check(!parse(parsed, buffer.data()), "parse() of a delta", doc);
+
+  tracked.clear();
+  check(!tracked.any() && delta() == "{}", "clear()", delta());
+  tracked.markAll();
+  std::string all =
+      written([&](rapidjson::Writer<rapidjson::StringBuffer> &writer) {
+        return write(tracked.value, writer);
+      });
+  check(delta() == all, "markAll() writes what write() does", delta());
+}
+
+void testView() {
+  const char *doc =
+      "{\"active\":true, \"extra\":[1,{\"a\":\"}\"}], \"id\":7, "
+      "\"balance\":\"oops\"}";
+  std::vector<char> buffer = copy(doc);
+  AccountView view;
+  check(view.open(buffer.data()), "open()", doc);
+  // an invalid member doesn't keep the others from being decoded
+  const int64_t *balance = view.get_balance();
+  check(!balance, "get_balance() of a string", doc);
+  const int32_t *id = view.get_id();
+  check(id && *id == 7, "get_id()", doc);
+  check(view.get_id() == id, "get_id() again", doc);
+  const bool *active = view.get_active();
+  check(active && *active, "get_active()", doc);
+
+  doc = "{\"id\":8}";
+  buffer = copy(doc);
+  check(view.open(buffer.data()), "open() again", doc);
+  id = view.get_id();
+  check(id && *id == 8, "get_id() after open()", doc);
+  check(!view.get_active(), "get_active() of a missing member", doc);
+
+  doc = "[1]";
+  buffer = copy(doc);
+  check(!view.open(buffer.data()), "open() of an array", doc);
+}
+
+// a temporary file holding content, removed by the destructor
+struct TempFile {
+  char path[32] = "/tmp/jsongen_runtime_XXXXXX";
+  explicit TempFile(const std::string &content) {
+    int fd = mkstemp(path);
+    if (fd < 0 || ::write(fd, content.data(), content.size()) !=
+                      static_cast<ssize_t>(content.size())) {
+      std::perror(path);
+      std::exit(1);
+    }
+    ::close(fd);
+  }
+  ~TempFile() { ::unlink(path); }
+};
+
+void testParseFile() {
+  std::string doc = "{\"name\":\"a\\\"b\",\"size\":3}";
+  TempFile file(doc);
+  jsongen::MappedFile mapped;
+  Entry e{};
+  check(parse_file(e, mapped, file.path), "parse_file() result", doc);
+  check(e.size == 3 && std::strcmp(e.name, "a\"b") == 0,
+        "parse_file() values", doc);
+  // the strings point into the mapping
+  check(e.name >= mapped.data() && e.name < mapped.data() + mapped.size(),
+        "parse_file() strings", doc);
+
+  // no byte after the file in its last page, the '\0' is on the next one
+  doc = "{\"name\":\"x\",\"size\":1}";
+  doc.resize(static_cast<size_t>(sysconf(_SC_PAGESIZE)), ' ');
+  TempFile page(doc);
+  check(parse_file(e, mapped, page.path) && e.size == 1,
+        "parse_file() of a whole page", "");
+
+  jsongen::ErrorInfo error;
+  check(!parse_file(e, mapped, "/nonexistent/jsongen.json", &error) &&
+            error.code == jsongen::ParseError::Io,
+        "parse_file() of a missing file", "");
+}
+
+void testParseNdjson() {
+  std::string doc = "{\"name\":\"a\",\"size\":1}\n"
+                    "{\"name\":\"b\",\"size\":2}\r\n\n"
+                    "  {\"name\":\"c\",\"size\":3}\n";
+  TempFile file(doc);
+  jsongen::MappedFile mapped;
+  Entry e{};
+  std::string names;
+  int32_t sizes = 0;
+  auto all = [&](const Entry &entry) {
+    names += entry.name;
+    sizes += entry.size;
+    return true;
+  };
+  check(parse_ndjson_file(e, mapped, file.path, all), "ndjson result", doc);
+  check(names == "abc" && sizes == 6, "ndjson documents", doc);
+
+  // stopped by the callback after the second document
+  names.clear();
+  auto two = [&](const Entry &entry) {
+    names += entry.name;
+    return names.size() != 2;
+  };
+  check(parse_ndjson_file(e, mapped, file.path, two) && names == "ab",
+        "ndjson stopped", doc);
+
+  // the documents before an invalid one are handed over
+  doc = "{\"name\":\"a\",\"size\":1}\n{\"name\":1}\n";
+  TempFile invalid(doc);
+  names.clear();
+  check(!parse_ndjson_file(e, mapped, invalid.path, all) && names == "a",
+        "ndjson with an invalid document", doc);
+}
+
+struct ErrorCase {
+  const char *doc;
+  jsongen::ParseError code;
+  // the state of the handler, nullptr for the errors of the reader
+  const char *state;
+};
+
+const ErrorCase errors[] = {
+    {"{\"id\":1,", jsongen::ParseError::Syntax, nullptr},
+    {"[1]", jsongen::ParseError::UnexpectedToken, "S_start"},
+    {"{\"id\":1,\"balance\":1.5}", jsongen::ParseError::TypeMismatch,
+     "S_Mbalance"},
+    {"{\"id\":3000000000}", jsongen::ParseError::OutOfRange, "S_Mid"},
+    {"{\"id\":1,\"nope\":1}", jsongen::ParseError::UnknownKey,
+     "S_expect_key"},
+    {"{\"id\":1,\"id\":2}", jsongen::ParseError::DuplicateMember, "S_Mid"},
+    {"{\"balance\":1}", jsongen::ParseError::MissingMember, "S_Mid"},
+};
+
+void testErrors() {
+  for (const ErrorCase &c : errors) {
+    std::vector<char> buffer = copy(c.doc);
+    Account a{};
+    jsongen::ErrorInfo error;
+    check(!parse(a, buffer.data(), &error) && error.code == c.code,
+          jsongen::describe(c.code), c.doc);
+    check(c.state ? error.state && std::strcmp(error.state, c.state) == 0
+                  : !error.state,
+          "error state", c.doc);
+  }
+
+  // just past the key
+  const char *doc = "{\"id\":1,\"nope\":1}";
+  std::vector<char> buffer = copy(doc);
+  Account a{};
+  jsongen::ErrorInfo error;
+  check(!parse(a, buffer.data(), &error) && error.offset == 14,
+        "error offset", doc);
+
+  doc = "{\"samples\":[1,2,3,4]}";
+  buffer = copy(doc);
+  Samples s{};
+  check(!parse(s, buffer.data(), &error) &&
+            error.code == jsongen::ParseError::ArrayLength,
+        jsongen::describe(jsongen::ParseError::ArrayLength), doc);
+
+  // a parse that succeeds clears what the previous one left
+  doc = "{\"id\":1}";
+  buffer = copy(doc);
+  check(parse(a, buffer.data(), &error) &&
+            error.code == jsongen::ParseError::None && !error.state,
+        "error after a success", doc);
+}
+
+// the document fed to a push parser in the chunks split cuts it into
+template <typename Parser, typename Record>
+bool pushed(Record &r, const std::string &doc,
+            const std::vector<size_t> &split, jsongen::ErrorInfo *error) {
+  Parser parser(r, error);
+  size_t begin = 0;
+  for (size_t end : split) {
+    if (!parser.feed(doc.data() + begin, end - begin)) {
+      return false;
+    }
+    begin = end;
+  }
+  return parser.feed(doc.data() + begin, doc.size() - begin) &&
+         parser.finish();
+}
+
+void testPushSplit() {
+  std::string doc = "{ \"name\" : \"a\\\"b\\u00e9\", \"size\":-123 }";
+  for (size_t i = 0; i <= doc.size(); ++i) {
+    std::string cut = doc.substr(0, i) + "|" + doc.substr(i);
+    Entry e{};
+    EntryPushParser parser(e);
+    check(parser.feed(doc.data(), i) &&
+              parser.feed(doc.data() + i, doc.size() - i) && parser.finish(),
+          "push split result", cut);
+    // the name points into the parser, checked while it lives
+    check(e.name && std::strcmp(e.name, "a\"b\xC3\xA9") == 0 &&
+              e.size == -123,
+          "push split values", cut);
+  }
+
+  // one byte at a time, every token cut
+  doc = "{\"id\":12,\"balance\":-9876543210,\"active\":true}";
+  std::vector<size_t> every;
+  for (size_t i = 1; i != doc.size(); ++i) {
+    every.push_back(i);
+  }
+  Account a{};
+  check(pushed<AccountPushParser>(a, doc, every, nullptr) && a.id == 12 &&
+            a.balance == -9876543210 && a.active,
+        "push byte by byte", doc);
+
+  // what follows the document is left to the caller
+  doc = "{\"id\":1} {\"id\":2}";
+  AccountPushParser parser(a);
+  check(parser.feed(doc.data(), doc.size()) && parser.done() &&
+            parser.tail() == 9 && a.id == 1,
+        "push tail()", doc);
+
+  // an invalid document fails wherever it is cut, with the same error
+  doc = "{\"id\":1,\"balance\":1.5}";
+  for (size_t i = 0; i <= doc.size(); ++i) {
+    jsongen::ErrorInfo error;
+    check(!pushed<AccountPushParser>(a, doc, {i}, &error) &&
+              error.code == jsongen::ParseError::TypeMismatch,
+          "push split error", doc.substr(0, i) + "|" + doc.substr(i));
+  }
+  // and an incomplete one at finish()
+  doc = "{\"id\":1,\"bal";
+  jsongen::ErrorInfo error;
+  check(!pushed<AccountPushParser>(a, doc, {4}, &error), "push incomplete",
+        doc);
+}
+
+void testInlineStrings() {
+  const char *doc = "{\"code\":\"abc\",\"label\":\"xy\",\"note\":\"short\"}";
+  std::vector<char> buffer = copy(doc);
+  Tag t{};
+  check(parse(t, buffer.data()), "parse() result", doc);
+  check(std::strcmp(t.code, "abc") == 0 && std::strcmp(t.label, "xy") == 0,
+        "inline char arrays", doc);
+  check(!t.note.isSpilled() && std::string(t.note.data()) == "short" &&
+            t.note.size() == 5,
+        "inline string", doc);
+  std::string text =
+      written([&](rapidjson::Writer<rapidjson::StringBuffer> &writer) {
+        return write(t, writer);
+      });
+  check(text == doc, "write() of inline strings", text);
+
+  // one byte too many for the char[4] of code
+  doc = "{\"code\":\"abcd\"}";
+  buffer = copy(doc);
+  jsongen::ErrorInfo error;
+  check(!parse(t, buffer.data(), &error) &&
+            error.code == jsongen::ParseError::StringTooLong,
+        "reject a long string", doc);
+
+  // cut before the character that doesn't fit: "abcd" and two bytes of the
+  // three of \u20ac would fill the char[6]
+  doc = "{\"label\":\"abcd\u20ac\"}";
+  buffer = copy(doc);
+  check(parse(t, buffer.data()) && std::strcmp(t.label, "abcd") == 0,
+        "truncate at a character", doc);
+  doc = "{\"label\":\"ab\u20ac\"}";
+  buffer = copy(doc);
+  check(parse(t, buffer.data()) &&
+            std::strcmp(t.label, "ab\xE2\x82\xAC") == 0,
+        "truncate a string that fits", doc);
+
+  // pointed to in the input, which holds it past the parse
+  doc = "{\"note\":\"a longer note\"}";
+  buffer = copy(doc);
+  check(parse(t, buffer.data()) && t.note.isSpilled() &&
+            t.note.size() == 13 &&
+            std::string(t.note.data(), t.note.size()) == "a longer note",
+        "spill a long string", doc);
+  check(t.note.data() >= buffer.data() &&
+            t.note.data() < buffer.data() + buffer.size(),
+        "spilled into the input", doc);
+}
+
+void testColumns() {
+  const char *doc = "[{\"id\":1,\"balance\":10,\"active\":true},\n"
+                    " {\"id\":2,\"active\":false} , {\"id\":3,\"balance\":-5}]";
+  std::vector<char> buffer = copy(doc);
+  AccountColumns columns;
+  check(parseColumns(columns, buffer.data()), "parseColumns() of an array",
+        doc);
+  check(columns.size() == 3 && columns.id == std::vector<int32_t>{1, 2, 3} &&
+            columns.balance == std::vector<int64_t>{10, 0, -5} &&
+            columns.active == std::vector<uint8_t>{1, 0, 0},
+        "columns of an array", doc);
+
+  // appended to the rows already there
+  doc = "{\"id\":4}\n{\"id\":5,\"balance\":7}\n";
+  buffer = copy(doc);
+  check(parseColumns(columns, buffer.data()) && columns.size() == 5 &&
+            columns.id[4] == 5 && columns.balance[4] == 7,
+        "parseColumns() of ndjson", doc);
+  doc = " [ ] ";
+  buffer = copy(doc);
+  check(parseColumns(columns, buffer.data()) && columns.size() == 5,
+        "parseColumns() of an empty array", doc);
+
+  // the rows before a failed one are kept
+  columns.clear();
+  doc = "[{\"id\":6},{\"balance\":1},{\"id\":8}]";
+  buffer = copy(doc);
+  jsongen::ErrorInfo error;
+  check(!parseColumns(columns, buffer.data(), &error) &&
+            error.code == jsongen::ParseError::MissingMember &&
+            columns.size() == 1 && columns.id[0] == 6,
+        "parseColumns() of a failed row", doc);
+  doc = "[{\"id\":6} {\"id\":7}]";
+  buffer = copy(doc);
+  check(!parseColumns(columns, buffer.data(), &error) &&
+            error.code == jsongen::ParseError::Syntax,
+        "parseColumns() without a comma", doc);
+}
+
+} // namespace
+
+int main() {
+  testBulkArrays();
+  testBulkVector();
+  testUsrString();
+  testQualifiedBase();
+  testWriteDepth();
+  testDirtyTracking();
+  testView();
+  testParseFile();
+  testParseNdjson();
+  testErrors();
+  testPushSplit();
+  testInlineStrings();
+  testColumns();
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+// the records RuntimeTest.cpp parses
+
+#include "JsonGenInlineString.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// \jsongen
+struct Samples {
+  double samples[3];
+  int32_t id;
+};
+
+/// \jsongen
+struct Series {
+  std::vector<double> values;
+  int32_t id;
+};
+
+/// \jsongen
+struct Named {
+  /// \usrString $$.assign(str, length);
+  std::string name;
+  int32_t id;
+};
+
+namespace geo {
+struct Point {
+  int32_t x;
+  int32_t y;
+};
+} // namespace geo
+
+/// \jsongen
+struct Labeled : geo::Point {
+  int32_t label;
+};
+
+/// \jsongen
+struct Link {
+  int32_t value;
+  Link *next;
+};
+
+/// \jsongen
+/// \trackDirty
+struct Account {
+  /// \required
+  int32_t id;
+  int64_t balance;
+  bool active;
+};
+
+/// \jsongen
+struct Entry {
+  /// \cstring
+  const char *name;
+  int32_t size;
+};
+
+/// \jsongen
+struct Tag {
+  /// \inlineString
+  char code[4];
+  /// \inlineString truncate
+  char label[6];
+  /// \inlineString spill
+  jsongen::InlineString<6> note;
+};
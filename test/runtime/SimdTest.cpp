@@ -0,0 +1,194 @@
+// The string scans of JsonGenSimd.hpp, every version the CPU can run checked
+// against the expected result: sequences placed across every offset of the
+// blocks, surrogates, overlong forms, code points above U+10FFFF, sequences
+// cut short, and the characters findEscape() stops at.
+//
+//   runtime_simd_test
+//
+// Prints the failed checks, and exits with 1 if there are any.
+
+#include "JsonGenSimd.hpp"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char *what, const std::string &input) {
+  if (!ok) {
+    std::string hex;
+    for (unsigned char c : input) {
+      char byte[4];
+      std::snprintf(byte, sizeof(byte), "%02x ", c);
+      hex += byte;
+    }
+    std::fprintf(stderr, "FAILED: %s: %s\n", what, hex.c_str());
+    ++failures;
+  }
+}
+
+struct Version {
+  const char *name;
+  bool (*validUtf8)(const char *, size_t);
+  size_t (*findEscape)(const char *, size_t);
+};
+
+size_t findEscapeScalar(const char *s, size_t n) {
+  return jsongen::detail::findEscapeScalar(s, 0, n);
+}
+
+std::vector<Version> versions() {
+  std::vector<Version> ret = {
+      {"portable", jsongen::detail::validUtf8Portable, findEscapeScalar},
+      {"dispatched", jsongen::validUtf8, jsongen::findEscape}};
+#ifdef JSONGEN_X86_SIMD
+  ret.push_back({"sse2", jsongen::detail::validUtf8Sse2,
+                 jsongen::detail::findEscapeSse2});
+  if (jsongen::detail::hasSsse3()) {
+    ret.push_back({"ssse3", jsongen::detail::validUtf8Ssse3,
+                   jsongen::detail::findEscapeSse2});
+  }
+  if (jsongen::detail::hasAvx2()) {
+    ret.push_back({"avx2", jsongen::detail::validUtf8Avx2,
+                   jsongen::detail::findEscapeAvx2});
+  }
+#endif
+  return ret;
+}
+
+void checkUtf8(const std::string &input, bool valid) {
+  for (const Version &v : versions()) {
+    std::string what = std::string(v.name) + " validUtf8()";
+    check(v.validUtf8(input.data(), input.size()) == valid, what.c_str(),
+          input);
+  }
+}
+
+struct Sequence {
+  const char *bytes;
+  bool valid;
+};
+
+const Sequence sequences[] = {
+    {"\xC2\x80", true},
+    {"\xDF\xBF", true},
+    {"\xE0\xA0\x80", true},
+    {"\xED\x9F\xBF", true},
+    {"\xEE\x80\x80", true},
+    {"\xEF\xBF\xBF", true},
+    {"\xF0\x90\x80\x80", true},
+    {"\xF4\x8F\xBF\xBF", true},
+    // overlong
+    {"\xC0\x80", false},
+    {"\xC1\xBF", false},
+    {"\xE0\x9F\xBF", false},
+    {"\xF0\x8F\xBF\xBF", false},
+    // surrogates
+    {"\xED\xA0\x80", false},
+    {"\xED\xBF\xBF", false},
+    {"\xED\xA0\xBD\xED\xB8\x80", false},
+    // above U+10FFFF
+    {"\xF4\x90\x80\x80", false},
+    {"\xF5\x80\x80\x80", false},
+    {"\xFF", false},
+    // a continuation without a lead byte, or too many of them
+    {"\x80", false},
+    {"\xC2\x80\x80", false},
+    // a lead byte without enough continuations
+    {"\xC2", false},
+    {"\xE0\xA0", false},
+    {"\xF0\x90\x80", false},
+    {"\xE0\xA0" "a", false},
+    {"\xF0\x90\x80" "a", false},
+};
+
+// every sequence at every offset of a run of ASCII spanning a few blocks,
+// followed by ASCII, and cut at the end of the input
+void testUtf8() {
+  for (const Sequence &s : sequences) {
+    std::string bytes = s.bytes;
+    for (size_t offset = 0; offset != 70; ++offset) {
+      std::string input(offset, 'a');
+      checkUtf8(input + bytes, s.valid);
+      checkUtf8(input + bytes + std::string(40, 'b'), s.valid);
+      checkUtf8(input + bytes + "\xE2\x82\xAC", s.valid);
+    }
+  }
+  // a valid sequence cut at every byte, at every offset
+  const std::string euro4 = "\xF0\x9F\x98\x80";
+  for (size_t offset = 0; offset != 70; ++offset) {
+    std::string input(offset, 'a');
+    for (size_t cut = 1; cut != euro4.size(); ++cut) {
+      checkUtf8(input + euro4.substr(0, cut), false);
+      checkUtf8(input + euro4.substr(0, cut) + std::string(40, 'b'), false);
+    }
+  }
+  // multi-byte text only, so no block is all ASCII
+  std::string text;
+  for (int i = 0; i != 40; ++i) {
+    text += "\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80";
+  }
+  checkUtf8(text, true);
+  checkUtf8("", true);
+}
+
+// pseudo-random bytes, mostly well-formed, each version against the
+// portable one
+void testUtf8Random() {
+  uint32_t seed = 12345;
+  auto next = [&seed] {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 16;
+  };
+  const char *pieces[] = {"a", "\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80",
+                          "\xED\x9F\xBF", "\xF4\x8F\xBF\xBF"};
+  for (int round = 0; round != 2000; ++round) {
+    std::string input;
+    size_t pieces_count = next() % 40;
+    for (size_t i = 0; i != pieces_count; ++i) {
+      input += pieces[next() % 6];
+    }
+    if (!input.empty() && next() % 2) {
+      input[next() % input.size()] = static_cast<char>(next());
+    }
+    checkUtf8(input, jsongen::detail::validUtf8Portable(input.data(),
+                                                        input.size()));
+  }
+}
+
+// each character json escapes at every offset, behind ASCII and behind bytes
+// it doesn't escape
+void testFindEscape() {
+  const char escaped[] = {'"', '\\', '\0', '\x01', '\n', '\x1F'};
+  const std::string fillers[] = {"a", "\x7F", "\x80", " ", "\xFF"};
+  for (const std::string &filler : fillers) {
+    for (size_t offset = 0; offset != 70; ++offset) {
+      std::string prefix;
+      for (size_t i = 0; i != offset; ++i) {
+        prefix += filler;
+      }
+      for (const Version &v : versions()) {
+        std::string what = std::string(v.name) + " findEscape()";
+        check(v.findEscape(prefix.data(), prefix.size()) == prefix.size(),
+              what.c_str(), prefix);
+        for (char c : escaped) {
+          std::string input = prefix + c + std::string(40, 'x') + '"';
+          check(v.findEscape(input.data(), input.size()) == prefix.size(),
+                what.c_str(), input);
+        }
+      }
+    }
+  }
+}
+
+} // namespace
+
+int main() {
+  testUtf8();
+  testUtf8Random();
+  testFindEscape();
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+// the records TableTest.cpp parses, which the tables of the table-driven
+// mode can describe
+
+#include <cstdint>
+
+/// \jsongen
+struct Reading {
+  /// \required
+  uint32_t sensor;
+  int8_t offset;
+  int64_t timestamp;
+  float gain;
+  double value;
+  bool calibrated;
+  /// \cstring
+  const char *unit;
+};
@@ -0,0 +1,112 @@
+// The switch handlers and the table-driven mode, held to the same checks:
+// this file is built once over the code of each mode, runtime_switch_test
+// and runtime_table_test (JSONGEN_TEST_TABLES), and both have to accept the
+// same documents into the same values, reject the others with the same
+// jsongen::ParseError, and write the same text.
+//
+//   runtime_switch_test
+//   runtime_table_test
+//
+// Prints the failed checks, and exits with 1 if there are any.
+
+#include "jsongen.hpp"
+
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifdef JSONGEN_TEST_TABLES
+static_assert(std::is_base_of<jsongen::TableHandler, ReadingHandler>::value,
+              "Reading has to be table-driven");
+#endif
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char *what, const std::string &doc) {
+  if (!ok) {
+    std::fprintf(stderr, "FAILED: %s: %s\n", what, doc.c_str());
+    ++failures;
+  }
+}
+
+std::vector<char> copy(const char *doc) {
+  return std::vector<char>(doc, doc + std::strlen(doc) + 1);
+}
+
+std::string written(const Reading &r) {
+  rapidjson::StringBuffer buffer;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+  return write(r, writer) ? buffer.GetString() : "<failed>";
+}
+
+void testValues() {
+  const char *doc = "{\"unit\":\"hPa\",\"sensor\":7,\"offset\":-128,"
+                    "\"timestamp\":-9000000000,\"gain\":2,\"value\":1.25,"
+                    "\"calibrated\":true}";
+  std::vector<char> buffer = copy(doc);
+  Reading r{};
+  check(parse(r, buffer.data()), "parse() result", doc);
+  check(r.sensor == 7 && r.offset == -128 && r.timestamp == -9000000000 &&
+            r.gain == 2 && r.value == 1.25 && r.calibrated && r.unit &&
+            std::strcmp(r.unit, "hPa") == 0,
+        "parse() values", doc);
+  std::string text = written(r);
+  check(text == "{\"sensor\":7,\"offset\":-128,\"timestamp\":-9000000000,"
+                "\"gain\":2.0,\"value\":1.25,\"calibrated\":true,"
+                "\"unit\":\"hPa\"}",
+        "write()", text);
+
+  // null zeroes the member, also a \required one
+  doc = "{\"sensor\":null,\"gain\":null,\"unit\":null}";
+  buffer = copy(doc);
+  check(parse(r, buffer.data()), "parse() of nulls", doc);
+  check(r.sensor == 0 && r.gain == 0 && !r.unit, "null values", doc);
+  text = written(r);
+  check(text.find("\"unit\":null") != std::string::npos, "write() of null",
+        text);
+}
+
+struct ErrorCase {
+  const char *doc;
+  jsongen::ParseError code;
+};
+
+const ErrorCase errors[] = {
+    {"{\"sensor\":1", jsongen::ParseError::Syntax},
+    {"{\"sensor\":1,\"offset\":200}", jsongen::ParseError::OutOfRange},
+    {"{\"sensor\":-1}", jsongen::ParseError::OutOfRange},
+    {"{\"sensor\":1,\"calibrated\":1}", jsongen::ParseError::TypeMismatch},
+    {"{\"sensor\":1.5}", jsongen::ParseError::TypeMismatch},
+    {"{\"sensor\":1,\"unit\":5}", jsongen::ParseError::TypeMismatch},
+    {"{\"sensor\":1,\"value\":[1]}", jsongen::ParseError::UnexpectedToken},
+    {"{\"sensor\":1,\"value\":{}}", jsongen::ParseError::UnexpectedToken},
+    {"[]", jsongen::ParseError::UnexpectedToken},
+    {"{\"sensor\":1,\"x\":1}", jsongen::ParseError::UnknownKey},
+    {"{\"sensor\":1,\"sensor\":2}", jsongen::ParseError::DuplicateMember},
+    {"{\"value\":1}", jsongen::ParseError::MissingMember},
+};
+
+void testErrors() {
+  for (const ErrorCase &c : errors) {
+    std::vector<char> buffer = copy(c.doc);
+    Reading r{};
+    jsongen::ErrorInfo error;
+    check(!parse(r, buffer.data(), &error) && error.code == c.code,
+          jsongen::describe(c.code), c.doc);
+  }
+}
+
+} // namespace
+
+int main() {
+  testValues();
+  testErrors();
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,136 @@
+// The runtime shared by threads: jsongen::InternTable, interned into and
+// read from by every thread at once, and jsongen::RecordMetrics, counted
+// into by threads that come and go while others take snapshots.
+//
+//   runtime_thread_test
+//
+// Prints the failed checks, and exits with 1 if there are any.
+
+#include "JsonGenIntern.hpp"
+#include "JsonGenMetrics.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr unsigned kThreads = 8;
+
+std::atomic<int> failures{0};
+
+void check(bool ok, const char *what) {
+  if (!ok) {
+    std::fprintf(stderr, "FAILED: %s\n", what);
+    ++failures;
+  }
+}
+
+// Every thread interns the same strings, each in an order of its own, and
+// reads back every id it got. They all have to agree on the ids.
+void testIntern() {
+  constexpr unsigned kStrings = 5000;
+  jsongen::InternTable table;
+  std::vector<std::string> strings;
+  for (unsigned i = 0; i != kStrings; ++i) {
+    strings.push_back("string " + std::to_string(i));
+  }
+  std::vector<std::vector<uint32_t>> ids(kThreads,
+                                         std::vector<uint32_t>(kStrings));
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t != kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      for (unsigned n = 0; n != kStrings; ++n) {
+        unsigned i = (n * 7919 + t * 997) % kStrings;
+        jsongen::InternedString s =
+            table.intern(strings[i].data(), strings[i].size());
+        ids[t][i] = s.id;
+        check(s.id != 0 && strings[i] == s.data, "intern() content");
+        jsongen::InternedString got = table.get(s.id);
+        check(got.data == s.data && got.size == s.size && got.id == s.id,
+              "get() of a fresh id");
+      }
+    });
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  check(table.size() == kStrings, "size() after the threads");
+  std::vector<bool> taken(kStrings + 1);
+  for (unsigned i = 0; i != kStrings; ++i) {
+    uint32_t id = ids[0][i];
+    for (unsigned t = 1; t != kThreads; ++t) {
+      check(ids[t][i] == id, "the threads agree on the id");
+    }
+    check(id >= 1 && id <= kStrings && !taken[id], "ids are 1..size()");
+    if (id >= 1 && id <= kStrings) {
+      taken[id] = true;
+    }
+    check(strings[i] == table.get(id).data, "get() after the threads");
+  }
+}
+
+// Half the threads exit, and their counts are retired, while the others
+// still count; snapshots are taken all along and never go backwards.
+void testMetrics() {
+  constexpr unsigned kDocuments = 20000;
+  static const char *const states[] = {"S_start", "S_expect_key", "S_end",
+                                       "S_Mx"};
+  static jsongen::RecordMetrics metrics("Threaded", states, 4);
+  std::atomic<bool> counting{true};
+  std::thread snapshots([&] {
+    uint64_t last = 0;
+    while (counting.load()) {
+      jsongen::MetricsSnapshot s = metrics.snapshot();
+      check(s.documents >= last, "snapshots don't go backwards");
+      check(s.documents <= kThreads * kDocuments, "snapshot within bounds");
+      last = s.documents;
+    }
+  });
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t != kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      for (unsigned n = 0; n != kDocuments; ++n) {
+        bool ok = n % 10 != 0;
+        metrics.document(ok, 100, 1 + t,
+                         ok ? jsongen::ParseError::None
+                            : jsongen::ParseError::TypeMismatch);
+        if (!ok) {
+          metrics.error(3);
+        }
+      }
+    });
+  }
+  // the first half is done and retired while the second half may still run
+  for (unsigned t = 0; t != kThreads / 2; ++t) {
+    threads[t].join();
+  }
+  jsongen::MetricsSnapshot half = metrics.snapshot();
+  check(half.documents >= kThreads / 2 * kDocuments, "retired threads count");
+  for (unsigned t = kThreads / 2; t != kThreads; ++t) {
+    threads[t].join();
+  }
+  counting.store(false);
+  snapshots.join();
+
+  jsongen::MetricsSnapshot s = metrics.snapshot();
+  check(s.documents == kThreads * kDocuments, "documents");
+  check(s.failures == kThreads * kDocuments / 10, "failures");
+  check(s.bytes == uint64_t(kThreads) * kDocuments * 100, "bytes");
+  check(s.max_depth == kThreads, "max_depth");
+  check(s.errors[static_cast<size_t>(jsongen::ParseError::TypeMismatch)] ==
+            s.failures,
+        "errors by code");
+  check(s.state_errors.size() == 1 && s.state_errors[0].second == s.failures,
+        "errors by state");
+}
+
+} // namespace
+
+int main() {
+  testIntern();
+  testMetrics();
+  return failures ? 1 : 0;
+}